@@ -15,18 +15,69 @@
 #include "common.h"
 
 #include "clock.h"
+#include "lock.h"
+#include "vdata.h"
 #include "process.h"
 #include "queues.h"
 #include "scheduler.h"
+#include "stacks.h"
+#include "syscalls.h"
 
 /*
 ** PRIVATE DEFINITIONS
 */
 
+// The sleep queue is a hierarchical timing wheel.  Level 0 has one
+// slot per tick for the next 256 ticks; each higher level has 64
+// slots, each covering one full turn of the level below it.  Five
+// levels cover the whole 32-bit range of time_t.
+//
+// Inserting or cancelling a sleeper is O(1).  Each tick empties one
+// level 0 slot; every 256 ticks, one slot of the next level up is
+// redistributed ("cascaded") into the levels below it.
+
+#define WHEEL_L0_BITS   8
+#define WHEEL_LN_BITS   6
+#define WHEEL_L0_SIZE   (1 << WHEEL_L0_BITS)
+#define WHEEL_LN_SIZE   (1 << WHEEL_LN_BITS)
+#define WHEEL_LEVELS    5
+
+// first bit of the time value used to index level n (n > 0)
+#define WHEEL_SHIFT(n)  (WHEEL_L0_BITS + ((n) - 1) * WHEEL_LN_BITS)
+
+// slot index of time t within level n (n > 0)
+#define WHEEL_INDEX(t,n) (((t) >> WHEEL_SHIFT(n)) & (WHEEL_LN_SIZE - 1))
+
+// PIT counts per tick, and the longest one-shot delay the 16-bit
+// counter can hold (about 54 ticks)
+#define PIT_DIVISOR      (TIMER_FREQUENCY / CLOCK_FREQUENCY)
+#define ONESHOT_MAX      (0xffff / PIT_DIVISOR)
+
+// TSC calibration uses PIT channel 2, whose gate and output are
+// controlled and read through the keyboard controller's port B
+#define PIT_PORT_B       0x61
+#define PORT_B_GATE2     0x01    // channel 2 gate
+#define PORT_B_SPEAKER   0x02    // channel 2 output to the speaker
+#define PORT_B_OUT2      0x20    // channel 2 output state
+
+// length of the calibration interval, in ms
+#define CALIBRATE_MS     10
+
+// a nanosleep() deadline this close is due (about one PIT count)
+#define FINE_SLACK       (NS_PER_MS / PIT_DIVISOR)
+
 /*
 ** PRIVATE DATA TYPES
 */
 
+// one level of the timing wheel; bit n of map is set iff slot[n]
+// is non-empty
+typedef struct wheel_s {
+    pcbq_t *slot;
+    uint32_t size;
+    uint32_t map[WHEEL_L0_SIZE / 32];
+} wheel_t;
+
 /*
 ** PRIVATE GLOBAL VARIABLES
 */
@@ -35,6 +86,41 @@
 static uint32_t _pinwheel;   // pinwheel counter
 static uint32_t _pindex;     // index into pinwheel string
 
+// timing wheel slots and levels
+static pcbq_t _wheel0[WHEEL_L0_SIZE];
+static pcbq_t _wheeln[WHEEL_LEVELS - 1][WHEEL_LN_SIZE];
+static wheel_t _wheel[WHEEL_LEVELS];
+
+// the next tick the wheel will process
+static time_t _wheel_time;
+
+// number of processes on the wheel
+static uint32_t _wheel_count;
+
+// protects the wheel and the two variables above
+static spinlock_t _wheel_lock;
+
+// while idle, the number of ticks the PIT was set to count (else 0)
+static uint32_t _oneshot;
+
+// nanosleep() sleepers taken off the wheel at the last tick before
+// their deadlines; they are woken between ticks (see _clk_nsleep()).
+// Also protected by _wheel_lock, and counted in _wheel_count.
+static pcbq_t _fine;
+
+// time of the last tick, from _clk_ns()
+static uint64_t _tick_ns;
+
+// between ticks, the PIT is in one-shot mode, counting down to a
+// wakeup from _fine or (after that) to the end of the tick; this
+// is when it will fire
+static bool_t _fine_due;
+static bool_t _fine_rest;
+static uint64_t _fine_at;
+
+// TSC value when the clock module was initialized
+static uint64_t _tsc_base;
+
 /*
 ** PUBLIC GLOBAL VARIABLES
 */
@@ -42,42 +128,313 @@ static uint32_t _pindex;     // index into pinwheel string
 // current system time
 time_t _system_time;
 
-// we own the sleep queue
-queue_t _sleeping;
+// TSC cycles per millisecond, measured at boot (0 if unknown)
+uint32_t _tsc_khz;
 
 /*
 ** PRIVATE FUNCTIONS
 */
 
 /**
-** Name:  _cmp_wakeup
+** Name:  _tsc_calibrate
 **
-** Ordering function for the sleep queue
+** Measures the TSC rate by counting cycles across a fixed interval
+** timed by PIT channel 2, which leaves the system clock alone
 **
-** @param v1    First key value to examine
-** @param v2    Second key value to examine
+** @return TSC cycles per millisecond
+*/
+static uint32_t _tsc_calibrate( void ) {
+    uint32_t count = CALIBRATE_MS * PIT_DIVISOR;
+    uint64_t start, end;
+    uint8_t portb;
+
+    // raise the channel 2 gate, with the speaker off
+    portb = __inb( PIT_PORT_B );
+    __outb( PIT_PORT_B, (portb & ~PORT_B_SPEAKER) | PORT_B_GATE2 );
+
+    // count down once, raising OUT2 at the end
+    __outb( TIMER_CONTROL_PORT, TIMER_2_SELECT | TIMER_2_READ |
+                                TIMER_MODE_0 );
+    __outb( TIMER_2_PORT, count & 0xff );
+    __outb( TIMER_2_PORT, (count >> 8) & 0xff );
+
+    start = __rdtsc();
+    while( (__inb(PIT_PORT_B) & PORT_B_OUT2) == 0 ) {
+        ;
+    }
+    end = __rdtsc();
+
+    // put the gate back the way we found it
+    __outb( PIT_PORT_B, portb );
+
+    return( (uint32_t) __udiv64(end - start, CALIBRATE_MS, NULL) );
+}
+
+/**
+** Name:  _clk_periodic
 **
-** @return Relationship between the key values:
-**      < 0   v1 < v2
-**      = 0   v1 == v2
-**      > 0   v1 > v2
+** Programs the PIT to interrupt once every tick
 */
-static int _cmp_wakeup( const void *v1, const void *v2 ) {
+static void _clk_periodic( void ) {
+    __outb( TIMER_CONTROL_PORT, TIMER_0_LOAD | TIMER_0_SQUARE );
+    __outb( TIMER_0_PORT, PIT_DIVISOR & 0xff );        // LSB of divisor
+    __outb( TIMER_0_PORT, (PIT_DIVISOR >> 8) & 0xff ); // MSB of divisor
+}
 
-    // QUESTION:  does it make more sense to put this function
-    // somewhere else with a name like "_cmp_uint32", which would
-    // make it more generic and thus usable for other ordered
-    // queues which sort in ascending order by uint32_t values?
+/**
+** Name:  _wheel_add
+**
+** Places a process in the wheel slot for its wakeup time, relative
+** to the current wheel position
+**
+** @param pcb   The sleeping process
+*/
+static void _wheel_add( pcb_t *pcb ) {
+    time_t when = pcb->event.wakeup;
+    uint32_t delta = when - _wheel_time;
+    uint32_t level, idx;
+
+    if( (int32_t) delta < 0 ) {
+        // already due; it goes in the slot for the next tick
+        level = 0;
+        idx = _wheel_time & (WHEEL_L0_SIZE - 1);
+    } else if( delta < WHEEL_L0_SIZE ) {
+        level = 0;
+        idx = when & (WHEEL_L0_SIZE - 1);
+    } else {
+        // find the first level whose span covers the delay
+        for( level = 1; level < WHEEL_LEVELS - 1; ++level ) {
+            if( delta < (1U << WHEEL_SHIFT(level + 1)) ) {
+                break;
+            }
+        }
+        idx = WHEEL_INDEX( when, level );
+    }
 
-    // we just do direct comparisons between the void* values,
-    // because pointers are essentially unsigned integers in IA32
+    _pcbq_enque( &_wheel[level].slot[idx], pcb, 0 );
+    _wheel[level].map[idx >> 5] |= (1 << (idx & 31));
+}
+
+/**
+** Name:  _wheel_unmap
+**
+** Clears the map bit for a slot if the slot is now empty
+**
+** @param w     The wheel level
+** @param q     The slot within that level
+*/
+static void _wheel_unmap( wheel_t *w, pcbq_t *q ) {
+    uint32_t idx = q - w->slot;
 
-	if( v1 < v2 )
-        return( -1 );
-	else if( v1 == v2 )
-        return( 0 );
-	else
-        return( 1 );
+    if( _pcbq_length(q) == 0 ) {
+        w->map[idx >> 5] &= ~(1 << (idx & 31));
+    }
+}
+
+/**
+** Name:  _wheel_cascade
+**
+** Empties one slot of a higher level, redistributing its processes
+** into the levels below it
+**
+** @param level The level to cascade from
+** @param idx   The slot within that level
+**
+** @return idx, so that callers can tell whether this level wrapped
+*/
+static uint32_t _wheel_cascade( uint32_t level, uint32_t idx ) {
+    wheel_t *w = &_wheel[level];
+    pcbq_t *q = &w->slot[idx];
+    pcb_t *pcb;
+
+    while( (pcb = _pcbq_deque(q)) != NULL ) {
+        _wheel_add( pcb );
+    }
+    _wheel_unmap( w, q );
+
+    return( idx );
+}
+
+/**
+** Name:  _wheel_tick
+**
+** Advances the wheel by one tick, waking every process whose
+** time has come
+*/
+static void _wheel_tick( void ) {
+    uint32_t idx;
+    pcbq_t *q, due;
+    pcb_t *pcb;
+
+    _pcbq_init( &due, false );
+
+    _spin_lock( &_wheel_lock );
+
+    idx = _wheel_time & (WHEEL_L0_SIZE - 1);
+
+    // at the start of each turn of level 0, pull the next slot of
+    // level 1 down (and so on up the levels, as each one wraps)
+    if( idx == 0 ) {
+        for( uint32_t n = 1; n < WHEEL_LEVELS; ++n ) {
+            if( _wheel_cascade(n, WHEEL_INDEX(_wheel_time,n)) != 0 ) {
+                break;
+            }
+        }
+    }
+
+    ++_wheel_time;
+
+    // everything in this slot is due now, except that nanosleep()
+    // callers may still have part of a tick to go
+    q = &_wheel[0].slot[idx];
+    while( (pcb = _pcbq_deque(q)) != NULL ) {
+        if( pcb->wake_ns != 0 ) {
+            _pcbq_enque( &_fine, pcb, 0 );
+            continue;
+        }
+        --_wheel_count;
+        _pcbq_enque( &due, pcb, 0 );
+    }
+    _wheel_unmap( &_wheel[0], q );
+
+    _spin_unlock( &_wheel_lock );
+
+    // _schedule() may dispatch, which looks at the wheel again, so
+    // the wakeups wait until we have let go of it
+    while( (pcb = _pcbq_deque(&due)) != NULL ) {
+        _schedule( pcb );
+    }
+}
+
+/**
+** Name:  _wheel_next
+**
+** Searches a level's map for the first non-empty slot at or after
+** a starting index, wrapping around the end of the level
+**
+** @param w     The wheel level
+** @param start Where to begin searching
+**
+** @return the distance (in slots) to that slot, or -1 if the level is empty
+*/
+static int32_t _wheel_next( wheel_t *w, uint32_t start ) {
+    uint32_t words = (w->size + 31) / 32;
+
+    for( uint32_t i = 0; i <= words; ++i ) {
+        uint32_t word = ((start >> 5) + i) % words;
+        uint32_t bits = w->map[word];
+
+        // on the first word, ignore slots before the start;
+        // on the wrapped-around copy of it, ignore slots after
+        if( i == 0 ) {
+            bits &= ~0U << (start & 31);
+        } else if( i == words ) {
+            bits &= ~(~0U << (start & 31));
+        }
+
+        if( bits != 0 ) {
+            uint32_t idx = (word << 5) + __bsf( bits );
+            return( (idx - start) & (w->size - 1) );
+        }
+    }
+
+    return( -1 );
+}
+
+/**
+** Name:  _clk_oneshot
+**
+** Programs the PIT to interrupt once, less than a tick from now
+**
+** @param now   The current time, from _clk_ns()
+** @param ns    The delay
+*/
+static void _clk_oneshot( uint64_t now, uint64_t ns ) {
+    uint32_t count = PIT_DIVISOR;
+
+    if( ns < NS_PER_MS ) {
+        count = (uint32_t) __udiv64( ns * PIT_DIVISOR, NS_PER_MS, NULL );
+        if( count == 0 ) {
+            count = 1;
+        }
+    }
+
+    __outb( TIMER_CONTROL_PORT, TIMER_0_LOAD | TIMER_MODE_0 );
+    __outb( TIMER_0_PORT, count & 0xff );
+    __outb( TIMER_0_PORT, (count >> 8) & 0xff );
+
+    _fine_at = now + ns;
+}
+
+/**
+** Name:  _clk_fine_wake
+**
+** Wakes the processes on _fine whose deadlines have come
+**
+** @param now   The current time, from _clk_ns()
+*/
+static void _clk_fine_wake( uint64_t now ) {
+    pcb_t *pcb, *next;
+    pcbq_t due;
+
+    _pcbq_init( &due, false );
+
+    _spin_lock( &_wheel_lock );
+
+    for( pcb = _pcbq_peek(&_fine); pcb != NULL; pcb = next ) {
+        next = pcb->qnext;
+        // without a TSC rate, the tick is as close as we can get
+        if( _tsc_khz == 0 || pcb->wake_ns <= now + FINE_SLACK ) {
+            _pcbq_remove( pcb );
+            --_wheel_count;
+            pcb->wake_ns = 0;
+            _pcbq_enque( &due, pcb, 0 );
+        }
+    }
+
+    _spin_unlock( &_wheel_lock );
+
+    while( (pcb = _pcbq_deque(&due)) != NULL ) {
+        _schedule( pcb );
+    }
+}
+
+/**
+** Name:  _clk_fine_arm
+**
+** If the earliest deadline on _fine comes before the next tick (and
+** before any one-shot already set), sets the PIT to fire then
+**
+** @param now   The current time, from _clk_ns()
+*/
+static void _clk_fine_arm( uint64_t now ) {
+    uint64_t first = 0;
+    pcb_t *pcb;
+
+    if( _tsc_khz == 0 ) {
+        return;
+    }
+
+    _spin_lock( &_wheel_lock );
+    for( pcb = _pcbq_peek(&_fine); pcb != NULL; pcb = pcb->qnext ) {
+        if( first == 0 || pcb->wake_ns < first ) {
+            first = pcb->wake_ns;
+        }
+    }
+    _spin_unlock( &_wheel_lock );
+
+    // the next tick will look at anything later
+    if( first == 0 || first >= _tick_ns + NS_PER_MS ) {
+        return;
+    }
+
+    if( (_fine_due || _fine_rest) && first >= _fine_at ) {
+        return;
+    }
+
+    _clk_oneshot( now, first > now ? first - now : 0 );
+    _fine_due = true;
+    _fine_rest = false;
 }
 
 /**
@@ -90,6 +447,25 @@ static int _cmp_wakeup( const void *v1, const void *v2 ) {
 */
 static void _clk_isr( int vector, int code ) {
 
+    // a one-shot between ticks wakes nanosleep() callers; the tick
+    // itself is still to come, and is counted out by another one
+    if( _fine_due ) {
+        uint64_t now = _clk_ns();
+        uint64_t end = _tick_ns + NS_PER_MS;
+
+        _fine_due = false;
+        _clk_fine_wake( now );
+        _clk_fine_arm( now );
+
+        if( !_fine_due ) {
+            _clk_oneshot( now, end > now ? end - now : 0 );
+            _fine_rest = true;
+        }
+
+        __outb( PIC_PRI_CMD_PORT, PIC_EOI );
+        return;
+    }
+
 	// spin the pinwheel
 	
     ++_pinwheel;
@@ -108,46 +484,75 @@ static void _clk_isr( int vector, int code ) {
 
     if( (_system_time % SEC_TO_TICKS(STATUS)) == 0 ) {
         __cio_printf_at( 3, 0,
-            "%3d procs:  sl/%d wt/%d rd/%d zo/%d  r %d %d %d %d    ",
+            "%3d procs:  sl/%d wt/%d rd/%d zo/%d  r %08x    ",
                 _active_procs,
-                _que_length(_sleeping), _que_length(_waiting),
-                _que_length(_reading), _que_length(_zombie),
-                _que_length(_ready[0]), _que_length(_ready[1]),
-                _que_length(_ready[2]), _que_length(_ready[3])
+                _wheel_count, _que_length(_waiting),
+                _pcbq_length(&_reading), _que_length(_zombie),
+                _ready_map
         );
         _sio_dump( true );
         // _active_dump( "Ptbl", false );
     }
 #endif
 
-    // time marches on!
-	++_system_time;
+    // time marches on!  (by more than one tick, if this is the
+    // end of an idle period)
+    if( _oneshot > 0 ) {
+        _system_time += _oneshot;
+        _oneshot = 0;
+        _clk_periodic();
+    } else {
+        ++_system_time;
+        if( _fine_rest ) {
+            // the end of a tick split up by _fine wakeups
+            _fine_rest = false;
+            _clk_periodic();
+        }
+    }
+    _vdata_time( _system_time );
+    _tick_ns = _clk_ns();
+
+    // remember whether we interrupted the idle process
+    bool_t idle = _current == _idle;
 	
-    // wake up an sleeping processes whose time has come
+    // wake up any sleeping processes whose time has come
     //
     // we give them preference over the current process
     // (when it is scheduled again)
 
-    // peek at the first element on the sleep queue
-	pcb_t *tmp = _que_peek( _sleeping );
+    while( (int32_t) (_system_time - _wheel_time) >= 0 ) {
+        _wheel_tick();
+    }
+
+    // nanosleep() callers due before the next tick get a one-shot
+    _clk_fine_wake( _tick_ns );
+    _clk_fine_arm( _tick_ns );
 
-    // loop as long as there is something on the queue AND
-    // it's (past?) time for that process to wake up
-	while( tmp != NULL && tmp->event.wakeup <= _system_time ) {
-		tmp = _que_deque( _sleeping );
-		_schedule( tmp );
-		tmp = _que_peek( _sleeping );
-	}
-	
-    // check the current process to see if its time slice has expired
-	_current->ticks -= 1;
-
-	if( _current->ticks < 1 ) {
-        // yes!  put it back on the ready queue
-		_schedule( _current );
-        // pick a new "current" process
-		_dispatch();
-	}
+    // let the scheduler age any processes that have waited too long
+    _sched_tick();
+
+    if( idle ) {
+
+        // idle runs on a one-page stack, so it needs watching too
+        _stk_check( _idle );
+
+        // if nothing woke up, go back to sleep until the next wakeup
+        if( _current == _idle ) {
+            _clk_idle();
+        }
+
+    } else if( !_stk_check(_current) ) {
+
+        // check the current process to see if its time slice has expired
+        _current->ticks -= 1;
+
+        if( _current->ticks < 1 ) {
+            // yes!  put it back on the ready queue, one step down
+            _sched_preempt( _current );
+            // pick a new "current" process
+            _dispatch();
+        }
+    }
 	
     // tell the PIC we're done
 	__outb( PIC_PRI_CMD_PORT, PIC_EOI );
@@ -173,16 +578,34 @@ void _clk_init( void ) {
 
     // return to the dawn of time
 	_system_time = 0;
+    _vdata_time( _system_time );
+
+    // find out how fast the TSC runs, and start counting from here
+    _tsc_khz = _tsc_calibrate();
+    _tsc_base = __rdtsc();
+    __cio_printf( " (TSC %d kHz)", _tsc_khz );
 	
 	// configure the clock
-    uint32_t divisor = TIMER_FREQUENCY / CLOCK_FREQUENCY;
-    __outb( TIMER_CONTROL_PORT, TIMER_0_LOAD | TIMER_0_SQUARE );
-    __outb( TIMER_0_PORT, divisor & 0xff );        // LSB of divisor
-    __outb( TIMER_0_PORT, (divisor >> 8) & 0xff ); // MSB of divisor
+    _oneshot = 0;
+    _clk_periodic();
 	
-    // create the sleep queue
-	_sleeping = _que_alloc( _cmp_wakeup );
-	assert( _sleeping != NULL );
+    // set up the timing wheel
+    _spin_init( &_wheel_lock, "wheel", LOCK_WHEEL );
+    for( int n = 0; n < WHEEL_LEVELS; ++n ) {
+        wheel_t *w = &_wheel[n];
+        w->slot = n == 0 ? _wheel0 : _wheeln[n - 1];
+        w->size = n == 0 ? WHEEL_L0_SIZE : WHEEL_LN_SIZE;
+        for( uint32_t i = 0; i < w->size; ++i ) {
+            _pcbq_init( &w->slot[i], false );
+        }
+        __memclr( w->map, sizeof(w->map) );
+    }
+    _wheel_time = 0;
+    _wheel_count = 0;
+    _pcbq_init( &_fine, false );
+    _fine_due = false;
+    _fine_rest = false;
+    _tick_ns = _clk_ns();
 	
     // register the second-stage ISR
 	__install_isr( INT_VEC_TIMER, _clk_isr );
@@ -190,3 +613,302 @@ void _clk_init( void ) {
     // report that we're all set
 	__cio_puts( " done" );
 }
+
+/**
+** Name:  _clk_sleep
+**
+** Adds a process to the timing wheel; it will be rescheduled once
+** the system time reaches pcb->event.wakeup
+**
+** @param pcb   The sleeping process
+*/
+void _clk_sleep( pcb_t *pcb ) {
+
+    assert1( pcb != NULL );
+
+    _spin_lock( &_wheel_lock );
+    _wheel_add( pcb );
+    ++_wheel_count;
+    _spin_unlock( &_wheel_lock );
+}
+
+/**
+** Name:  _clk_nsleep
+**
+** Puts a nanosleep() caller to sleep.  It waits on the timing wheel
+** until the last tick before its deadline, and from there on _fine
+** for a one-shot that fires between ticks.
+**
+** @param pcb   The sleeping process
+** @param when  Its deadline, from _clk_ns()
+*/
+void _clk_nsleep( pcb_t *pcb, uint64_t when ) {
+    uint64_t now = _clk_ns();
+    uint64_t ticks = 0;
+
+    assert1( pcb != NULL );
+
+    if( when > now ) {
+        ticks = __udiv64( when - now, NS_PER_MS, NULL );
+    }
+    if( ticks > 0x7fffffff ) {
+        ticks = 0x7fffffff;
+    }
+
+    pcb->wake_ns = when;
+
+    if( ticks > 0 ) {
+        pcb->event.wakeup = _system_time + (uint32_t) ticks;
+        _clk_sleep( pcb );
+        return;
+    }
+
+    _spin_lock( &_wheel_lock );
+    _pcbq_enque( &_fine, pcb, 0 );
+    ++_wheel_count;
+    _spin_unlock( &_wheel_lock );
+
+    _clk_fine_arm( now );
+}
+
+/**
+** Name:  _clk_cancel
+**
+** Takes a sleeping process off the timing wheel without waking it
+**
+** @param pcb   The sleeping process
+*/
+void _clk_cancel( pcb_t *pcb ) {
+    pcbq_t *q;
+
+    assert1( pcb != NULL );
+
+    q = pcb->queue;
+    assert( q != NULL );
+
+    _spin_lock( &_wheel_lock );
+
+    _pcbq_remove( pcb );
+    --_wheel_count;
+    pcb->wake_ns = 0;
+
+    if( q == &_fine ) {
+        _spin_unlock( &_wheel_lock );
+        return;
+    }
+
+    // figure out which level the slot belongs to
+    for( int n = 0; n < WHEEL_LEVELS; ++n ) {
+        wheel_t *w = &_wheel[n];
+        if( q >= w->slot && q < w->slot + w->size ) {
+            _wheel_unmap( w, q );
+            _spin_unlock( &_wheel_lock );
+            return;
+        }
+    }
+
+    // not one of ours!
+    PANIC( 0, _clk_cancel );
+}
+
+/**
+** Name:  _clk_sleepers
+**
+** @return the number of processes on the timing wheel
+*/
+uint32_t _clk_sleepers( void ) {
+    return( _wheel_count );
+}
+
+/**
+** Name:  _clk_next_expiry
+**
+** Finds the earliest time at which the timing wheel has work to do.
+** This is exact for wakeups less than 256 ticks away; beyond that,
+** it is the time at which the earliest waiting slot will be cascaded
+** down a level, which is never later than the wakeup itself.
+**
+** @param when  Where to store the time
+**
+** @return true if anything is on the wheel, else false
+*/
+bool_t _clk_next_expiry( time_t *when ) {
+    bool_t found = false;
+    time_t best = 0;
+    int32_t d;
+
+    _spin_lock( &_wheel_lock );
+
+    if( _wheel_count == 0 ) {
+        _spin_unlock( &_wheel_lock );
+        return( false );
+    }
+
+    // level 0 is exact:  slot i fires on the tick whose low bits are i
+    d = _wheel_next( &_wheel[0], _wheel_time & (WHEEL_L0_SIZE - 1) );
+    if( d >= 0 ) {
+        best = _wheel_time + d;
+        found = true;
+    }
+
+    // higher levels are cascaded when the bits below them roll over
+    for( int n = 1; n < WHEEL_LEVELS; ++n ) {
+        uint32_t shift = WHEEL_SHIFT(n);
+        uint32_t base = _wheel_time >> shift;
+        uint32_t start = WHEEL_INDEX( _wheel_time, n );
+
+        // unless we are exactly on a boundary, the current slot
+        // won't be cascaded again until the next turn of this level
+        if( (_wheel_time & ((1U << shift) - 1)) != 0 ) {
+            ++base;
+            start = (start + 1) & (WHEEL_LN_SIZE - 1);
+        }
+
+        d = _wheel_next( &_wheel[n], start );
+        if( d < 0 ) {
+            continue;
+        }
+
+        time_t t = (base + d) << shift;
+
+        if( !found || (int32_t) (t - best) < 0 ) {
+            best = t;
+            found = true;
+        }
+    }
+
+    _spin_unlock( &_wheel_lock );
+
+    if( found && when != NULL ) {
+        *when = best;
+    }
+
+    return( found );
+}
+
+/**
+** Name:  _clk_ns
+**
+** Reads the high-resolution monotonic clock
+**
+** @return nanoseconds since the clock module was initialized
+*/
+uint64_t _clk_ns( void ) {
+    uint64_t ms;
+    uint32_t rem;
+
+    if( _tsc_khz == 0 ) {
+        // no usable TSC; fall back on the tick count
+        return( (uint64_t) _system_time * NS_PER_MS );
+    }
+
+    // convert in two steps so the intermediate values can't overflow
+    ms = __udiv64( __rdtsc() - _tsc_base, _tsc_khz, &rem );
+
+    return( ms * NS_PER_MS +
+            __udiv64((uint64_t) rem * NS_PER_MS, _tsc_khz, NULL) );
+}
+
+/**
+** Name:  _clk_idle
+**
+** Called when the idle process is dispatched.  Switches the PIT to
+** one-shot mode, set to fire when the next timed wakeup is due (or
+** as late as the PIT allows), so that an idle system takes no clock
+** interrupts in between.
+*/
+void _clk_idle( void ) {
+    uint32_t ticks = ONESHOT_MAX;
+    time_t next;
+
+    // leave a one-shot for _fine alone
+    if( _oneshot > 0 || _fine_due || _fine_rest ) {
+        return;
+    }
+
+    // anything left on _fine is due after the next tick
+    if( _pcbq_length(&_fine) > 0 ) {
+        ticks = 1;
+    }
+
+    if( _clk_next_expiry(&next) ) {
+        int32_t delta = next - _system_time;
+        if( delta < 1 ) {
+            delta = 1;
+        }
+        if( (uint32_t) delta < ticks ) {
+            ticks = delta;
+        }
+    }
+
+    uint32_t count = ticks * PIT_DIVISOR;
+    __outb( TIMER_CONTROL_PORT, TIMER_0_LOAD | TIMER_MODE_0 );
+    __outb( TIMER_0_PORT, count & 0xff );
+    __outb( TIMER_0_PORT, (count >> 8) & 0xff );
+
+    _oneshot = ticks;
+}
+
+/**
+** Name:  _clk_resume
+**
+** Called when a process other than idle is dispatched.  If the
+** clock was in one-shot mode, charges the time spent idle to the
+** system time and restarts the periodic tick.
+*/
+void _clk_resume( void ) {
+    uint32_t count, left, elapsed;
+
+    if( _oneshot == 0 ) {
+        return;
+    }
+
+    // latch and read the remaining count
+    __outb( TIMER_CONTROL_PORT, TIMER_0_SELECT );
+    left = __inb( TIMER_0_PORT );
+    left |= __inb( TIMER_0_PORT ) << 8;
+
+    // once the count runs out, the counter wraps; the pending clock
+    // interrupt will then account for the last tick
+    count = _oneshot * PIT_DIVISOR;
+    elapsed = left <= count ? count - left : count - PIT_DIVISOR;
+
+    _system_time += (elapsed + PIT_DIVISOR / 2) / PIT_DIVISOR;
+    _vdata_time( _system_time );
+    _oneshot = 0;
+    _clk_periodic();
+
+    // the ticks start over from here
+    _tick_ns = _clk_ns();
+    _clk_fine_arm( _tick_ns );
+}
+
+/**
+** Name:  _clk_dump
+**
+** Dumps the contents of the timing wheel to the console
+*/
+void _clk_dump( void ) {
+    time_t next;
+
+    __cio_printf( "Timing wheel: time %d, %d sleepers",
+                  _wheel_time, _wheel_count );
+    if( _clk_next_expiry(&next) ) {
+        __cio_printf( ", next %d", next );
+    }
+    __cio_putchar( '\n' );
+
+    for( int n = 0; n < WHEEL_LEVELS; ++n ) {
+        wheel_t *w = &_wheel[n];
+        for( uint32_t i = 0; i < w->size; ++i ) {
+            if( _pcbq_length(&w->slot[i]) > 0 ) {
+                __sprint( b256, " L%d[%d]", n, i );
+                _pcbq_dump( b256, &w->slot[i] );
+            }
+        }
+    }
+
+    if( _pcbq_length(&_fine) > 0 ) {
+        _pcbq_dump( " fine", &_fine );
+    }
+}
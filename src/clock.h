@@ -49,8 +49,8 @@
 // current system time
 extern time_t _system_time;
 
-// we own the sleep queue
-extern queue_t _sleeping;
+// TSC cycles per millisecond, measured at boot (0 if unknown)
+extern uint32_t _tsc_khz;
 
 /*
 ** Prototypes
@@ -64,6 +64,93 @@ extern queue_t _sleeping;
 */
 void _clk_init( void );
 
+/**
+** Name:  _clk_sleep
+**
+** Adds a process to the timing wheel; it will be rescheduled once
+** the system time reaches pcb->event.wakeup
+**
+** @param pcb   The sleeping process
+*/
+void _clk_sleep( pcb_t *pcb );
+
+/**
+** Name:  _clk_nsleep
+**
+** Puts a nanosleep() caller to sleep.  It waits on the timing wheel
+** until the last tick before its deadline, and is then woken by a
+** one-shot that fires between ticks.
+**
+** @param pcb   The sleeping process
+** @param when  Its deadline, from _clk_ns()
+*/
+void _clk_nsleep( pcb_t *pcb, uint64_t when );
+
+/**
+** Name:  _clk_cancel
+**
+** Takes a sleeping process off the timing wheel without waking it
+**
+** @param pcb   The sleeping process
+*/
+void _clk_cancel( pcb_t *pcb );
+
+/**
+** Name:  _clk_sleepers
+**
+** @return the number of processes on the timing wheel
+*/
+uint32_t _clk_sleepers( void );
+
+/**
+** Name:  _clk_next_expiry
+**
+** Finds the earliest time at which the timing wheel has work to do.
+** This is exact for wakeups less than 256 ticks away; beyond that,
+** it is the time at which the earliest waiting slot will be cascaded
+** down a level, which is never later than the wakeup itself.
+**
+** @param when  Where to store the time
+**
+** @return true if anything is on the wheel, else false
+*/
+bool_t _clk_next_expiry( time_t *when );
+
+/**
+** Name:  _clk_ns
+**
+** Reads the high-resolution monotonic clock
+**
+** @return nanoseconds since the clock module was initialized
+*/
+uint64_t _clk_ns( void );
+
+/**
+** Name:  _clk_idle
+**
+** Called when the idle process is dispatched.  Switches the PIT to
+** one-shot mode, set to fire when the next timed wakeup is due (or
+** as late as the PIT allows), so that an idle system takes no clock
+** interrupts in between.
+*/
+void _clk_idle( void );
+
+/**
+** Name:  _clk_resume
+**
+** Called when a process other than idle is dispatched.  If the
+** clock was in one-shot mode, charges the time spent idle to the
+** system time and restarts the periodic tick.
+*/
+void _clk_resume( void );
+
+/**
+** Name:  _clk_dump
+**
+** Dumps the contents of the timing wheel to the console
+*/
+void _clk_dump( void );
+
 #endif
 /* SP_ASM_SRC */
 
@@ -34,10 +34,6 @@
 #define	CHAN_CONS	0
 #define	CHAN_SIO	1
 
-// maximum number of processes in the system
-
-#define N_PROCS     25
-
 #ifndef SP_ASM_SRC
 
 /*
@@ -61,6 +57,11 @@
 
 #define	SEC_TO_MS(n)		((n) * 1000)
 
+// nanoseconds per millisecond and per second
+
+#define	NS_PER_MS		1000000
+#define	NS_PER_SEC		1000000000
+
 /*
 ** Types
 */
@@ -85,8 +86,8 @@ typedef uint8_t bool_t;
 #define true    1
 #define false   0
 
-// PID data type
-typedef int16_t pid_t;
+// PID data type (see process.h for the encoding)
+typedef int32_t pid_t;
 
 // User and Group ID data types
 typedef uint16_t gid_t;
@@ -119,16 +120,22 @@ enum state_e {
 // Process priority type and values
 typedef uint8_t prio_t;
 
+//
+// Any value from PRIO_HIGHEST through PRIO_LOWEST is a legal priority;
+// the names below are just convenient landmarks within that range.
+// The scheduler tracks non-empty levels in a 32-bit map, so there can
+// be at most 32 levels.
+
 enum prio_e {
 
     // MUST BE FIRST - HIGHEST PRIORITY
-    System,          // OS-related processes
+    System = 0,      // OS-related processes
 
     // User-level priorities
-    User1, User2,
+    User1 = 8, User2 = 16,
 
     // MUST BE LAST - LOWEST PRIORITY
-    Deferred         // things that run only when nothing else is ready
+    Deferred = 31    // things that run only when nothing else is ready
 };
 
 // delimiters for priority values
@@ -139,6 +146,83 @@ enum prio_e {
 // number of scheduling categories
 #define N_QUEUES   (PRIO_LOWEST + 1)
 
+// Kernel memory accounting (see meminfo())
+//
+// Every kernel allocation is tagged with the subsystem it is for.  Slab
+// pages are counted under KM_SLAB, and the objects in them are counted
+// again under their own tags.
+enum kmtag_e {
+    KM_OTHER = 0, KM_STACK, KM_PCB, KM_QUEUE, KM_FS, KM_UAREA, KM_SLAB,
+    N_KMTAGS         // should be the last entry
+};
+
+// initializer for a table of the tag names, in the order above
+#define KM_TAG_NAMES { \
+    "other", "stack", "pcb", "queue", "fs", "uarea", "slab" \
+}
+
+typedef struct kmstat_s {
+    uint32_t inuse;       // bytes currently allocated
+    uint32_t peak;        // high-water mark of inuse
+    uint32_t allocs;      // successful allocations
+    uint32_t frees;       // deallocations
+    uint32_t fails;       // failed allocations
+} kmstat_t;
+
+typedef struct meminfo_s {
+    uint32_t total;       // pages managed by the page allocator
+    uint32_t free;        // pages currently free
+    uint32_t low;         // low-water mark of free
+    kmstat_t tags[N_KMTAGS];
+    uint32_t pool;        // warm processes in the spawn pool
+    uint32_t pool_target; // the number the pool is kept at
+} meminfo_t;
+
+// System call ring (see ring_setup() and submit())
+//
+// A process queues system calls on the submission ring, and has the
+// kernel run a batch of them with one submit() call; each result is
+// posted on the completion ring.  The head and tail counters run
+// freely, and are reduced modulo RING_SIZE to index the rings.  The
+// process advances sq_tail and cq_head; the kernel advances sq_head
+// and cq_tail.
+
+#define RING_SIZE   32          // must be a power of two
+
+typedef struct rsqe_s {
+    uint32_t code;              // SYS_read, SYS_write, SYS_fopen,
+                                // SYS_fclose, SYS_getinode, SYS_dirname
+    uint32_t args[3];           // its arguments
+    uint32_t tag;               // copied to the completion
+} rsqe_t;
+
+typedef struct rcqe_s {
+    uint32_t tag;               // from the submission
+    int32_t result;             // what the system call returned
+} rcqe_t;
+
+typedef struct ring_s {
+    volatile uint32_t sq_head;  // next submission the kernel will run
+    volatile uint32_t sq_tail;  // next free submission slot
+    volatile uint32_t cq_head;  // next completion to be collected
+    volatile uint32_t cq_tail;  // next free completion slot
+    rsqe_t sq[RING_SIZE];
+    rcqe_t cq[RING_SIZE];
+} ring_t;
+
+// Asynchronous file I/O
+//
+// aread() and awrite() queue a request, named by a token of the
+// caller's choosing, and return at once; await() collects the results.
+// The caller fills in the tokens it wants; await() fills in the results.
+
+#define AIO_FOREVER 0xffffffff  // await() timeout which never expires
+
+typedef struct aio_s {
+    uint32_t token;             // the request
+    int32_t result;             // its result, or E_AGAIN if still queued
+} aio_t;
+
 // Generic "event" type
 typedef union event_u {
     uint32_t wakeup;      // wakeup time for sleeping processes
@@ -170,6 +254,8 @@ typedef int status_t;
 #define E_NO_PERMISSION (-11)
 #define E_FILE_LIMIT    (-12)
 #define E_EOF           (-13)
+#define E_BUSY          (-14)
+#define E_AGAIN         (-15)
 
 
 /*
@@ -51,12 +51,12 @@
 ** terms of the names used in the rest of the baseline.
 */
 
-// queue module
-#define QLENGTH    _que_length
-#define QDEQUE     _que_deque
+// process queues
+#define QLENGTH    _pcbq_length
+#define QDEQUE     _pcbq_deque
 
 // blocked queue for reading processes
-#define READQ      _reading
+#define READQ      (&_reading)
 
 // scheduler
 #define SCHED      _schedule
@@ -24,6 +24,7 @@
 #include "driverInterface.h"
 #include "cio.h"
 #include "support.h"
+#include "lock.h"
 
 // Forward declarations
 int _disk_read( uint32_t blockNr, char* buf, uint8_t devId );
@@ -94,6 +95,9 @@ int _disk_ide_device_count = 0;
 // The ATA disk device
 _pci_device_t _disk_device;
 
+// Serializes commands to the controller
+static spinlock_t _disk_lock;
+
 /**
 ** Name:	_sleep1ms
 **
@@ -376,7 +380,7 @@ void _disk_ide_initialize(void) {
 #endif
 
             // Add driver
-            driverInterface_t dri = { 0, _disk_ide_device_count, _disk_read_block, _disk_write_block };
+            driverInterface_t dri = { 0, _disk_ide_device_count, _disk_read_block, _disk_write_block, NULL };
             _disk_ide_device_count++;
             int err = _fs_registerDev(dri);
             if (err < 0) {
@@ -547,6 +551,8 @@ void _disk_init( void ) {
     _pci_dev_itr_t itr;
     _pci_device_t dev;
 
+    _spin_init(&_disk_lock, "disk", LOCK_DISK);
+
     // Install Dummy ISR for the random interrupts.
     __install_isr(46, _disk_dummy_isr);
     
@@ -617,7 +623,11 @@ int _disk_read_block( uint32_t block, char* buf, uint8_t drive ) {
     if (block + 1 > _disk_ide_devices[drive].size)
         return -1;
 
-    return _disk_ide_ata_io(_DISK_READ, drive, block, buf);
+    uint32_t flags = _spin_lock_irqsave(&_disk_lock);
+    int ret = _disk_ide_ata_io(_DISK_READ, drive, block, buf);
+    _spin_unlock_irqrestore(&_disk_lock, flags);
+
+    return ret;
 }
 
 /**
@@ -650,6 +660,10 @@ int _disk_write_block( uint32_t block, char* buf, uint8_t drive ) {
     if (block + 1 > _disk_ide_devices[drive].size)
         return -1;
 
-    return _disk_ide_ata_io(_DISK_WRITE, drive, block, buf);
+    uint32_t flags = _spin_lock_irqsave(&_disk_lock);
+    int ret = _disk_ide_ata_io(_DISK_WRITE, drive, block, buf);
+    _spin_unlock_irqrestore(&_disk_lock, flags);
+
+    return ret;
 }
 
@@ -16,6 +16,10 @@ typedef struct driverInterface_s {
     uint16_t driverNr;
     int (* readBlock)(uint32_t blockNr, char* buf, uint8_t devId);
     int (* writeBlock)(uint32_t blockNr, char* buf, uint8_t devId);
+
+    // Optional (NULL if the device isn't memory resident): returns the 
+    // address of a block in memory, for direct read-only file views
+    char * (* mapBlock)(uint32_t blockNr, uint8_t devId);
 } driverInterface_t;
 
 #endif
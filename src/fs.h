@@ -59,7 +59,7 @@ typedef struct inode_s {
     gid_t gid; 
 
     // Lock + Padding (4 bytes)
-    uint8_t lock; // 1 byte
+    uint8_t lock; // 1 byte (unused on disk; locks are kept in memory by kfs)
     uint8_t pad[3]; // 3 bytes
 
     // Indirect Pointers 4 bytes
@@ -25,10 +25,16 @@
 #include "support.h"
 #include "disk.h"
 #include "pci.h"
+#include "smp.h"
+#include "lock.h"
 
-// need init() and idle() addresses
+// need init() address
 #include "users.h"
 
+// system call stub for the I/O worker, in ulibs.S; it is not part of
+// the user library API, so it isn't declared in ulib.h
+extern int32_t aio_serve( void );
+
 /*
 ** PRIVATE DEFINITIONS
 */
@@ -56,8 +62,6 @@ char b512[512];
 //     pointer to the current process
 //     information about the initial process
 //         pid, PCB pointer
-//     information about the idle process (if there is one)
-//         pid, PCB pointer
 //     information about active processes
 //         static array of PCBs, active count, next available PID
 //     queue variables
@@ -73,6 +77,40 @@ uint32_t *_system_esp;
 ** PRIVATE FUNCTIONS
 */
 
+/**
+** _idle_loop - body of the idle process
+**
+** Dispatched only when nothing else is ready; tops up the spawn
+** pool, then halts the CPU until the next interrupt, which will
+** usually make something ready
+*/
+static int32_t _idle_loop( uint32_t arg1, uint32_t arg2 ) {
+
+    for(;;) {
+        while( _proc_refill() ) {
+            ;
+        }
+        __pause();
+    }
+
+    return( 0 );  // never reached
+}
+
+/**
+** _aio_loop - body of the I/O worker process
+**
+** Runs the queued aread() and awrite() requests, one per system
+** call; the call blocks the worker while there are none
+*/
+static int32_t _aio_loop( uint32_t arg1, uint32_t arg2 ) {
+
+    for(;;) {
+        aio_serve();
+    }
+
+    return( 0 );  // never reached
+}
+
 /*
 ** PUBLIC FUNCTIONS
 */
@@ -139,6 +177,7 @@ void _init( void ) {
     _clk_init();
     _sio_init();
     _pci_init();
+    _smp_init();
 
     _fs_init();     // Must come before driver inits
     _rd_init();
@@ -160,15 +199,42 @@ void _init( void ) {
     args[2] = args[3] = 0;       // no command-line arguments
 
     // create it; init is strange, as it is its own parent (spawned as root user in root dir)
-    pcb_t *pcb = _proc_create( args, PID_INIT, PID_INIT, GID_USER, UID_ROOT, (inode_id_t){0, 1});
+    pcb_t *pcb = _proc_create( args, PID_INIT, PID_INIT, GID_USER, UID_ROOT, (inode_id_t){0, 1}, 0);
     assert( pcb != NULL );
 
     // schedule it
     _schedule( pcb );
 
-    // add to the active process table
-    _ptable[0] = pcb;
-    _active_procs = 1;
+    // add to the active process table (init has no parent)
+    _proc_add( pcb, NULL );
+
+    /*
+    ** Create the idle process.  It is never placed on a ready
+    ** queue or in the process table; _dispatch() falls back to it
+    ** when the ready queues are empty.
+    */
+
+    args[0] = (uint32_t) _idle_loop;
+    args[1] = PRIO_LOWEST;
+
+    // it does very little, so it gets by with a one-page stack
+    _idle = _proc_create( args, PID_IDLE, PID_INIT, GID_USER, UID_ROOT,
+                          (inode_id_t){0, 1}, 1 );
+    assert( _idle != NULL );
+
+    /*
+    ** Create the I/O worker.  Like idle, it is not in the process
+    ** table, so nothing can kill it or wait for it.  It blocks itself
+    ** the first time it finds no requests queued.
+    */
+
+    args[0] = (uint32_t) _aio_loop;
+    args[1] = System;
+
+    _aio_worker = _proc_create( args, PID_AIO, PID_INIT, GID_USER, UID_ROOT,
+                                (inode_id_t){0, 1}, 1 );
+    assert( _aio_worker != NULL );
+    _schedule( _aio_worker );
 
     /*
     ** Turn on the SIO receiver (the transmitter will be turned
@@ -223,18 +289,34 @@ void _shell( int ch ) {
             break;
 
         case 'q':  // dump the queues
-            _que_dump( "Sleep queue", _sleeping );
-            _que_dump( "Reading queue", _reading );
-            _que_dump( "Ready queue 0", _ready[0] );
-            _que_dump( "Ready queue 1", _ready[1] );
-            _que_dump( "Ready queue 2", _ready[2] );
-            _que_dump( "Ready queue 3", _ready[3] );
+            _clk_dump();
+            _pcbq_dump( "Reading queue", &_reading );
+            _pcbq_dump( "Writing queue", &_writing );
+            for( int i = 0; i < N_QUEUES; ++i ) {
+                if( _pcbq_length(&_ready[i]) > 0 ) {
+                    __sprint( b256, "Ready queue %d", i );
+                    _pcbq_dump( b256, &_ready[i] );
+                }
+            }
             break;
 
         case 'a':  // dump the active table
             _active_dump( "\nActive processes", false );
             break;
 
+        case 'k':  // dump the spinlock statistics
+            _lock_dump( "\nLocks" );
+            break;
+
+        case 'l':  // dump the spawn pool and latency histogram
+            _proc_pool_dump( "\nSpawn" );
+            break;
+
+        case 'm':  // dump the page allocator and the object caches
+            _km_dump();
+            _km_cache_dump();
+            break;
+
         case 'p':  // dump the active table and all PCBs
             _active_dump( "\nActive processes", true );
             break;
@@ -245,12 +327,13 @@ void _shell( int ch ) {
 
         case 's':  // dump stack info for all active PCBS
             __cio_puts( "\nActive stacks (w/5-sec. delays):\n" );
-            for( int i = 0; i < N_PROCS; ++i ) {
-                if( _ptable[i]->state != Unused ) {
-                    pcb_t *pcb = _ptable[i];
+            {
+                uint32_t pos = 0;
+                pcb_t *pcb;
+                while( (pcb = _proc_next(&pos)) != NULL ) {
                     __cio_printf( "pid %5d: ", pcb->pid );
                     __cio_printf( "EIP %08x, ", pcb->context->eip );
-                    _stk_dump( NULL, pcb->stack, 12 );
+                    _stk_dump( NULL, pcb->stack, pcb->stkpages, 12 );
                     __delay( 200 );
                 }
             }
@@ -265,7 +348,10 @@ void _shell( int ch ) {
             __cio_puts( "   a  -- dump the active table\n" );
             __cio_puts( "   c  -- dump contexts for active processes\n" );
             __cio_puts( "   h  -- this message\n" );
-            __cio_puts( "   p  -- dump the active table and all PCBs\n" );
+            __cio_puts( "   k  -- dump spinlock statistics\n" );
+            __cio_puts( "   l  -- dump spawn pool and latencies\n" );
+            __cio_puts( "   m  -- dump memory allocator state\n" );
+            __cio_puts( "   p  -- dump the active table, all PCBs, and locks\n" );
             __cio_puts( "   q  -- dump the queues\n" );
             __cio_puts( "   s  -- dump stacks for active processes\n" );
             __cio_puts( "   x  -- exit\n" );
@@ -1,4 +1,5 @@
 #include "kfs.h"
+#include "scheduler.h"
 
 static driverInterface_t disks[MAX_DISKS];
 char * inode_buffer;
@@ -8,17 +9,58 @@ char * meta_buffer;
 int _fs_getNodeEnt(inode_t* inode, int idx, data_u * ret);
 int _fs_setNodeEnt(inode_t* inode, int idx, data_u ret);
 
+/*
+ * An fmap() view of a file. Views with no references stay cached until the
+ * file changes or the slot is needed for another file. A copy outlives 
+ * changes to the file; a direct view is the file's own blocks (see _fs_map).
+ */
+typedef struct fmap_s {
+    inode_id_t id;      // The mapped file ({0, 0} if the slot is unused)
+    char * base;        // Start of the view
+    uint32_t len;       // Length of the view
+    uint32_t refs;      // Number of open descriptors using the view
+    uint32_t pages;     // Pages allocated for a copy (0 for a direct view)
+    bool_t stale;       // The file has changed since the view was made
+} fmap_t;
+
+static fmap_t fmaps[MAX_FMAPS];
+
+static void _fs_dropMap(inode_id_t id);
+
+/*
+ * The in-memory lock on an inode. A slot is in use while the lock is held.
+ */
+typedef struct fs_lock_s {
+    inode_id_t id;      // The locked inode ({0, 0} if the slot is unused)
+    uint16_t readers;   // Number of read holds
+    uint16_t depth;     // Number of write holds (all by writer)
+    pcb_t * writer;     // The process holding the write lock, if any
+} fs_lock_t;
+
+static fs_lock_t locks[MAX_FS_LOCKS];
+
 void _fs_init( void ) {
     __cio_printf( " FS:" );
 
-    inode_buffer = _km_slice_alloc(); // Get 1024 bytes for our buffer
-    meta_buffer = _km_slice_alloc(); // We only are using the first 512 bytes
+    inode_buffer = _km_slice_alloc(KM_FS); // Get 1024 bytes for our buffer
+    meta_buffer = _km_slice_alloc(KM_FS); // We only are using the first 512 bytes
     assert(inode_buffer != NULL && meta_buffer != NULL);
 
     data_buffer = inode_buffer + BLOCK_SIZE; // Set data_buffer to the second half
     for(unsigned int i = 0; i < MAX_DISKS; i++) {
         disks[i].fsNr = 0;
     }
+    for(unsigned int i = 0; i < MAX_FMAPS; i++) {
+        fmaps[i].id = (inode_id_t){0, 0};
+        fmaps[i].refs = 0;
+        fmaps[i].pages = 0;
+    }
+    for(unsigned int i = 0; i < MAX_FS_LOCKS; i++) {
+        locks[i].id = (inode_id_t){0, 0};
+        locks[i].readers = 0;
+        locks[i].depth = 0;
+        locks[i].writer = NULL;
+    }
 
     __cio_printf( " done" );
 }
@@ -146,6 +188,78 @@ int _fs_read(fd_t * file, char * buf, uint32_t len) {
     return bytes_read;
 }
 
+/**
+ * Exposes the file data at the current offset without copying it out. The 
+ * block holding the offset is loaded into the FS data buffer, and a pointer 
+ * to the data is returned; the file offset is NOT advanced.
+ * 
+ * @param file The file descriptor to read from
+ * @param data A return pointer for the start of the available data
+ * @param len The max number of bytes the caller wants
+ * 
+ * @returns The number of bytes available at *data, or E_EOF/an error code
+ */
+int _fs_peek(fd_t * file, char ** data, uint32_t len) {
+    uint8_t devID = file->inode_id.devID;
+
+    // Compute the disk index for devID;
+    uint32_t i = 0;
+    for(; i < MAX_DISKS; i++) {
+        if(devID == disks[i].fsNr) {
+            devID = i;
+            break;
+        }
+    }
+    if(i == MAX_DISKS) {
+        __cio_printf("*ERROR* in _fs_peek: Canot find disk %d\n", file->inode_id.devID);
+        return E_BAD_CHANNEL;
+    }
+
+    // Read in inode for file
+    inode_t node;
+    int ret = _fs_getInode(file->inode_id, &node);
+    if(ret < 0) {
+        __cio_printf("*ERROR* in _fs_peek: Failed to read inode %d.%d (%d)\n", 
+            file->inode_id.devID, file->inode_id.idx, ret);
+        return E_FAILURE;
+    }
+
+    // Return EOF on EOF (or at the end of the direct blocks)
+    uint32_t blockIdx = file->offset / BLOCK_SIZE;
+    if(file->offset >= node.nBytes || blockIdx >= NUM_DIRECT_POINTERS * 4) {
+        return E_EOF;
+    }
+
+    // Find and load the block holding the offset
+    data_u ent;
+    ret = _fs_getNodeEnt(&node, blockIdx / 4, &ent);
+    if(ret < 0) {
+        __cio_printf("*ERROR* in _fs_peek: Failed to read node entry %d (%d)\n", 
+            blockIdx/4, ret);
+        return E_FAILURE;
+    }
+    block_t block = ent.blocks[blockIdx % 4];
+
+    ret = disks[devID].readBlock(block, data_buffer, disks[devID].driverNr);
+    if(ret < 0) {
+        __cio_printf( "*ERROR* in _fs_peek: Unable to read block %d from disk (%d)\n", block, ret);
+        return E_FAILURE;
+    }
+
+    // Limit the view to the request, the block, and the file
+    uint32_t idx = file->offset % BLOCK_SIZE;
+    uint32_t avail = BLOCK_SIZE - idx;
+    if(avail > node.nBytes - file->offset) {
+        avail = node.nBytes - file->offset;
+    }
+    if(avail > len) {
+        avail = len;
+    }
+
+    *data = data_buffer + idx;
+    return avail;
+}
+
 int _fs_alloc_block(uint8_t fsNr, uint32_t * blockNr) {
     fsNr = (fsNr == 0) ? disks[0].fsNr : fsNr;
 
@@ -301,6 +415,9 @@ int _fs_write(fd_t * file, char * buf, uint32_t len) {
         return E_FAILURE;
     }
 
+    // Any view of the file is about to be out of date
+    _fs_dropMap(file->inode_id);
+
     bufOffset = 0;
     while(bufOffset < len) {
         // Calculate the entry index of the next block
@@ -456,6 +573,82 @@ int _fs_kRead(inode_id_t id, int offset, char* buf, int bufSize) {
     return bytes_read;
 }
 
+/**
+ * Initializes a buffered stream at the start of a file
+ * 
+ * @param stream The stream to initialize
+ * @param id The inode of the file to read
+ */
+void _fs_streamOpen(fs_stream_t * stream, inode_id_t id) {
+    stream->fd.inode_id = id;
+    stream->fd.offset = 0;
+    stream->pos = 0;
+    stream->len = 0;
+}
+
+/**
+ * Refills a stream's buffer with (up to) one block of data
+ * 
+ * @param stream The stream to refill
+ * 
+ * @return The number of bytes buffered (<0 on error, E_EOF on EOF)
+ */
+static int _fs_streamFill(fs_stream_t * stream) {
+    int ret = _fs_read(&(stream->fd), stream->buf, BLOCK_SIZE);
+    if(ret == 0) {
+        ret = E_EOF;
+    }
+
+    stream->pos = 0;
+    stream->len = (ret > 0) ? ret : 0;
+    return ret;
+}
+
+/**
+ * Reads the next line from a buffered stream. Carriage returns, backspaces 
+ * and NUL bytes are dropped, and the newline is consumed but not stored.
+ * 
+ * @param stream The stream to read from
+ * @param buf The buffer to read into (always NUL terminated)
+ * @param bufLen The length of the buffer
+ * 
+ * @return The number of bytes read (<0 on error, E_EOF on EOF)
+ */
+int _fs_streamGetLn(fs_stream_t * stream, char * buf, int bufLen) {
+    int nRead = 0;
+
+    while(nRead < bufLen - 1) {
+        // Grab more data once the buffered block is used up
+        if(stream->pos == stream->len) {
+            int ret = _fs_streamFill(stream);
+            if(ret == E_EOF) {
+                if(nRead > 0) {
+                    break;
+                }
+
+                buf[0] = 0;
+                return E_EOF;
+            } else if(ret < 0) {
+                __cio_printf("*ERROR* in _fs_streamGetLn: Failed to read from file (%d)\n", ret);
+                buf[nRead] = 0;
+                return E_FAILURE;
+            }
+        }
+
+        char ch = stream->buf[stream->pos++];
+        if(ch == '\n') {
+            break;
+        } else if(ch == '\b' || ch == '\r' || ch == 0) {
+            continue;
+        }
+
+        buf[nRead++] = ch;
+    }
+
+    buf[nRead] = 0;
+    return nRead;
+}
+
 /**
  * Reads an inode from disk (Exposed)
  * 
@@ -673,7 +866,7 @@ int _fs_setNodeEnt(inode_t* inode, int idx, data_u ent) {
 }
 
 /**
- * Adds an entry to a directory inode (Exposed)
+ * Adds an entry to a directory inode (caller holds the directory's lock)
  * 
  * @param inode The inode to update
  * @param name The name to associate with this entry
@@ -681,7 +874,7 @@ int _fs_setNodeEnt(inode_t* inode, int idx, data_u ent) {
  * 
  * @return A standard exit status
  */
-int _fs_addDirEnt(inode_id_t inode, const char* name, inode_id_t buf) {
+static int _fs_addDirEntLocked(inode_id_t inode, const char* name, inode_id_t buf) {
     inode_t tgt, child;
     int ret;
 
@@ -776,14 +969,15 @@ int _fs_addDirEnt(inode_id_t inode, const char* name, inode_id_t buf) {
 }
 
 /**
- * Removes an entry from a directory inode (Exposed)
+ * Removes an entry from a directory inode (caller holds the directory's and 
+ * the entry's locks)
  * 
  * @param inode The inode to update
  * @param name The entry name to remove
  * 
  * @return A standard exit status
  */
-int _fs_rmDirEnt(inode_id_t inode, const char* name) {
+static int _fs_rmDirEntLocked(inode_id_t inode, const char* name) {
     inode_id_t childId;
     inode_t tgt, child;
     int ret, idx;
@@ -877,6 +1071,61 @@ int _fs_rmDirEnt(inode_id_t inode, const char* name) {
     return E_SUCCESS;
 }
 
+/**
+ * Adds an entry to a directory inode (Exposed)
+ * 
+ * @param inode The inode to update
+ * @param name The name to associate with this entry
+ * @param buf The new target inode
+ * 
+ * @return A standard exit status
+ */
+int _fs_addDirEnt(inode_id_t inode, const char* name, inode_id_t buf) {
+    int ret = _fs_lock(inode, true, _current);
+    if(ret < 0) {
+        return ret;
+    }
+
+    ret = _fs_addDirEntLocked(inode, name, buf);
+    _fs_unlock(inode, true);
+
+    return ret;
+}
+
+/**
+ * Removes an entry from a directory inode (Exposed)
+ * 
+ * @param inode The inode to update
+ * @param name The entry name to remove
+ * 
+ * @return A standard exit status
+ */
+int _fs_rmDirEnt(inode_id_t inode, const char* name) {
+    inode_id_t childId;
+    int ret;
+
+    // Lock the directory before looking up the entry
+    ret = _fs_lock(inode, true, _current);
+    if(ret < 0) {
+        return ret;
+    }
+
+    // The entry may be freed, so nobody else can be using it either
+    ret = _fs_getSubDir(inode, (char *) name, &childId);
+    if(ret >= 0) {
+        ret = _fs_lock(childId, true, _current);
+        if(ret >= 0) {
+            ret = _fs_rmDirEntLocked(inode, name);
+            _fs_unlock(childId, true);
+        }
+    } else {
+        ret = _fs_rmDirEntLocked(inode, name); // Reports the missing entry
+    }
+
+    _fs_unlock(inode, true);
+    return ret;
+}
+
 /**
  * Returns a particular inode entry (Exposed)
  * 
@@ -1025,6 +1274,9 @@ int _fs_freeNode(inode_id_t id) {
         return ret;
     }
 
+    // Don't let a cached view outlive the file
+    _fs_dropMap(id);
+
     // Free indirect blocks associated with this node
     //todo free indirect blocks
 
@@ -1141,3 +1393,340 @@ int _fs_nodePermission(inode_t * node, uid_t uid, gid_t gid, bool_t * canRead, b
 
     return E_SUCCESS;
 }
+
+/**
+ * Releases the memory behind a view and frees its slot
+ * 
+ * @param map The view to release
+ */
+static void _fs_releaseMap(fmap_t * map) {
+    // Copies were allocated as one block of pages
+    if(map->pages > 0) {
+        _km_page_free(map->base);
+    }
+
+    map->id = (inode_id_t){0, 0};
+    map->base = NULL;
+    map->len = 0;
+    map->refs = 0;
+    map->pages = 0;
+    map->stale = false;
+}
+
+/**
+ * Invalidates any view of a file (called when the file changes). Views still 
+ * in use are released once their last reference is dropped.
+ * 
+ * @param id The inode of the changing file
+ */
+static void _fs_dropMap(inode_id_t id) {
+    for(int i = 0; i < MAX_FMAPS; i++) {
+        if(fmaps[i].id.devID == id.devID && fmaps[i].id.idx == id.idx) {
+            if(fmaps[i].refs == 0) {
+                _fs_releaseMap(&fmaps[i]);
+            } else {
+                fmaps[i].stale = true;
+            }
+        }
+    }
+}
+
+/**
+ * Gets a read-only, contiguous in-memory view of a whole file
+ * 
+ * @param id The inode of the file to map
+ * @param base A return pointer for the start of the view
+ * @param len A return pointer for the length of the view
+ * 
+ * @return The view number (>= 0) for _fs_unmap, or an error code
+ */
+int _fs_map(inode_id_t id, char ** base, uint32_t * len) {
+    fmap_t * map = NULL;
+    int ret;
+
+    // Reuse a current view of this file if there is one, otherwise find a 
+    // free slot (or failing that, an unused cached view to evict)
+    for(int i = 0; i < MAX_FMAPS; i++) {
+        if(fmaps[i].id.devID == id.devID && fmaps[i].id.idx == id.idx && !fmaps[i].stale) {
+            fmaps[i].refs++;
+            *base = fmaps[i].base;
+            *len = fmaps[i].len;
+            return i;
+        }
+
+        if(fmaps[i].id.devID == 0 && fmaps[i].id.idx == 0) {
+            map = &fmaps[i];
+        } else if(map == NULL && fmaps[i].refs == 0) {
+            map = &fmaps[i];
+        }
+    }
+    if(map == NULL) {
+        __cio_printf("*ERROR* in _fs_map: Out of file views\n");
+        return E_FILE_LIMIT;
+    }
+    if(map->id.devID != 0 || map->id.idx != 0) {
+        _fs_releaseMap(map);
+    }
+
+    // Compute the disk index for devID
+    uint32_t devIdx = 0;
+    for(; devIdx < MAX_DISKS; devIdx++) {
+        if(id.devID == disks[devIdx].fsNr) {
+            break;
+        }
+    }
+    if(devIdx == MAX_DISKS) {
+        __cio_printf("*ERROR* in _fs_map: Cannot find disk %d\n", id.devID);
+        return E_BAD_CHANNEL;
+    }
+
+    inode_t node;
+    ret = _fs_getInode(id, &node);
+    if(ret < 0) {
+        __cio_printf("*ERROR* in _fs_map: Failed to read inode %d.%d (%d)\n", 
+            id.devID, id.idx, ret);
+        return ret;
+    }
+    if(node.nodeType != INODE_FILE_TYPE) {
+        return E_BAD_PARAM;
+    }
+
+    uint32_t nBlocks = (node.nBytes + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    if(nBlocks > NUM_DIRECT_POINTERS * 4) {
+        return E_BAD_PARAM;     // Only direct blocks are readable
+    }
+
+    // Memory resident files with contiguous blocks can be viewed in place
+    char * direct = NULL;
+    if(disks[devIdx].mapBlock != NULL && nBlocks > 0) {
+        block_t first = 0;
+        uint32_t i;
+
+        for(i = 0; i < nBlocks; i++) {
+            data_u ent;
+            if(_fs_getNodeEnt(&node, i / 4, &ent) < 0) {
+                break;
+            }
+            if(i == 0) {
+                first = ent.blocks[0];
+            } else if(ent.blocks[i % 4] != first + i) {
+                break;
+            }
+        }
+
+        if(i == nBlocks) {
+            direct = disks[devIdx].mapBlock(first, disks[devIdx].driverNr);
+        }
+    }
+
+    map->id = id;
+    map->len = node.nBytes;
+    map->refs = 1;
+    map->stale = false;
+
+    if(direct != NULL || nBlocks == 0) {
+        map->base = direct;
+        map->pages = 0;
+    } else {
+        // Build a contiguous copy
+        map->pages = (node.nBytes + PAGE_SIZE - 1) / PAGE_SIZE;
+        map->base = _km_page_alloc(map->pages, KM_FS);
+        if(map->base == NULL) {
+            map->pages = 0;
+            _fs_releaseMap(map);
+            return E_NO_MEMORY;
+        }
+
+        ret = _fs_kRead(id, 0, map->base, node.nBytes);
+        if(ret != node.nBytes) {
+            __cio_printf("*ERROR* in _fs_map: Failed to copy file %d.%d (%d)\n", 
+                id.devID, id.idx, ret);
+            _fs_releaseMap(map);
+            return E_FAILURE;
+        }
+    }
+
+    *base = map->base;
+    *len = map->len;
+    return map - fmaps;
+}
+
+/**
+ * Drops a reference taken by _fs_map
+ * 
+ * @param view The view number returned by _fs_map
+ * 
+ * @return A standard exit status
+ */
+int _fs_unmap(int view) {
+    if(view < 0 || view >= MAX_FMAPS || fmaps[view].refs == 0) {
+        return E_BAD_PARAM;
+    }
+
+    fmap_t * map = &fmaps[view];
+    map->refs--;
+    if(map->refs == 0 && map->stale) {
+        _fs_releaseMap(map);
+    }
+
+    return E_SUCCESS;
+}
+
+/**
+ * Converts an inode id to the form used in the lock table (the root alias 
+ * {0, 1} names the root of the first disk)
+ * 
+ * @param id The id to convert
+ * 
+ * @return The canonical id
+ */
+static inode_id_t _fs_lockId(inode_id_t id) {
+    if(id.devID == 0 && id.idx == 1) {
+        id = (inode_id_t){disks[0].fsNr, 1};
+    }
+    return id;
+}
+
+/**
+ * Finds the lock table entry for an inode
+ * 
+ * @param id The (canonical) inode id
+ * @param alloc True to claim a free slot if the inode has no entry
+ * 
+ * @return The entry, or NULL if there is none (or no room for one)
+ */
+static fs_lock_t * _fs_findLock(inode_id_t id, bool_t alloc) {
+    fs_lock_t * free = NULL;
+
+    for(unsigned int i = 0; i < MAX_FS_LOCKS; i++) {
+        if(locks[i].id.devID == id.devID && locks[i].id.idx == id.idx) {
+            return &locks[i];
+        }
+        if(free == NULL && locks[i].id.devID == 0 && locks[i].id.idx == 0) {
+            free = &locks[i];
+        }
+    }
+
+    if(!alloc || free == NULL) {
+        return NULL;
+    }
+
+    free->id = id;
+    free->readers = 0;
+    free->depth = 0;
+    free->writer = NULL;
+    return free;
+}
+
+/**
+ * Tries to take an inode's lock
+ * 
+ * @param id The inode to lock
+ * @param write True for an exclusive (write) lock, false for a shared one
+ * @param owner The process taking a write lock (lets it nest)
+ * 
+ * @return E_SUCCESS, E_BUSY if the lock is held (a bug, see kfs.h), or 
+ *         E_FILE_LIMIT if the lock table is full
+ */
+int _fs_lock(inode_id_t id, bool_t write, pcb_t * owner) {
+    id = _fs_lockId(id);
+    if(id.devID == 0) {
+        return E_BAD_PARAM;
+    }
+
+    fs_lock_t * lock = _fs_findLock(id, true);
+    if(lock == NULL) {
+        __cio_printf("*ERROR* in _fs_lock: Lock table full (%d.%d)\n", id.devID, id.idx);
+        return E_FILE_LIMIT;
+    }
+
+    // The write holder can take either kind of hold again
+    if(lock->writer != NULL && lock->writer == owner) {
+        if(write) {
+            lock->depth++;
+        } else {
+            lock->readers++;
+        }
+        return E_SUCCESS;
+    }
+
+    // Nothing holds a lock across a dispatch, so no one else can have it
+    if(lock->writer != NULL || (write && lock->readers > 0)) {
+        __cio_printf("*ERROR* in _fs_lock: Inode %d.%d is busy\n", id.devID, id.idx);
+        return E_BUSY;
+    }
+
+    if(write) {
+        lock->writer = owner;
+        lock->depth = 1;
+    } else {
+        lock->readers++;
+    }
+
+    return E_SUCCESS;
+}
+
+/**
+ * Tries to take the write locks for two directories, in inode order. Either 
+ * both are taken or neither is.
+ * 
+ * @param a The first directory
+ * @param b The second directory (may be the same as a)
+ * @param owner The process taking the locks
+ * 
+ * @return E_SUCCESS, or the failure from _fs_lock
+ */
+int _fs_lockDirs(inode_id_t a, inode_id_t b, pcb_t * owner) {
+    int ret;
+
+    a = _fs_lockId(a);
+    b = _fs_lockId(b);
+
+    // Order the pair so every caller takes them the same way around
+    if(b.devID < a.devID || (b.devID == a.devID && b.idx < a.idx)) {
+        inode_id_t temp = a;
+        a = b;
+        b = temp;
+    }
+
+    ret = _fs_lock(a, true, owner);
+    if(ret < 0) {
+        return ret;
+    }
+
+    ret = _fs_lock(b, true, owner);
+    if(ret < 0) {
+        _fs_unlock(a, true);
+        return ret;
+    }
+
+    return E_SUCCESS;
+}
+
+/**
+ * Releases one hold on an inode's lock
+ * 
+ * @param id The inode to unlock
+ * @param write True to release a write hold, false for a read hold
+ */
+void _fs_unlock(inode_id_t id, bool_t write) {
+    fs_lock_t * lock = _fs_findLock(_fs_lockId(id), false);
+    if(lock == NULL) {
+        __cio_printf("*ERROR* in _fs_unlock: Inode %d.%d is not locked\n", id.devID, id.idx);
+        return;
+    }
+
+    if(write && lock->depth > 0) {
+        if(--lock->depth == 0) {
+            lock->writer = NULL;
+        }
+    } else if(!write && lock->readers > 0) {
+        lock->readers--;
+    }
+
+    if(lock->writer != NULL || lock->readers > 0) {
+        return;
+    }
+
+    lock->id = (inode_id_t){0, 0};
+}
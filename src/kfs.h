@@ -9,6 +9,12 @@
 
 #define MAX_DISKS 10
 
+// Number of fmap() views (direct or cached copies) that can exist at once
+#define MAX_FMAPS 16
+
+// Number of inodes that can be locked (or waited on) at once
+#define MAX_FS_LOCKS 32
+
 void _fs_init(void);
 
 /**
@@ -31,6 +37,22 @@ int _fs_registerDev(driverInterface_t interface);
  */
 int _fs_read(fd_t * file, char * buf, uint32_t len);
 
+/**
+ * Exposes the file data at the current offset without copying it out. The 
+ * block holding the offset is loaded into the FS data buffer, and a pointer 
+ * to the data is returned; the file offset is NOT advanced, so the caller 
+ * must add however many bytes it consumes. The view is only valid until the 
+ * next FS call.
+ * 
+ * @param file The file descriptor to read from
+ * @param data A return pointer for the start of the available data
+ * @param len The max number of bytes the caller wants
+ * 
+ * @returns The number of bytes available at *data (never past the end of the 
+ *          block), or E_EOF/an error code
+ */
+int _fs_peek(fd_t * file, char ** data, uint32_t len);
+
 /**
  * FS write handler
  * 
@@ -44,6 +66,67 @@ int _fs_write(fd_t * file, char * buf, uint32_t len);
 
 int _fs_kRead(inode_id_t id, int offset, char* buf, int bufSize);
 
+/**
+ * Buffered read stream over a file, used for kernel-side parsing of text files
+ * (e.g. /.groups). Each refill pulls up to a full block with one _fs_read call,
+ * so lines are scanned in memory rather than with one read per byte.
+ */
+typedef struct fs_stream_s {
+    fd_t fd;                // The file (and offset) backing this stream
+    uint32_t pos;           // Index of the next unconsumed byte in buf
+    uint32_t len;           // Number of valid bytes in buf
+    char buf[BLOCK_SIZE];   // Buffered file data
+} fs_stream_t;
+
+/**
+ * Initializes a buffered stream at the start of a file
+ * 
+ * @param stream The stream to initialize
+ * @param id The inode of the file to read
+ */
+void _fs_streamOpen(fs_stream_t * stream, inode_id_t id);
+
+/**
+ * Reads the next line from a buffered stream. Carriage returns, backspaces 
+ * and NUL bytes are dropped, and the newline is consumed but not stored.
+ * 
+ * @param stream The stream to read from
+ * @param buf The buffer to read into (always NUL terminated)
+ * @param bufLen The length of the buffer
+ * 
+ * @return The number of bytes read (<0 on error, E_EOF on EOF)
+ */
+int _fs_streamGetLn(fs_stream_t * stream, char * buf, int bufLen);
+
+/**
+ * Gets a read-only, contiguous in-memory view of a whole file. If the file 
+ * lives on a memory resident device and its blocks are contiguous the view is 
+ * the device memory itself; otherwise a copy is built once and cached for 
+ * later maps. Each successful call takes a reference on the view that must 
+ * be dropped with _fs_unmap.
+ * 
+ * A copy is a snapshot: later changes to the file only stop it being handed 
+ * to new maps. A direct view aliases the file's blocks instead. Writes only 
+ * append, so the bytes it covers don't change while the file exists, but once 
+ * the file is removed its blocks may be reused, and the view with them.
+ * 
+ * @param id The inode of the file to map
+ * @param base A return pointer for the start of the view
+ * @param len A return pointer for the length of the view
+ * 
+ * @return The view number (>= 0) for _fs_unmap, or an error code
+ */
+int _fs_map(inode_id_t id, char ** base, uint32_t * len);
+
+/**
+ * Drops a reference taken by _fs_map
+ * 
+ * @param view The view number returned by _fs_map
+ * 
+ * @return A standard exit status
+ */
+int _fs_unmap(int view);
+
 /**
  * Reads an inode from disk
  * 
@@ -75,7 +158,7 @@ int _fs_setInode(inode_t inode);
 int _fs_getNodeEnt(inode_t* inode, int idx, data_u * ret);
 
 /**
- * Adds an entry to a directory inode
+ * Adds an entry to a directory inode (takes the directory's write lock)
  * 
  * @param inode The inode to update
  * @param name The name to associate with this entry
@@ -86,7 +169,8 @@ int _fs_getNodeEnt(inode_t* inode, int idx, data_u * ret);
 int _fs_addDirEnt(inode_id_t inode, const char* name, inode_id_t buf);
 
 /**
- * Removes an entry from a directory inode
+ * Removes an entry from a directory inode (takes the directory's write lock, 
+ * then the entry's)
  * 
  * @param inode The inode to update
  * @param name The entry name to remove
@@ -164,4 +248,53 @@ int _fs_getPermission(inode_id_t id, uid_t uid, gid_t gid, bool_t * canRead, boo
  */
 int _fs_nodePermission(inode_t * node, uid_t uid, gid_t gid, bool_t * canRead, bool_t * canWrite, bool_t * canMeta);
 
+/*
+ * Inode locks
+ * 
+ * Each inode has an in-memory reader/writer lock: any number of readers can 
+ * share it, while a writer holds it alone (a writer may take its own lock 
+ * again, and may also read). 
+ * 
+ * System calls run with interrupts off and the disk is polled, so every 
+ * lock is released before the process that took it is dispatched away 
+ * (a blocked splice() lets go of its lock first). A lock is therefore never 
+ * found busy: the locks assert that invariant rather than arbitrate between 
+ * processes. A busy lock is a kernel bug, reported on the console and 
+ * returned as E_BUSY. Operations that need more than one lock still take them 
+ * in a fixed order (a directory before its entries, and two directories in 
+ * inode order, see _fs_lockDirs), so the invariant can be relaxed later.
+ */
+
+/**
+ * Tries to take an inode's lock
+ * 
+ * @param id The inode to lock
+ * @param write True for an exclusive (write) lock, false for a shared one
+ * @param owner The process taking a write lock (lets it nest)
+ * 
+ * @return E_SUCCESS, E_BUSY if the lock is held (a bug, see above), or 
+ *         E_FILE_LIMIT if the lock table is full
+ */
+int _fs_lock(inode_id_t id, bool_t write, pcb_t * owner);
+
+/**
+ * Tries to take the write locks for two directories, in inode order. Either 
+ * both are taken or neither is.
+ * 
+ * @param a The first directory
+ * @param b The second directory (may be the same as a)
+ * @param owner The process taking the locks
+ * 
+ * @return E_SUCCESS, or the failure from _fs_lock
+ */
+int _fs_lockDirs(inode_id_t a, inode_id_t b, pcb_t * owner);
+
+/**
+ * Releases one hold on an inode's lock
+ * 
+ * @param id The inode to unlock
+ * @param write True to release a write hold, false for a read hold
+ */
+void _fs_unlock(inode_id_t id, bool_t write);
+
 #endif //KFS_H_
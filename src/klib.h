@@ -262,6 +262,40 @@ void __outl( int port, int value );
 */
 unsigned int __get_flags( void );
 
+/**
+** Name:	__bsf
+**
+** Description:	Find the lowest set bit in a word
+**
+** @param value  The word to scan (must be non-zero)
+**
+** @return The bit number (0-31) of the least significant 1 bit
+*/
+uint32_t __bsf( uint32_t value );
+
+/**
+** Name:	__rdtsc
+**
+** Description:	Read the CPU time stamp counter
+**
+** @return The number of CPU cycles since reset
+*/
+uint64_t __rdtsc( void );
+
+/**
+** Name:	__udiv64
+**
+** Description:	Divide a 64-bit value by a 32-bit value, without
+**		help from libgcc
+**
+** @param num   The dividend
+** @param den   The divisor (must be non-zero)
+** @param rem   Where to store the remainder (may be NULL)
+**
+** @return The quotient
+*/
+uint64_t __udiv64( uint64_t num, uint32_t den, uint32_t *rem );
+
 /**
 ** Name:	__pause
 **
@@ -269,6 +303,43 @@ unsigned int __get_flags( void );
 */
 void __pause( void );
 
+/**
+** Name:	__intr_save
+**
+** Description:	Disable interrupts
+**
+** @return The prior EFLAGS, for __intr_restore()
+*/
+uint32_t __intr_save( void );
+
+/**
+** Name:	__intr_restore
+**
+** Description:	Restore the interrupt state saved by __intr_save()
+**
+** @param flags  The saved EFLAGS
+*/
+void __intr_restore( uint32_t flags );
+
+/**
+** Name:	__xadd
+**
+** Description:	Atomically add to a longword
+**
+** @param ptr    The longword
+** @param value  The amount to add
+**
+** @return The prior contents of the longword
+*/
+uint32_t __xadd( volatile uint32_t *ptr, uint32_t value );
+
+/**
+** Name:	__relax
+**
+** Description:	Pause briefly in a spin-wait loop
+*/
+void __relax( void );
+
 /**
 ** __get_ra:
 **
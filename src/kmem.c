@@ -9,38 +9,36 @@
 **      NOTE: these should NOT be called by user processes!
 **
 **
-** This allocator functions as a simple "slab" allocator; it allows
-** allocation of either 4096-byte ("page") or 1024-byte ("slice")
-** chunks of memory from the free pool.  The free pool is initialized
+** This allocator provides 4096-byte pages (singly or in blocks) and
+** smaller objects carved from them.  The free pool is initialized
 ** using the memory map provided by the BIOS during the boot sequence,
-** and contains a series of blocks which are multiples of 4K bytes and
-** which are aligned at 4K boundaries; they are held in the free list
-** in order by base address.
-**
-** The "page" allocator allows allocation of one or more 4K blocks
-** at a time.  Requests are made for a specific number of 4K pages;
-** the allocator locates the first free list entry that contains at
-** least the requested amount of space.  If that entry is the exact
-** size requested, it is unlinked and returned; otherwise, the entry
-** is split into a chunk of the requested size and the remainder.
-** The chunk is returned, and the remainder replaces the original
-** block in the free list.  On deallocation, the block is inserted
-** at the appropriate place in the free list, and physically adjacent
-** blocks are coalesced into single, larger blocks.  If a multi-page
-** block is allocated, it should be deallocated one page at a time,
-** because there is no record of the size of the original allocation -
-** all we know is that it is N*4K bytes in length, so it's up to the
-** requesting code to figure this out.
-**
-** The "slice" allocator operates by taking blocks from the "page"
-** allocator and splitting them into four 1K slices, which it then
-** manages.  Requests are made for slices one at a time.  If the free
-** list contains an available slice, it is unlinked and returned;
-** otherwise, a page is requested from the page allocator, split into
-** slices, and the slices are added to the free list, after which the
-** first one is returned.  The slice free list is a simple linked list
-** of these 1K blocks; because they are all the same size, no ordering
-** is done on the free list, and no coalescing is performed.
+** and is divided into blocks which are a power of two pages in size
+** and aligned on a boundary of that size.
+**
+** The "page" allocator is a binary buddy allocator.  Free memory is
+** held as blocks of 2^order pages, each aligned on a 2^order page
+** boundary, with one free list per order.  A request for N pages is
+** rounded up to the next power of two; the smallest free block that
+** is large enough is taken, and split in half repeatedly (the unused
+** halves going onto the lower-order lists) until it is the right
+** size.  On deallocation, a block is merged with its "buddy" (the
+** other half of the block it was split from) for as long as that
+** buddy is also free, and the result goes onto the appropriate list.
+** Both operations take O(log n) time.
+**
+** A one-byte entry per page (the page map, carved from free memory
+** during initialization) records the order of each free block and of
+** each allocated block, so a multi-page block is freed with a single
+** call.
+**
+** Smaller allocations come from object caches.  A cache hands out
+** objects of one size from "slabs" (blocks from the page allocator),
+** using a bitmap in each slab to track its free objects.  There are
+** general caches for sizes from 32 bytes to 2KB (_km_alloc), and
+** modules can create named caches for their own structures.  Slabs
+** that empty out are given back to the page allocator, so kernel
+** memory shrinks again when the load drops.  The old 1K "slice"
+** interface is kept, and is served by the 1KB size class.
 **
 */
 
@@ -54,6 +52,7 @@
 #include "cio.h"
 
 #include "kmem.h"
+#include "lock.h"
 
 /*
 ** PRIVATE DEFINITIONS
@@ -73,16 +72,30 @@
 #define P2B(x)   ((x) << LOG2_OF_PAGE_SIZE)
 #define B2P(x)   ((x) >> LOG2_OF_PAGE_SIZE)
 
-/*
-** Name:    adjacent
-**
-** Arguments:   addresses of two blocks
-**
-** Description: Determines whether the second block immediately
-**      follows the first one.
-*/
-#define adjacent(first,second)  \
-    ( (void *) (first) + P2B((first)->pages) == (void *) (second) )
+// number of block sizes (orders) in the buddy allocator; the largest
+// block is 2^(N_ORDERS-1) pages (1GB)
+
+#define N_ORDERS    19
+
+// maximum number of usable memory regions we will manage
+
+#define N_REGIONS   32
+
+// object caches:  the maximum number, the size classes for _km_alloc(),
+// the smallest number of objects a slab should hold, and the number of
+// empty slabs each cache keeps for reuse
+
+#define N_CACHES        16
+#define N_SIZES         7
+#define KM_MAX_SIZE     2048
+#define KM_MIN_OBJS     8
+#define KM_KEEP_EMPTY   1
+
+// page map entries:  the block order plus the block's state
+
+#define PM_ORDER    0x1f    // order of the block starting at this page
+#define PM_FREE     0x80    // the page begins a free block
+#define PM_USED     0x40    // the page begins an allocated block
 
 /*
 ** PRIVATE DATA TYPES
@@ -96,8 +109,56 @@
 typedef struct blkinfo_s {
     uint32_t pages;           // length of this block, in pages
     struct   blkinfo_s *next; // pointer to the next free block
+    struct   blkinfo_s *prev; // pointer to the previous free block
 } Blockinfo;
 
+/*
+** A slab of objects from a cache (the header at the start of the
+** slab's block of pages)
+*/
+
+#define SLAB_MAP_WORDS  4   // bitmap words per slab (up to 128 objects)
+
+typedef struct slab_s {
+    struct cache_s *cache;          // the cache this slab belongs to
+    struct slab_s *next;            // next slab on the cache's list
+    struct slab_s *prev;            // previous slab on the cache's list
+    uint32_t inuse;                 // number of allocated objects
+    uint32_t map[SLAB_MAP_WORDS];   // free object bitmap (1 == free)
+    uint8_t tags[SLAB_MAP_WORDS * 32];  // accounting tag of each object
+} Slab;
+
+// objects start after the header, on a 16-byte boundary
+
+#define SLAB_HDR_SIZE   ((sizeof(Slab) + 15) & ~15)
+
+/*
+** An object cache (cache_t points to one of these)
+*/
+
+typedef struct cache_s {
+    const char *name;   // name, for _km_cache_dump()
+    uint32_t size;      // object size, in bytes
+    uint32_t pages;     // slab size, in pages
+    uint32_t count;     // objects per slab
+    uint8_t tag;        // accounting tag for objects from _km_cache_alloc
+    Slab *partial;      // slabs with some objects in use
+    Slab *full;         // slabs with every object in use
+    Slab *empty;        // slabs with no objects in use
+    uint32_t n_empty;   // length of the empty list
+    uint32_t slabs;     // number of slabs allocated
+    uint32_t inuse;     // number of objects allocated
+} Cache;
+
+/*
+** A usable memory region, after trimming to our limits
+*/
+
+typedef struct span_s {
+    uint32_t base;    // base address (page-aligned)
+    uint32_t pages;   // length, in pages
+} Span;
+
 /*
 ** Memory region information returned by the BIOS
 **
@@ -156,12 +217,40 @@ typedef struct memregion_s {
 */
 
 // freespace pools
-static Blockinfo *_free_pages;
-static Blockinfo *_free_slices;
+static Blockinfo *_free_pages[N_ORDERS];
+static uint32_t _free_count[N_ORDERS];
+
+// the page map, and the range of page numbers it covers
+static uint8_t *_page_map;
+static uint32_t _first_page;
+static uint32_t _map_pages;
+
+// accounting:  the tag of each allocated block (indexed like the page
+// map), the statistics for each tag, and the free page counts
+static uint8_t *_page_tag;
+static kmstat_t _km_stats[N_KMTAGS];
+static const char *_tag_names[N_KMTAGS] = KM_TAG_NAMES;
+static uint32_t _pages_total;
+static uint32_t _pages_free;
+static uint32_t _pages_low;
+
+// usable regions found in the BIOS memory map
+static Span _regions[N_REGIONS];
+static int _n_regions;
+
+// object caches, and the size classes among them
+static Cache _caches[N_CACHES];
+static int _n_caches;
+static Cache *_sizes[N_SIZES];
 
 // initialization status
 static int _km_initialized = 0;
 
+// one lock covers the page allocator and all the caches; the public
+// entry points take it (with interrupts off, as the idle process
+// allocates with interrupts enabled), and everything else assumes it
+static spinlock_t _km_lock;
+
 /*
 ** IMPORTED GLOBAL VARIABLES
 */
@@ -176,79 +265,239 @@ extern int _end;    // end of the BSS section - provided by the linker
 ** FREE LIST MANAGEMENT
 */
 
+/**
+** Name:    _order_of
+**
+** Find the smallest order whose blocks hold a given number of pages
+**
+** @param count  Number of pages
+**
+** @return the order
+*/
+static uint32_t _order_of( uint32_t count ) {
+    uint32_t order = 0;
+
+    while( (1U << order) < count ) {
+        ++order;
+    }
+
+    return( order );
+}
+
+/**
+** Name:    _push_block
+**
+** Add a block to the front of the free list for its order
+**
+** @param block  The block
+** @param order  Its order
+*/
+static void _push_block( Blockinfo *block, uint32_t order ) {
+
+    _page_map[ B2P((uint32_t) block) - _first_page ] = PM_FREE | order;
+
+    block->pages = 1U << order;
+    _pages_free += 1U << order;
+    block->prev = NULL;
+    block->next = _free_pages[order];
+    if( block->next != NULL ) {
+        block->next->prev = block;
+    }
+    _free_pages[order] = block;
+    _free_count[order] += 1;
+}
+
+/**
+** Name:    _unlink_block
+**
+** Remove a block from the free list for its order
+**
+** @param block  The block
+** @param order  Its order
+*/
+static void _unlink_block( Blockinfo *block, uint32_t order ) {
+
+    _page_map[ B2P((uint32_t) block) - _first_page ] = 0;
+
+    if( block->prev != NULL ) {
+        block->prev->next = block->next;
+    } else {
+        _free_pages[order] = block->next;
+    }
+    if( block->next != NULL ) {
+        block->next->prev = block->prev;
+    }
+    _free_count[order] -= 1;
+    _pages_free -= 1U << order;
+}
+
+/**
+** Name:    _free_block
+**
+** Return a block to the free lists, merging it with its buddy
+** for as long as the buddy is also free
+**
+** @param page   Page number of the start of the block
+** @param order  Order of the block
+*/
+static void _free_block( uint32_t page, uint32_t order ) {
+
+    while( order < N_ORDERS - 1 ) {
+        uint32_t buddy = page ^ (1U << order);
+
+        // the buddy must be managed memory, and free at this size
+        if( buddy < _first_page || buddy - _first_page >= _map_pages ) {
+            break;
+        }
+        if( _page_map[buddy - _first_page] != (PM_FREE | order) ) {
+            break;
+        }
+
+        // take it off its list and combine the two
+        _unlink_block( (Blockinfo *) P2B(buddy), order );
+        _page_map[page - _first_page] = 0;
+        if( buddy < page ) {
+            page = buddy;
+        }
+        ++order;
+    }
+
+    _push_block( (Blockinfo *) P2B(page), order );
+}
+
 /**
 ** Name:    _add_block
 **
-** Add a block to the free list
+** Add a region to the free lists, as the largest aligned blocks
+** that it can be split into
 **
-** @param base   Base address of the block
-** @param length Block length, in bytes
+** @param base   Base address of the region (page-aligned)
+** @param pages  Region length, in pages
 */
-static void _add_block( uint32_t base, uint32_t length ) {
-    Blockinfo *block;
+static void _add_block( uint32_t base, uint32_t pages ) {
+    uint32_t page = B2P(base);
 
-    // don't add it if it isn't at least 4K
-    if( length < PAGE_SIZE ) {
-        return;
+    while( pages > 0 ) {
+        uint32_t order = 0;
+
+        // grow the block while it stays aligned and inside the region
+        while( order < N_ORDERS - 1
+                && (page & ((2U << order) - 1)) == 0
+                && (2U << order) <= pages ) {
+            ++order;
+        }
+
+        _free_block( page, order );
+        page  += 1U << order;
+        pages -= 1U << order;
     }
+}
+
+/**
+** Name:    _build_free_lists
+**
+** Allocate the page map from the first region large enough to hold
+** it, then add all the regions to the free lists
+*/
+static void _build_free_lists( void ) {
+    uint32_t last = 0;
 
-    // only want to add multiples of 4K; check the lower bits
-    if( (length & 0xfff) != 0 ) {
-        // round it down to 4K
-        length &= 0xfffff000;
+    _first_page = ~0U;
+    for( int i = 0; i < _n_regions; ++i ) {
+        if( B2P(_regions[i].base) < _first_page ) {
+            _first_page = B2P(_regions[i].base);
+        }
+        if( B2P(_regions[i].base) + _regions[i].pages > last ) {
+            last = B2P(_regions[i].base) + _regions[i].pages;
+        }
     }
+    _map_pages = last - _first_page;
 
-    // create the "block"
+    // the page map and the tag array occupy whole pages
+    uint32_t need = B2P(2 * _map_pages + PAGE_SIZE - 1);
 
-    block = (Blockinfo *) base;
-    block->pages = B2P(length);
-    block->next = NULL;
+    for( int i = 0; i < _n_regions; ++i ) {
+        if( _regions[i].pages > need ) {
+            _page_map = (uint8_t *) _regions[i].base;
+            _regions[i].base += P2B(need);
+            _regions[i].pages -= need;
+            break;
+        }
+    }
+    assert( _page_map != NULL );
 
-    /*
-    ** We maintain the free list in order by address, to simplify
-    ** coalescing adjacent free blocks.
-    **
-    ** Handle the easiest case first.
-    */
+    // nothing is free until it is added
+    __memclr( _page_map, 2 * _map_pages );
+    _page_tag = _page_map + _map_pages;
 
-    if( _free_pages == NULL ) {
-        _free_pages = block;
-        return;
+    for( int i = 0; i < _n_regions; ++i ) {
+        _add_block( _regions[i].base, _regions[i].pages );
     }
 
-    /*
-    ** Unfortunately, it's not always that easy....
-    **
-    ** Find the correct insertion spot.
-    */
+    _pages_total = _pages_low = _pages_free;
+}
 
-    Blockinfo *prev, *curr;
+/*
+** ACCOUNTING
+*/
 
-    prev = NULL;
-    curr = _free_pages;
+/**
+** Name:    _km_count
+**
+** Record an allocation (or a failed one)
+**
+** @param tag    Accounting tag of the allocation
+** @param bytes  Size of the allocation, or 0 if it failed
+*/
+static void _km_count( uint8_t tag, uint32_t bytes ) {
+    kmstat_t *stat = &_km_stats[tag < N_KMTAGS ? tag : KM_OTHER];
 
-    while( curr && curr < block ) {
-        prev = curr;
-        curr = curr->next;
+    if( bytes == 0 ) {
+        stat->fails += 1;
+        return;
     }
 
-    // the new block always points to its successor
-    block->next = curr;
+    stat->allocs += 1;
+    stat->inuse += bytes;
+    if( stat->inuse > stat->peak ) {
+        stat->peak = stat->inuse;
+    }
+}
 
-    /*
-    ** If prev is NULL, we're adding at the front; otherwise,
-    ** we're adding after some other entry (middle or end).
-    */
+/**
+** Name:    _km_uncount
+**
+** Record a deallocation
+**
+** @param tag    Accounting tag of the allocation
+** @param bytes  Size of the allocation
+*/
+static void _km_uncount( uint8_t tag, uint32_t bytes ) {
+    kmstat_t *stat = &_km_stats[tag < N_KMTAGS ? tag : KM_OTHER];
 
-    if( prev == NULL ) {
-        // sanity check - both pointers can't be NULL
-        assert( curr );
-        // add at the beginning
-        _free_pages = block;
-    } else {
-        // inserting in the middle or at the end
-        prev->next = block;
+    stat->frees += 1;
+    stat->inuse -= bytes;
+}
+
+/**
+** Name:    _km_meminfo
+**
+** Copy the memory accounting information
+**
+** @param info   Where to put it
+*/
+void _km_meminfo( meminfo_t *info ) {
+
+    uint32_t flags = _spin_lock_irqsave( &_km_lock );
+
+    info->total = _pages_total;
+    info->free = _pages_free;
+    info->low = _pages_low;
+    for( int i = 0; i < N_KMTAGS; ++i ) {
+        info->tags[i] = _km_stats[i];
     }
+
+    _spin_unlock_irqrestore( &_km_lock, flags );
 }
 
 /**
@@ -269,9 +518,18 @@ void _km_init( void ) {
     // announce that we're starting initialization
     __cio_puts( " Kmem:" );
 
+    _spin_init( &_km_lock, "kmem", LOCK_KMEM );
+
     // initially, nothing in the free lists
-    _free_slices = NULL;
-    _free_pages = NULL;
+    for( int i = 0; i < N_ORDERS; ++i ) {
+        _free_pages[i] = NULL;
+        _free_count[i] = 0;
+    }
+    _n_regions = 0;
+    for( int i = 0; i < N_KMTAGS; ++i ) {
+        __memclr( &_km_stats[i], sizeof(kmstat_t) );
+    }
+    _pages_total = _pages_free = _pages_low = 0;
 
     /*
     ** We ignore all memory below the end of our OS.  In theory,
@@ -373,17 +631,48 @@ void _km_init( void ) {
             length -= loss;
         }
 
-        // we survived the gauntlet - add the new block
+        // we survived the gauntlet - remember the new region,
+        // trimmed to whole pages
 
         uint32_t b32 = base   & ADDR_LOW_HALF;
         uint32_t l32 = length & ADDR_LOW_HALF;
 
-        _add_block( b32, l32 );
+        if( b32 & 0xfff ) {
+            l32 -= PAGE_SIZE - (b32 & 0xfff);
+            b32 = (b32 & 0xfffff000) + PAGE_SIZE;
+        }
+
+        if( l32 < PAGE_SIZE || _n_regions == N_REGIONS ) {
+            continue;
+        }
+
+        _regions[_n_regions].base = b32;
+        _regions[_n_regions].pages = B2P(l32);
+        ++_n_regions;
     }
 
+    if( _n_regions < 1 ) {
+        __cio_puts( " **noRegions** " );
+        return;
+    }
+
+    // now that we know the extent of memory, build the free lists
+    _build_free_lists();
+
     // record the initialization
     _km_initialized = 1;
 
+    // create the general size classes (32 bytes to 2KB)
+    static const char *names[N_SIZES] = {
+        "size-32", "size-64", "size-128", "size-256",
+        "size-512", "size-1024", "size-2048"
+    };
+    _n_caches = 0;
+    for( int i = 0; i < N_SIZES; ++i ) {
+        _sizes[i] = _km_cache_create( names[i], 32 << i, KM_OTHER );
+        assert( _sizes[i] != NULL );
+    }
+
     // announce that we have completed initialization
     __cio_puts( " done" );
 }
@@ -391,18 +680,43 @@ void _km_init( void ) {
 /**
 ** Name:    _km_dump
 **
-** Dump the current contents of the free list to the console
+** Dump the number of free blocks of each size, and the current
+** contents of the free lists, to the console
 */
 void _km_dump( void ) {
     Blockinfo *block;
+    uint32_t total = 0;
 
-    __cio_printf( "&_free_pages=%08x\n", &_free_pages );
+    __cio_printf( "page map @ 0x%08x, pages 0x%05x-0x%05x\n", _page_map,
+            _first_page, _first_page + _map_pages - 1 );
 
-    for( block = _free_pages; block != NULL; block = block->next ) {
-        __cio_printf(
-            "block @ 0x%08x 0x%08x pages (ends at 0x%08x) next @ 0x%08x\n",
-                block, block->pages, P2B(block->pages) + (uint32_t) block,
-                block->next );
+    // per-order summary first
+    for( int i = 0; i < N_ORDERS; ++i ) {
+        if( _free_count[i] > 0 ) {
+            __cio_printf( " order %2d (%6d pages): %d free\n", i,
+                    1 << i, _free_count[i] );
+            total += _free_count[i] << i;
+        }
+    }
+    __cio_printf( " %d pages free\n", total );
+
+    // then the accounting
+    __cio_printf( "%d of %d pages free (low %d)\n", _pages_free,
+            _pages_total, _pages_low );
+    __cio_puts( "tag       inuse     peak   allocs    frees fails\n" );
+    for( int i = 0; i < N_KMTAGS; ++i ) {
+        kmstat_t *stat = &_km_stats[i];
+        __cio_printf( "%-6s %8d %8d %8d %8d %5d\n", _tag_names[i], stat->inuse,
+                stat->peak, stat->allocs, stat->frees, stat->fails );
+    }
+
+    for( int i = 0; i < N_ORDERS; ++i ) {
+        for( block = _free_pages[i]; block != NULL; block = block->next ) {
+            __cio_printf(
+                "block @ 0x%08x 0x%08x pages (ends at 0x%08x) next @ 0x%08x\n",
+                    block, block->pages, P2B(block->pages) + (uint32_t) block,
+                    block->next );
+        }
     }
 
 }
@@ -411,78 +725,126 @@ void _km_dump( void ) {
 ** PAGE MANAGEMENT
 */
 
+static int _reap( void );
+
 /**
-** Name:    _km_page_alloc
+** Name:    _page_alloc
 **
-** Allocate a page of memory from the free list.
+** Allocate a block of pages from the free lists.  The block is rounded
+** up to a power of two pages in size.  The caller holds _km_lock.
 **
 ** @param count  Number of contiguous pages desired
+** @param tag    Accounting tag for the block
 **
 ** @return a pointer to the beginning of the first allocated page,
 **         or NULL if no memory is available
 */
-void *_km_page_alloc( uint32_t count ) {
-
-    assert( _km_initialized );
+static void *_page_alloc( uint32_t count, uint8_t tag ) {
 
     // make sure we actually need to do something!
     if( count < 1 ) {
         return( NULL );
     }
 
-    /*
-    ** Look for the first entry that is large enough.
-    */
+    // no block is that large
+    if( count > (1U << (N_ORDERS - 1)) ) {
+        _km_count( tag, 0 );
+        return( NULL );
+    }
 
-    // pointer to the current block
-    Blockinfo *block = _free_pages;
+    uint32_t want = _order_of( count );
 
-    // pointer to where the pointer to the current block is
-    Blockinfo **pointer = &_free_pages;
+    /*
+    ** Find the smallest order with a free block that is large enough.
+    */
 
-    while( block != NULL && block->pages < count ){
-        pointer = &block->next;
-        block = *pointer;
+    uint32_t order = want;
+    while( order < N_ORDERS && _free_pages[order] == NULL ) {
+        ++order;
     }
 
     // did we find a big enough block?
-    if( block == NULL ){
-        // nope!
+    if( order == N_ORDERS ) {
+        // nope!  take back the slab caches' spare slabs and try again
+        if( _reap() > 0 ) {
+            return( _page_alloc(count,tag) );
+        }
+        _km_count( tag, 0 );
         return( NULL );
     }
 
-    // found one!  check the length
+    Blockinfo *block = _free_pages[order];
+    _unlink_block( block, order );
 
-    if( block->pages == count ) {
+    // split it, returning the upper halves, until it is the right size
+    while( order > want ) {
+        --order;
+        _push_block( (Blockinfo *) ((uint8_t *) block + P2B(1U << order)),
+                order );
+    }
 
-        // exactly the right size - unlink it from the list
+    // remember the size for _km_page_free(), and the owner
+    _page_map[ B2P((uint32_t) block) - _first_page ] = PM_USED | order;
+    _page_tag[ B2P((uint32_t) block) - _first_page ] = tag;
+    _km_count( tag, P2B(1U << order) );
+    if( _pages_free < _pages_low ) {
+        _pages_low = _pages_free;
+    }
 
-        *pointer = block->next;
+    return( block );
+}
 
-    } else {
+/**
+** Name:    _page_free
+**
+** Returns a block allocated by _page_alloc() to the free lists,
+** combining it with its buddy if the buddy is free.  The caller
+** holds _km_lock.
+**
+** @param block   Pointer to the block to be returned to the free lists
+*/
+static void _page_free( void *block ){
 
-        // bigger than we need - carve the amount we need off
-        // the beginning of this block
+    /*
+    ** Don't do anything if the address is NULL.
+    */
+    if( block == NULL ){
+        return;
+    }
 
-        // remember where this chunk begins
-        Blockinfo *chunk = block;
+    uint32_t page = B2P((uint32_t) block);
 
-        // how much space will be left over?
-        int excess = block->pages - count;
+    // it must be the start of an allocated block
+    assert( ((uint32_t) block & 0xfff) == 0 );
+    assert( page >= _first_page && page - _first_page < _map_pages );
 
-        // find the start of the new fragment
-        Blockinfo *fragment = (Blockinfo *) ( (uint8_t *) block + P2B(count) );
+    uint8_t entry = _page_map[page - _first_page];
+    assert( (entry & PM_USED) != 0 );
 
-        // set the length and link for the new fragment
-        fragment->pages = excess;
-        fragment->next  = block->next;
+    _km_uncount( _page_tag[page - _first_page], P2B(1U << (entry & PM_ORDER)) );
 
-        // replace this chunk with the fragment
-        *pointer = fragment;
+    _free_block( page, entry & PM_ORDER );
+}
 
-        // return this chunk
-        block = chunk;
-    }
+/**
+** Name:    _km_page_alloc
+**
+** Allocate a block of pages from the free lists.  The block is rounded
+** up to a power of two pages in size.
+**
+** @param count  Number of contiguous pages desired
+** @param tag    Accounting tag for the block
+**
+** @return a pointer to the beginning of the first allocated page,
+**         or NULL if no memory is available
+*/
+void *_km_page_alloc( uint32_t count, uint8_t tag ) {
+
+    assert( _km_initialized );
+
+    uint32_t flags = _spin_lock_irqsave( &_km_lock );
+    void *block = _page_alloc( count, tag );
+    _spin_unlock_irqrestore( &_km_lock, flags );
 
     return( block );
 }
@@ -490,187 +852,480 @@ void *_km_page_alloc( uint32_t count ) {
 /**
 ** Name:    _km_page_free
 **
-** Returns a memory block to the list of available blocks,
-** combining it with adjacent blocks if they're present.
-**
-** CRITICAL ASSUMPTION:  multi-page blocks will be freed one page
-** at a time!
+** Returns a block allocated by _km_page_alloc() to the free lists,
+** combining it with its buddy if the buddy is free.
 **
-** @param block   Pointer to the page to be returned to the free list
+** @param block   Pointer to the block to be returned to the free lists
 */
 void _km_page_free( void *block ){
-    Blockinfo *used;
-    Blockinfo *prev;
-    Blockinfo *curr;
 
     assert( _km_initialized );
 
-    /*
-    ** Don't do anything if the address is NULL.
-    */
-    if( block == NULL ){
-        return;
-    }
+    uint32_t flags = _spin_lock_irqsave( &_km_lock );
+    _page_free( block );
+    _spin_unlock_irqrestore( &_km_lock, flags );
+}
 
-    used = (Blockinfo *) block;
+/*
+** SLAB MANAGEMENT
+*/
 
-    /*
-    ** CRITICAL ASSUMPTION
-    **
-    ** We assume that any multi-page block that is being freed will
-    ** be freed one page at a time.  We make this assumption because we
-    ** don't track allocation sizes.  We can't use the simple "allocate
-    ** four extra bytes before the returned pointer" scheme to do this
-    ** because we're managing pages, and the pointers we return must point
-    ** to page boundaries, so we would wind up allocating an extra page
-    ** for each allocation.
-    **
-    ** Alternatively, we could keep an array of addresses and block
-    ** sizes ourselves, but that feels clunky, and would risk running out
-    ** of table entries if there are lots of allocations (assuming we use
-    ** a 4KB page to hold the table, at eight bytes per entry we would have
-    ** 512 entries per page).
-    **
-    ** IF THIS ASSUMPTION CHANGES, THIS CODE MUST BE FIXED!!!
-    */
+/*
+** A slab is a block of pages holding objects of a single size.  The
+** slab header sits at the start of the block, followed by the objects;
+** a bitmap in the header marks which objects are free.  Because every
+** block from the page allocator is aligned on its own size, the slab
+** holding any object can be found from the page map (_block_of).
+**
+** Each cache keeps three lists of slabs:  partially-used slabs (which
+** are used first), full slabs, and empty slabs.  Empty slabs beyond
+** the first KM_KEEP_EMPTY are returned to the page allocator as soon
+** as they empty; the rest go back when the page allocator runs dry
+** (see _km_reap).
+*/
 
-    used->pages = 1;
+/**
+** Name:    _block_of
+**
+** Find the start of the allocated block containing an address
+**
+** @param ptr   The address
+**
+** @return the first byte of the block, or NULL if ptr is not in an
+**         allocated block
+*/
+static void *_block_of( void *ptr ) {
+    uint32_t page = B2P((uint32_t) ptr);
 
-    /*
-    ** Advance through the list until current and previous
-    ** straddle the place where the new block should be inserted.
-    */
-    prev = NULL;
-    curr = _free_pages;
+    if( page < _first_page || page - _first_page >= _map_pages ) {
+        return( NULL );
+    }
 
-    while( curr != NULL && curr < used ){
-        prev = curr;
-        curr = curr->next;
+    // only one allocated block can start at the right alignment
+    for( uint32_t order = 0; order < N_ORDERS; ++order ) {
+        uint32_t head = page & ~((1U << order) - 1);
+        if( head < _first_page ) {
+            break;
+        }
+        if( _page_map[head - _first_page] == (PM_USED | order) ) {
+            return( (void *) P2B(head) );
+        }
     }
 
-    /*
-    ** At this point, we have the following list structure:
-    **
-    **   ....    BLOCK       BLOCK      ....
-    **          (*prev)  ^  (*curr)
-    **                   |
-    **                "used" goes here
-    **
-    ** We may need to merge the inserted block with either its
-    ** predecessor or its successor (or both).
-    */
+    return( NULL );
+}
 
-    /*
-    ** If this is not the first block in the resulting list,
-    ** we may need to merge it with its predecessor.
-    */
-    if( prev != NULL ){
+/**
+** Name:    _slab_unlink
+**
+** Remove a slab from one of its cache's lists
+**
+** @param list  The list
+** @param slab  The slab
+*/
+static void _slab_unlink( Slab **list, Slab *slab ) {
 
-        // There is a predecessor.  Check to see if we need to merge.
-        if( adjacent( prev, used ) ){
+    if( slab->prev != NULL ) {
+        slab->prev->next = slab->next;
+    } else {
+        *list = slab->next;
+    }
+    if( slab->next != NULL ) {
+        slab->next->prev = slab->prev;
+    }
+    slab->next = slab->prev = NULL;
+}
 
-            // yes - merge them
-            prev->pages += used->pages;
+/**
+** Name:    _slab_push
+**
+** Add a slab to the front of one of its cache's lists
+**
+** @param list  The list
+** @param slab  The slab
+*/
+static void _slab_push( Slab **list, Slab *slab ) {
 
-            // the predecessor becomes the "newly inserted" block,
-            // because we still need to check to see if we should
-            // merge with the successor
-            used = prev;
+    slab->prev = NULL;
+    slab->next = *list;
+    if( slab->next != NULL ) {
+        slab->next->prev = slab;
+    }
+    *list = slab;
+}
 
+/**
+** Name:    _slab_create
+**
+** Allocate and initialize a new (empty) slab for a cache
+**
+** @param cache  The cache
+**
+** @return the slab, or NULL if no memory is available
+*/
+static Slab *_slab_create( Cache *cache ) {
+    Slab *slab = (Slab *) _page_alloc( cache->pages, KM_SLAB );
+
+    if( slab == NULL ) {
+        return( NULL );
+    }
+
+    slab->cache = cache;
+    slab->next = slab->prev = NULL;
+    slab->inuse = 0;
+
+    // every object starts out free
+    for( int i = 0; i < SLAB_MAP_WORDS; ++i ) {
+        uint32_t first = i * 32;
+        if( first + 32 <= cache->count ) {
+            slab->map[i] = ~0U;
+        } else if( first < cache->count ) {
+            slab->map[i] = (1U << (cache->count - first)) - 1;
         } else {
+            slab->map[i] = 0;
+        }
+    }
+
+    cache->slabs += 1;
+    return( slab );
+}
+
+/**
+** Name:    _slab_destroy
+**
+** Return an empty slab to the page allocator
+**
+** @param slab  The slab
+*/
+static void _slab_destroy( Slab *slab ) {
+
+    slab->cache->slabs -= 1;
+    _page_free( slab );
+}
+
+/**
+** Name:    _km_cache_create
+**
+** Create a cache of fixed-size objects
+**
+** @param name   Name of the cache (for _km_cache_dump)
+** @param size   Object size, in bytes
+** @param tag    Accounting tag for the objects
+**
+** @return the cache, or NULL if the size is too large or no more
+**         caches can be created
+*/
+cache_t _km_cache_create( const char *name, uint32_t size, uint8_t tag ) {
+    Cache *cache;
+
+    assert( _km_initialized );
+
+    if( size < 1 || size > KM_MAX_SIZE ) {
+        return( NULL );
+    }
+
+    uint32_t flags = _spin_lock_irqsave( &_km_lock );
 
-            // Not adjacent - just insert the new block
-            // between the predecessor and the successor.
-            used->next = prev->next;
-            prev->next = used;
+    if( _n_caches == N_CACHES ) {
+        _spin_unlock_irqrestore( &_km_lock, flags );
+        return( NULL );
+    }
+
+    cache = &_caches[_n_caches++];
+
+    // round up to a multiple of 8 bytes for alignment
+    size = (size + 7) & ~7;
+
+    // use the smallest slab that holds at least KM_MIN_OBJS objects
+    cache->pages = 1;
+    while( (P2B(cache->pages) - SLAB_HDR_SIZE) / size < KM_MIN_OBJS ) {
+        cache->pages <<= 1;
+    }
+
+    cache->name = name;
+    cache->size = size;
+    cache->tag = tag;
+    cache->count = (P2B(cache->pages) - SLAB_HDR_SIZE) / size;
+    if( cache->count > SLAB_MAP_WORDS * 32 ) {
+        cache->count = SLAB_MAP_WORDS * 32;
+    }
+    cache->partial = cache->full = cache->empty = NULL;
+    cache->n_empty = 0;
+    cache->slabs = 0;
+    cache->inuse = 0;
+
+    _spin_unlock_irqrestore( &_km_lock, flags );
+
+    return( cache );
+}
 
+/**
+** Name:    _cache_alloc
+**
+** Allocate an object from a cache, charging it to a given tag.
+** The caller holds _km_lock.
+**
+** @param cache  The cache
+** @param tag    Accounting tag for the object
+**
+** @return a pointer to the object, or NULL if no memory is available
+*/
+static void *_cache_alloc( Cache *cache, uint8_t tag ) {
+    Slab *slab;
+
+    // partially-used slabs first, then empty ones, then a new one
+    slab = cache->partial;
+    if( slab == NULL ) {
+        slab = cache->empty;
+        if( slab != NULL ) {
+            _slab_unlink( &cache->empty, slab );
+            cache->n_empty -= 1;
+        } else {
+            slab = _slab_create( cache );
+            if( slab == NULL ) {
+                _km_count( tag, 0 );
+                return( NULL );
+            }
         }
+        _slab_push( &cache->partial, slab );
+    }
 
-    } else {
+    // find the first free object
+    int i = 0;
+    while( slab->map[i] == 0 ) {
+        ++i;
+    }
+    uint32_t bit = __builtin_ctz( slab->map[i] );
+    slab->map[i] &= ~(1U << bit);
 
-        // Yes, it is first.  Update the list pointer to insert it.
-        used->next = _free_pages;
-        _free_pages = used;
+    slab->inuse += 1;
+    cache->inuse += 1;
+    slab->tags[i * 32 + bit] = tag;
+    _km_count( tag, cache->size );
 
+    if( slab->inuse == cache->count ) {
+        _slab_unlink( &cache->partial, slab );
+        _slab_push( &cache->full, slab );
     }
 
-    /*
-    ** If this is not the last block in the resulting list,
-    ** we may (also) need to merge it with its successor.
-    */
-    if( curr != NULL ){
+    return( (uint8_t *) slab + SLAB_HDR_SIZE + (i * 32 + bit) * cache->size );
+}
 
-        // No.  Check to see if it should be merged with the successor.
-        if( adjacent( used, curr ) ){
+/**
+** Name:    _km_cache_alloc
+**
+** Allocate an object from a cache.  The object is NOT cleared.
+**
+** @param cache  The cache
+**
+** @return a pointer to the object, or NULL if no memory is available
+*/
+void *_km_cache_alloc( cache_t cache ) {
 
-            // Yes, combine them.
-            used->next = curr->next;
-            used->pages += curr->pages;
+    uint32_t flags = _spin_lock_irqsave( &_km_lock );
+    void *obj = _cache_alloc( cache, cache->tag );
+    _spin_unlock_irqrestore( &_km_lock, flags );
 
+    return( obj );
+}
+
+/**
+** Name:    _cache_free
+**
+** Return an object to its cache.  The caller holds _km_lock.
+**
+** @param cache  The cache the object came from (NULL to look it up)
+** @param obj    The object
+*/
+static void _cache_free( cache_t cache, void *obj ) {
+
+    Slab *slab = (Slab *) _block_of( obj );
+    assert( slab != NULL );
+    assert( cache == NULL || slab->cache == cache );
+    cache = slab->cache;
+
+    uint32_t n = ((uint8_t *) obj - (uint8_t *) slab - SLAB_HDR_SIZE)
+            / cache->size;
+    assert( n < cache->count );
+    assert( (slab->map[n / 32] & (1U << (n % 32))) == 0 );
+
+    if( slab->inuse == cache->count ) {
+        _slab_unlink( &cache->full, slab );
+        _slab_push( &cache->partial, slab );
+    }
+
+    slab->map[n / 32] |= 1U << (n % 32);
+    slab->inuse -= 1;
+    cache->inuse -= 1;
+    _km_uncount( slab->tags[n], cache->size );
+
+    if( slab->inuse == 0 ) {
+        _slab_unlink( &cache->partial, slab );
+        if( cache->n_empty < KM_KEEP_EMPTY ) {
+            _slab_push( &cache->empty, slab );
+            cache->n_empty += 1;
+        } else {
+            _slab_destroy( slab );
         }
     }
 }
 
-/*
-** SLICE MANAGEMENT
+/**
+** Name:    _km_cache_free
+**
+** Return an object to its cache
+**
+** @param cache  The cache the object came from (NULL to look it up)
+** @param obj    The object
 */
+void _km_cache_free( cache_t cache, void *obj ) {
+
+    if( obj == NULL ) {
+        return;
+    }
+
+    uint32_t flags = _spin_lock_irqsave( &_km_lock );
+    _cache_free( cache, obj );
+    _spin_unlock_irqrestore( &_km_lock, flags );
+}
+
+/**
+** Name:    _reap
+**
+** Return every cached empty slab to the page allocator.  The
+** caller holds _km_lock.
+**
+** @return the number of slabs released
+*/
+static int _reap( void ) {
+    int n = 0;
+
+    for( int i = 0; i < _n_caches; ++i ) {
+        Cache *cache = &_caches[i];
+        while( cache->empty != NULL ) {
+            Slab *slab = cache->empty;
+            _slab_unlink( &cache->empty, slab );
+            _slab_destroy( slab );
+            ++n;
+        }
+        cache->n_empty = 0;
+    }
+
+    return( n );
+}
+
+/**
+** Name:    _km_reap
+**
+** Return every cached empty slab to the page allocator
+**
+** @return the number of slabs released
+*/
+int _km_reap( void ) {
+
+    uint32_t flags = _spin_lock_irqsave( &_km_lock );
+    int n = _reap();
+    _spin_unlock_irqrestore( &_km_lock, flags );
+
+    return( n );
+}
+
+/**
+** Name:    _km_cache_dump
+**
+** Dump the state of every cache to the console
+*/
+void _km_cache_dump( void ) {
+
+    __cio_puts( "cache          size pages/slab slabs  objects in use\n" );
+    for( int i = 0; i < _n_caches; ++i ) {
+        Cache *cache = &_caches[i];
+        __cio_printf( "%-12s %6d %10d %5d %8d %6d\n", cache->name,
+                cache->size, cache->pages, cache->slabs,
+                cache->slabs * cache->count, cache->inuse );
+    }
+}
 
 /*
-** Slices are 1024-byte fragments from pages.  We maintain a free list of
-** slices for those parts of the OS which don't need full 4096-byte chunks
-** of space (e.g., the QNode and Queue allocators).
+** GENERAL ALLOCATION
 */
 
 /**
-** Name:        _carve_slices
+** Name:    _km_alloc
+**
+** Allocate memory from the smallest size class that will hold it
+** (32 bytes to 2KB).  The memory is NOT cleared.
 **
-** Allocate a page and split it into four slices;  If no
-**              memory is available, we panic.
+** @param size   Number of bytes needed
+** @param tag    Accounting tag for the memory
+**
+** @return a pointer to the memory, or NULL
 */
-static void _carve_slices( void ) {
-    void *page;
+void *_km_alloc( uint32_t size, uint8_t tag ) {
+    void *obj = NULL;
+    int i;
 
-    // get a page
-    page = _km_page_alloc( 1 );
+    uint32_t flags = _spin_lock_irqsave( &_km_lock );
 
-    // allocation failure is a show-stopping problem
-    assert( page );
+    for( i = 0; i < N_SIZES; ++i ) {
+        if( size <= _sizes[i]->size ) {
+            obj = _cache_alloc( _sizes[i], tag );
+            break;
+        }
+    }
 
-    // we have the page; create the four slices from it
-    uint8_t *ptr = (uint8_t *) page;
-    for( int i = 0; i < 4; ++i ) {
-        _km_slice_free( (void *) ptr );
-        ptr += SLICE_SIZE;
+    // too big for any size class
+    if( i == N_SIZES ) {
+        _km_count( tag, 0 );
     }
+
+    _spin_unlock_irqrestore( &_km_lock, flags );
+
+    return( obj );
 }
 
+/**
+** Name:    _km_free
+**
+** Release memory from _km_alloc (or any cache)
+**
+** @param ptr    The memory to release
+*/
+void _km_free( void *ptr ) {
+
+    _km_cache_free( NULL, ptr );
+}
+
+/*
+** SLICE MANAGEMENT
+*/
+
+/*
+** Slices are 1024-byte blocks for those parts of the OS which don't
+** need full 4096-byte chunks of space; they come from the 1KB size
+** class.
+*/
+
 /**
 ** Name:        _km_slice_alloc
 **
 ** Dynamically allocates a slice (1/4 of a page).  If no
 ** memory is available, we panic.
 **
+** @param tag    Accounting tag for the slice
+**
 ** @return a pointer to the allocated slice
 */
-void *_km_slice_alloc( void ) {
-    Blockinfo *slice;
+void *_km_slice_alloc( uint8_t tag ) {
+    void *slice;
 
     assert( _km_initialized );
 
-    // if we are out of slices, create a few more
-    if( _free_slices == NULL ) {
-        _carve_slices();
-    }
-
-    // take the first one from the free list
-    slice = _free_slices;
-    assert( slice);
-
-    // unlink it
-    _free_slices = slice->next;
+    slice = _km_alloc( SLICE_SIZE, tag );
+    assert( slice );
 
     // make it nice and shiny for the caller
-    __memclr( (void *) slice, SLICE_SIZE );
+    __memclr( slice, SLICE_SIZE );
 
     return( slice );
 }
@@ -680,18 +1335,11 @@ void *_km_slice_alloc( void ) {
 **
 ** Returns a slice to the list of available slices.
 **
-** We make no attempt to merge slices, as they are independent
-** blocks of memory (unlike pages).
-**
 ** @param block  Pointer to the slice (1/4 page) to be freed
 */
 void _km_slice_free( void *block ) {
-    Blockinfo *slice = (Blockinfo *) block;
 
     assert( _km_initialized );
 
-    // just add it to the front of the free list
-    slice->pages = SLICE_SIZE;
-    slice->next = _free_slices;
-    _free_slices = slice;
+    _km_free( block );
 }
@@ -8,14 +8,13 @@
 ** Structures and functions to support dynamic memory
 ** allocation within the OS.
 **
-**      The list of free blocks is ordered by address to facilitate
-**      combining freed blocks with adjacent blocks that are already
-**      free.
+**      Pages are managed by a binary buddy allocator:  free blocks
+**      are powers of two pages in size, with one free list per size,
+**      and freed blocks are combined with their free "buddies".
 **
-**      All requests for memory are satisfied with blocks that are
-**      an integral number of 4-byte words.  More memory may be
-**      provided than was requested if the fragment left over after
-**      the allocation would not be large enough to be useable.
+**      Page requests are satisfied with blocks that are a power of
+**      two pages in size, so more memory may be provided than was
+**      requested.
 */
 
 #ifndef KMEM_H_
@@ -48,6 +47,9 @@
 ** Types
 */
 
+// an object cache (the structure is private to kmem)
+typedef struct cache_s *cache_t;
+
 /*
 ** Globals
 */
@@ -71,10 +73,21 @@ void _km_init( void );
 /**
 ** Name:    _km_dump
 **
-** Dump the current contents of the freelist to the console
+** Dump the number of free blocks of each size, the accounting
+** information, and the current contents of the free lists, to
+** the console
 */
 void _km_dump( void );
 
+/**
+** Name:    _km_meminfo
+**
+** Copy the memory accounting information
+**
+** @param info   Where to put it
+*/
+void _km_meminfo( meminfo_t *info );
+
 /*
 ** Functions that manipulate free memory blocks.
 */
@@ -82,46 +95,124 @@ void _km_dump( void );
 /**
 ** Name:    _km_page_alloc
 **
-** Allocate a page of memory from the free list.
+** Allocate a block of pages from the free lists.  The block is rounded
+** up to a power of two pages in size.
 **
 ** @param count  Number of contiguous pages desired
+** @param tag    Accounting tag for the block (KM_STACK, etc.)
 **
 ** @return a pointer to the beginning of the first allocated page,
 **         or NULL if no memory is available
 */
-void *_km_page_alloc( uint32_t count );
+void *_km_page_alloc( uint32_t count, uint8_t tag );
 
 /**
 ** Name:    _km_page_free
 **
-** Returns a memory block to the list of available blocks,
-** combining it with adjacent blocks if they're present.
-**
-** CRITICAL ASSUMPTION:  multi-page blocks will be freed one page
-** at a time!
+** Returns a block allocated by _km_page_alloc() to the free lists,
+** combining it with its buddy if the buddy is free.  The whole block
+** is freed at once.
 **
-** @param block   Pointer to the page to be returned to the free list
+** @param block   Pointer to the block to be returned to the free lists
 */
 void _km_page_free( void *block );
 
+/*
+** Functions that manage object caches.  Caches hand out fixed-size
+** objects from slabs of pages, and give empty slabs back to the
+** page allocator.
+*/
+
+/**
+** Name:    _km_cache_create
+**
+** Create a cache of fixed-size objects
+**
+** @param name   Name of the cache (for _km_cache_dump)
+** @param size   Object size, in bytes (at most 2KB)
+** @param tag    Accounting tag for the objects
+**
+** @return the cache, or NULL if the size is too large or no more
+**         caches can be created
+*/
+cache_t _km_cache_create( const char *name, uint32_t size, uint8_t tag );
+
+/**
+** Name:    _km_cache_alloc
+**
+** Allocate an object from a cache.  The object is NOT cleared.
+**
+** @param cache  The cache
+**
+** @return a pointer to the object, or NULL if no memory is available
+*/
+void *_km_cache_alloc( cache_t cache );
+
+/**
+** Name:    _km_cache_free
+**
+** Return an object to its cache
+**
+** @param cache  The cache the object came from (NULL to look it up)
+** @param obj    The object
+*/
+void _km_cache_free( cache_t cache, void *obj );
+
+/**
+** Name:    _km_reap
+**
+** Return every cached empty slab to the page allocator
+**
+** @return the number of slabs released
+*/
+int _km_reap( void );
+
+/**
+** Name:    _km_cache_dump
+**
+** Dump the state of every cache to the console
+*/
+void _km_cache_dump( void );
+
+/**
+** Name:    _km_alloc
+**
+** Allocate memory from the smallest size class that will hold it
+** (32 bytes to 2KB).  The memory is NOT cleared.
+**
+** @param size   Number of bytes needed
+** @param tag    Accounting tag for the memory
+**
+** @return a pointer to the memory, or NULL
+*/
+void *_km_alloc( uint32_t size, uint8_t tag );
+
+/**
+** Name:    _km_free
+**
+** Release memory from _km_alloc (or any cache)
+**
+** @param ptr    The memory to release
+*/
+void _km_free( void *ptr );
+
 /**
 ** Name:    _km_slice_alloc
 **
 ** Dynamically allocates a slice (1/4 of a page).  If no
 ** memory is available, we panic.
 **
+** @param tag    Accounting tag for the slice
+**
 ** @return a pointer to the allocated slice
 */
-void *_km_slice_alloc( void );
+void *_km_slice_alloc( uint8_t tag );
 
 /**
 ** Name:    _km_slice_free
 **
 ** Returns a slice to the list of available slices.
 **
-** We make no attempt to merge slices, as they are independent
-** blocks of memory (unlike pages).
-**
 ** @param block  Pointer to the slice (1/4 page) to be freed
 */
 void _km_slice_free( void *block );
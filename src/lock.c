@@ -0,0 +1,264 @@
+/**
+** @file lock.c
+**
+** @author CSCI-452 class of 20205
+**
+** Kernel spinlocks
+**
+** The kernel itself runs with interrupts disabled, so on a single
+** processor these locks are never contended.  They still mark which
+** data each module shares, keep the idle process' allocations safe
+** (it runs with interrupts enabled), and count how often, and for how
+** long, each lock is held.
+*/
+
+#define SP_KERNEL_SRC
+
+#include "common.h"
+
+#include "lock.h"
+#include "clock.h"
+#include "smp.h"
+
+/*
+** PRIVATE DEFINITIONS
+*/
+
+/*
+** PRIVATE DATA TYPES
+*/
+
+/*
+** PRIVATE GLOBAL VARIABLES
+*/
+
+// every initialized lock
+static spinlock_t *_locks;
+
+#ifdef DEBUG_LOCKS
+// the locks each processor holds, in the order they were acquired
+static spinlock_t *_held[SMP_MAX_CPUS][LOCK_DEPTH];
+static uint32_t _nheld[SMP_MAX_CPUS];
+#endif
+
+/*
+** PUBLIC GLOBAL VARIABLES
+*/
+
+/*
+** PRIVATE FUNCTIONS
+*/
+
+#ifdef DEBUG_LOCKS
+/**
+** _lock_check(lock) - validate a lock acquisition
+**
+** Recursive acquisition would deadlock, so it is fatal; acquiring
+** a lock whose rank isn't above that of every lock already held is
+** reported.  Locks may be released out of order, so the most recently
+** acquired one needn't be the highest ranked.
+**
+** @param lock  The lock about to be acquired
+*/
+static void _lock_check( spinlock_t *lock ) {
+    uint32_t cpu = _smp_cpu();
+    spinlock_t *top = NULL;
+
+    for( uint32_t i = 0; i < _nheld[cpu]; ++i ) {
+        if( _held[cpu][i] == lock ) {
+            __sprint( b256, "lock '%s' acquired recursively", lock->name );
+            _kpanic( "_spin_lock", b256 );
+        }
+        if( top == NULL || _held[cpu][i]->rank > top->rank ) {
+            top = _held[cpu][i];
+        }
+    }
+
+    if( top != NULL && top->rank >= lock->rank ) {
+        __sprint( b256, "lock '%s' (%d) acquired holding '%s' (%d)",
+                  lock->name, lock->rank, top->name, top->rank );
+        WARNING( b256 );
+    }
+
+    assert( _nheld[cpu] < LOCK_DEPTH );
+}
+
+/**
+** _lock_held(lock) - record that this processor holds a lock
+**
+** @param lock  The lock
+*/
+static void _lock_held( spinlock_t *lock ) {
+    uint32_t cpu = _smp_cpu();
+
+    _held[cpu][_nheld[cpu]++] = lock;
+}
+
+/**
+** _lock_released(lock) - record that this processor released a lock
+**
+** Locks needn't be released in the reverse order of acquisition.
+**
+** @param lock  The lock
+*/
+static void _lock_released( spinlock_t *lock ) {
+    uint32_t cpu = _smp_cpu();
+    int i;
+
+    for( i = _nheld[cpu] - 1; i >= 0; --i ) {
+        if( _held[cpu][i] == lock ) {
+            break;
+        }
+    }
+
+    if( i < 0 ) {
+        __sprint( b256, "lock '%s' released, but not held", lock->name );
+        _kpanic( "_spin_unlock", b256 );
+    }
+
+    for( --_nheld[cpu]; i < _nheld[cpu]; ++i ) {
+        _held[cpu][i] = _held[cpu][i + 1];
+    }
+}
+#endif
+
+/*
+** PUBLIC FUNCTIONS
+*/
+
+/**
+** _spin_init(lock,name,rank)
+**
+** Initialize a spinlock, and add it to the list dumped by _lock_dump()
+**
+** @param lock  The lock
+** @param name  Its name
+** @param rank  Its rank in the lock order
+*/
+void _spin_init( spinlock_t *lock, const char *name, uint32_t rank ) {
+
+    __memclr( lock, sizeof(spinlock_t) );
+    lock->name = name;
+    lock->rank = rank;
+
+    lock->link = _locks;
+    _locks = lock;
+}
+
+/**
+** _spin_lock(lock), _spin_unlock(lock)
+**
+** Acquire and release a spinlock.  These leave the interrupt state
+** alone, so they are for code which already runs with interrupts
+** disabled (e.g., anything called from an ISR or a system call).
+**
+** @param lock  The lock
+*/
+void _spin_lock( spinlock_t *lock ) {
+    uint32_t spins = 0;
+
+#ifdef DEBUG_LOCKS
+    _lock_check( lock );
+#endif
+
+    uint32_t ticket = __xadd( &lock->next, 1 );
+
+    while( lock->owner != ticket ) {
+        __relax();
+        ++spins;
+    }
+
+    // it's ours; the statistics are now safe to update
+    ++lock->acquires;
+    if( spins > 0 ) {
+        ++lock->contended;
+        lock->spins += spins;
+    }
+    lock->since = __rdtsc();
+
+#ifdef DEBUG_LOCKS
+    _lock_held( lock );
+#endif
+}
+
+void _spin_unlock( spinlock_t *lock ) {
+    uint64_t held = __rdtsc() - lock->since;
+
+    if( held > lock->max_hold ) {
+        lock->max_hold = held;
+    }
+
+#ifdef DEBUG_LOCKS
+    _lock_released( lock );
+#endif
+
+    // serve the next ticket; the locked add also keeps the
+    // stores above from being moved after it
+    (void) __xadd( &lock->owner, 1 );
+}
+
+/**
+** _spin_lock_irqsave(lock)
+**
+** Disable interrupts, then acquire a spinlock.  For code which may be
+** run with interrupts enabled (e.g., the idle process).
+**
+** @param lock  The lock
+**
+** @return The prior EFLAGS, for _spin_unlock_irqrestore()
+*/
+uint32_t _spin_lock_irqsave( spinlock_t *lock ) {
+    uint32_t flags = __intr_save();
+
+    _spin_lock( lock );
+
+    return( flags );
+}
+
+/**
+** _spin_unlock_irqrestore(lock,flags)
+**
+** Release a spinlock, then restore the interrupt state saved by
+** _spin_lock_irqsave()
+**
+** @param lock  The lock
+** @param flags The saved EFLAGS
+*/
+void _spin_unlock_irqrestore( spinlock_t *lock, uint32_t flags ) {
+
+    _spin_unlock( lock );
+    __intr_restore( flags );
+}
+
+/*
+** Debugging/tracing routines
+*/
+
+/**
+** _lock_dump(msg)
+**
+** Dump the statistics for every lock
+**
+** @param msg  Optional message to print
+*/
+void _lock_dump( const char *msg ) {
+
+    if( msg ) {
+        __cio_printf( "%s\n", msg );
+    }
+
+    __cio_puts( "lock     rank   acquires  contended      spins  max hold\n" );
+
+    for( spinlock_t *l = _locks; l != NULL; l = l->link ) {
+        __cio_printf( "%-8s %4d %10d %10d %10d", l->name, l->rank,
+                      l->acquires, l->contended, l->spins );
+
+        // hold times are kept in TSC cycles
+        if( _tsc_khz != 0 ) {
+            __cio_printf( " %6d us\n", (uint32_t)
+                          __udiv64(l->max_hold * 1000, _tsc_khz, NULL) );
+        } else {
+            __cio_printf( " %6d cyc\n", (uint32_t) l->max_hold );
+        }
+    }
+}
@@ -0,0 +1,128 @@
+/**
+** @file lock.h
+**
+** @author CSCI-452 class of 20205
+**
+** Kernel spinlock declarations
+*/
+
+#ifndef LOCK_H_
+#define LOCK_H_
+
+#include "common.h"
+
+/*
+** General (C and/or assembly) definitions
+*/
+
+// Lock ranks
+//
+// A lock may only be acquired while every lock already held by this
+// processor has a lower rank; with DEBUG_LOCKS defined, this is checked
+// on every acquisition.  Anything may allocate memory, so the allocator
+// comes last.
+
+#define LOCK_DISK       10      // ATA controller and the disks[] table
+#define LOCK_SIO        20      // SIO ring buffers
+#define LOCK_WHEEL      30      // timing wheel
+#define LOCK_POOL       40      // spawn pool
+#define LOCK_STACK      45      // free stack lists
+#define LOCK_KMEM       50      // page allocator and slab caches
+
+// most locks one processor may hold at once (DEBUG_LOCKS only)
+#define LOCK_DEPTH      8
+
+#ifndef SP_ASM_SRC
+
+/*
+** Start of C-only definitions
+*/
+
+/*
+** Types
+*/
+
+// a ticket spinlock
+//
+// each acquirer takes the next ticket, then waits until 'owner' reaches
+// it, so waiters are served in FIFO order.  the statistics are only
+// updated while the lock is held.
+
+typedef struct spinlock_s {
+    volatile uint32_t next;     // next ticket to hand out
+    volatile uint32_t owner;    // ticket now being served
+    const char *name;           // for _lock_dump()
+    uint32_t rank;              // see above
+    struct spinlock_s *link;    // list of all locks, for _lock_dump()
+
+    // statistics
+    uint32_t acquires;          // number of acquisitions
+    uint32_t contended;         // ... which had to wait
+    uint32_t spins;             // total wait loop iterations
+    uint64_t since;             // TSC at the current acquisition
+    uint64_t max_hold;          // longest hold time (TSC cycles)
+} spinlock_t;
+
+/*
+** Prototypes
+*/
+
+/**
+** _spin_init(lock,name,rank)
+**
+** Initialize a spinlock, and add it to the list dumped by _lock_dump()
+**
+** @param lock  The lock
+** @param name  Its name
+** @param rank  Its rank in the lock order
+*/
+void _spin_init( spinlock_t *lock, const char *name, uint32_t rank );
+
+/**
+** _spin_lock(lock), _spin_unlock(lock)
+**
+** Acquire and release a spinlock.  These leave the interrupt state
+** alone, so they are for code which already runs with interrupts
+** disabled (e.g., anything called from an ISR or a system call).
+**
+** @param lock  The lock
+*/
+void _spin_lock( spinlock_t *lock );
+void _spin_unlock( spinlock_t *lock );
+
+/**
+** _spin_lock_irqsave(lock)
+**
+** Disable interrupts, then acquire a spinlock.  For code which may be
+** run with interrupts enabled (e.g., the idle process).
+**
+** @param lock  The lock
+**
+** @return The prior EFLAGS, for _spin_unlock_irqrestore()
+*/
+uint32_t _spin_lock_irqsave( spinlock_t *lock );
+
+/**
+** _spin_unlock_irqrestore(lock,flags)
+**
+** Release a spinlock, then restore the interrupt state saved by
+** _spin_lock_irqsave()
+**
+** @param lock  The lock
+** @param flags The saved EFLAGS
+*/
+void _spin_unlock_irqrestore( spinlock_t *lock, uint32_t flags );
+
+/**
+** _lock_dump(msg)
+**
+** Dump the statistics for every lock
+**
+** @param msg  Optional message to print
+*/
+void _lock_dump( const char *msg );
+
+#endif
+/* SP_ASM_SRC */
+
+#endif
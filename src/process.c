@@ -15,6 +15,9 @@
 
 #include "process.h"
 #include "scheduler.h"
+#include "clock.h"
+#include "lock.h"
+#include "vdata.h"
 #include "stacks.h"
 #include "cio.h"
 
@@ -29,62 +32,376 @@ void exit_helper( void );
 ** PRIVATE DATA TYPES
 */
 
+// one process table entry
+//
+// a slot is free, reserved (by _pid_alloc(), with no PCB yet), or in
+// use; free slots are kept on a FIFO list, so that reuse is spread
+// over the whole table and generations wrap as slowly as possible
+
+typedef struct pslot_s {
+    pcb_t *pcb;         // the process in this slot, or NULL
+    uint16_t gen;       // generation for the next PID from this slot
+    uint16_t next;      // next slot on the free list (0 == none)
+} pslot_t;
+
 /*
 ** PRIVATE GLOBAL VARIABLES
 */
 
+// the process table; it starts at one page, and doubles in size
+// whenever it runs out of free slots
+static pslot_t *_ptable;
+static uint32_t _ptable_size;
+
+// free slot list
+static uint32_t _free_head;
+static uint32_t _free_tail;
+
+// spawn pool: warm processes, linked through qnext
+static spinlock_t _pool_lock;
+static pcb_t *_pool;
+static uint32_t _pool_count;
+static uint32_t _pool_target;
+
+// spawn statistics
+static uint32_t _spawn_warm;    // spawns satisfied from the pool
+static uint32_t _spawn_cold;    // spawns which had to build a process
+static uint32_t _spawn_hist[SPAWN_HIST];
+static uint64_t _spawn_max;     // longest latency seen (ns)
+
 // PCB management
-static pcb_t *_free_pcbs;
+static cache_t _pcb_cache;
+
+// shared process state (files, credentials, working directory)
+static cache_t _share_cache;
 
 /*
 ** PUBLIC GLOBAL VARIABLES
 */
 
-// next available PID
-pid_t _next_pid;
-
 // active process count
 uint32_t _active_procs;
 
-// table of active processes
-pcb_t *_ptable[N_PROCS];
+// user library area of the current process
+void *_uarea;
 
 /*
 ** PRIVATE FUNCTIONS
 */
 
 /**
-** _new_pcbs() - allocate a slice and carve it into PCBs
+** _slot_release(n) - add a process table slot to the free list
 **
-** @param critical  Should we panic on allocation failure?
-**
-** @return true on success, else false
+** @param n   The slot index
 */
-static bool_t _new_pcbs( bool_t critical ) {
-    pcb_t *slice;
+static void _slot_release( uint32_t n ) {
+
+    _ptable[n].pcb = NULL;
+    _ptable[n].next = 0;
 
-    // start by carving off a slice of memory
-    slice = (pcb_t *) _km_slice_alloc();
+    if( _free_tail == 0 ) {
+        _free_head = n;
+    } else {
+        _ptable[_free_tail].next = n;
+    }
+    _free_tail = n;
+}
 
-    // if this is a critical allocation and slice is NULL, we're done
-    assert( !critical || slice != NULL );
+/**
+** _ptable_grow() - double the size of the process table
+**
+** @return true on success, false if the table is at its maximum
+**         size or memory couldn't be allocated
+*/
+static bool_t _ptable_grow( void ) {
+    uint32_t size, bytes;
+    pslot_t *table;
 
-    // whew - not critical; NULL slice is still a problem, though
-    if( slice == NULL ) {
+    size = _ptable_size ? _ptable_size * 2 : PAGE_SIZE / sizeof(pslot_t);
+    if( size > PID_MAX_SLOTS ) {
         return( false );
     }
 
-    // clear out the allocated space
-    __memclr( slice, SLICE_SIZE );
+    bytes = size * sizeof(pslot_t);
+    table = (pslot_t *) _km_page_alloc( bytes / PAGE_SIZE, KM_PCB );
+    if( table == NULL ) {
+        return( false );
+    }
 
-    for( int i = 0; i < (SLICE_SIZE / sizeof(pcb_t)); ++i ) {
-        _pcb_free( slice + i );
+    // carry over the existing slots, and clear the new ones
+    if( _ptable != NULL ) {
+        __memcpy( table, _ptable, _ptable_size * sizeof(pslot_t) );
+        _km_page_free( _ptable );
     }
+    __memclr( table + _ptable_size,
+              (size - _ptable_size) * sizeof(pslot_t) );
+
+    _ptable = table;
+
+    // put the new slots on the free list, skipping the reserved ones
+    for( uint32_t n = _ptable_size; n < size; ++n ) {
+        if( n >= PID_FIRST_FREE ) {
+            _slot_release( n );
+        }
+    }
+    _ptable_size = size;
 
-    // all done!
     return( true );
 }
 
+/**
+** _kid_link(parent,kid) - add a process to its parent's child list
+**
+** @param parent   The parent
+** @param kid      The child
+*/
+static void _kid_link( pcb_t *parent, pcb_t *kid ) {
+
+    kid->parent = parent;
+    kid->sibprev = NULL;
+    kid->sibnext = parent->kids;
+    if( parent->kids != NULL ) {
+        parent->kids->sibprev = kid;
+    }
+    parent->kids = kid;
+}
+
+/**
+** _kid_unlink(kid) - remove a process from its parent's child list
+**
+** @param kid      The child
+*/
+static void _kid_unlink( pcb_t *kid ) {
+    pcb_t *parent = kid->parent;
+
+    if( parent == NULL ) {
+        return;
+    }
+
+    if( kid->sibprev != NULL ) {
+        kid->sibprev->sibnext = kid->sibnext;
+    } else {
+        parent->kids = kid->sibnext;
+    }
+    if( kid->sibnext != NULL ) {
+        kid->sibnext->sibprev = kid->sibprev;
+    }
+
+    kid->parent = kid->sibnext = kid->sibprev = NULL;
+}
+
+/**
+** _proc_kit() - build a process that hasn't been given an identity
+**
+** Allocates and clears a PCB, stack, and user library area, and lays
+** out the initial stack frame and context; only the entry point and
+** the command-line arguments are left to be filled in.
+**
+** @param pages  Size of the stack, in pages
+**
+** @return The new PCB, or NULL if memory could not be allocated
+*/
+static pcb_t *_proc_kit( uint32_t pages ) {
+
+    // allocate the necessary data structures
+    pcb_t *pcb = _pcb_alloc();
+    if( pcb == NULL ) {
+        return( NULL );
+    }
+
+    stack_t *stack = _stk_alloc( pages );
+    if( stack == NULL ) {
+        _pcb_free( pcb );
+        return( NULL );
+    }
+
+    // the user library area (output buffers etc.) starts out zeroed
+    void *uarea = _km_slice_alloc( KM_UAREA );
+    if( uarea == NULL ) {
+        _stk_free( stack, pages );
+        _pcb_free( pcb );
+        return( NULL );
+    }
+
+    pcb->stack = stack;
+    pcb->stkpages = pages;
+    pcb->uarea = uarea;
+    _pcbq_init( &pcb->zombies, false );
+
+    // the PCB was cleared, so all the file descriptors are unused
+
+    /*
+    ** Set up the initial process stack
+    **
+    ** We reserve two longwords at the bottom of the stack as scratch
+    ** space.  Above that, we simulate a call from exit_helper() with 
+    ** two command-line arguments by pushing the arguments and then
+    ** a "return address" which is the entry point to exit_helper().
+    ** Above that, we place a context_t area that is initialized with
+    ** the standard initial register contents.
+    **
+    ** The stack will then contain the following:
+    **
+    **     esp ->   context        <-- context save area
+    **                ...          <-- context save area
+    **              context        <-- context save area
+    **              exit_helper    <-- return address
+    **              arg 1          <-- command-line arguments
+    **              arg 2
+    **              0              <-- scratch space
+    **              0
+    */
+
+    /*
+    ** Stack alignment is controlled by the SysV ABI i386 supplement,
+    ** version 1.2 (June 23, 2016), which states in section 2.2.2:
+    **
+    **   "The end of the input argument area shall be aligned on a 16
+    **   (32 or 64, if __m256 or __m512 is passed on stack) byte boundary.
+    **   In other words, the value (%esp + 4) is always a multiple of 16
+    **   (32 or 64) when control is transferred to the function entry
+    **   point. The stack pointer, %esp, always points to the end of the
+    **   latest allocated stack frame."
+    **
+    ** Isn't technical documentation fun?  Ultimatly, this means that
+    ** the first parameter should be on the stack at an address that is
+    ** a multiple of 16.  Because our stacks are multiples of the page
+    ** size, we just need to ensure that "arg1" is 16 bytes back from 
+    ** the beginning of whatever follows the stack in memory.
+    */
+    
+    // create a pointer to the last longword in the stack
+    uint32_t *sp = STACK_END( stack, pages ) - 1;
+
+    // fill in the two scratch longwords
+    *sp-- = 0;
+    *sp-- = 0;  // stack alignment
+
+    // the two parameters are filled in by _proc_create()
+    sp -= 2;
+
+    // add the "return address"
+    *sp = (uint32_t) exit_helper;
+
+    // OK, now we need to add the context save area
+    pcb->context = ((context_t *) sp) - 1;
+
+    // fill in the critical registers
+    pcb->context->ss = GDT_STACK;
+    pcb->context->gs = GDT_DATA;
+    pcb->context->fs = GDT_DATA;
+    pcb->context->es = GDT_DATA;
+    pcb->context->ds = GDT_DATA;
+    pcb->context->cs = GDT_CODE;
+
+    // don't forget the flags!
+    pcb->context->eflags = DEFAULT_EFLAGS;
+
+    return( pcb );
+}
+
+/**
+** _proc_unkit(pcb) - release a process built by _proc_kit()
+**
+** @param pcb   The process
+*/
+static void _proc_unkit( pcb_t *pcb ) {
+
+    _stk_free( pcb->stack, pcb->stkpages );
+    _km_slice_free( pcb->uarea );
+    _pcb_free( pcb );
+}
+
+/**
+** _proc_get() - get a process without an identity
+**
+** Takes a warm process from the spawn pool if it has the right
+** stack size, else builds one
+**
+** @param pages  Size of the stack, in pages
+**
+** @return The new PCB, or NULL if memory could not be allocated
+*/
+static pcb_t *_proc_get( uint32_t pages ) {
+    pcb_t *pcb;
+
+    // pool processes all have default-sized stacks
+    pcb = NULL;
+    if( pages == STACK_PAGES ) {
+        _spin_lock( &_pool_lock );
+        pcb = _pool;
+        if( pcb != NULL ) {
+            _pool = pcb->qnext;
+            --_pool_count;
+            pcb->qnext = NULL;
+        }
+        _spin_unlock( &_pool_lock );
+    }
+
+    if( pcb != NULL ) {
+        ++_spawn_warm;
+    } else {
+        pcb = _proc_kit( pages );
+        if( pcb == NULL ) {
+            return( NULL );
+        }
+        ++_spawn_cold;
+    }
+
+    return( pcb );
+}
+
+/**
+** _share_alloc(uid,gid,wDir) - create the shared state for a new process
+**
+** @param uid   User ID
+** @param gid   Group ID
+** @param wDir  Working directory
+**
+** @return The new block, with one reference and no open files, or NULL
+*/
+static pshare_t *_share_alloc( uid_t uid, gid_t gid, inode_id_t wDir ) {
+
+    pshare_t *share = (pshare_t *) _km_cache_alloc( _share_cache );
+    if( share == NULL ) {
+        return( NULL );
+    }
+
+    // clearing it leaves all the file descriptors unused
+    __memclr( share, sizeof(pshare_t) );
+    share->refs = 1;
+    share->uid  = uid;
+    share->gid  = gid;
+    share->wDir = wDir;
+
+    return( share );
+}
+
+/**
+** _share_release(share) - drop one reference to a process' shared state
+**
+** The last reference drops any file views still held, and frees it
+**
+** @param share The shared state
+*/
+static void _share_release( pshare_t *share ) {
+
+    assert1( share->refs > 0 );
+
+    if( --share->refs > 0 ) {
+        return;
+    }
+
+    for( int i = 0; i < MAX_OPEN_FILES; ++i ) {
+        if( share->files[i].view != 0 ) {
+            _fs_unmap( share->files[i].view - 1 );
+            share->files[i].view = 0;
+        }
+    }
+
+    _km_cache_free( _share_cache, share );
+}
+
 /*
 ** PUBLIC FUNCTIONS
 */
@@ -103,22 +420,12 @@ static bool_t _new_pcbs( bool_t critical ) {
 pcb_t *_pcb_alloc( void ) {
     pcb_t *new;
 
-    // see if there is an available PCB
-    if( _free_pcbs == NULL ) {
-
-        // no - see if we can create some
-        if( !_new_pcbs(false) ) {
-            // no!  let's just leave quietly
-            return( NULL );
-        }
+    new = (pcb_t *) _km_cache_alloc( _pcb_cache );
+    if( new == NULL ) {
+        // no memory!  let's just leave quietly
+        return( NULL );
     }
 
-    // OK, we know that there is at least one free PCB;
-    // just take the first one from the list
-
-    new = _free_pcbs;
-    _free_pcbs = (pcb_t *) new->context;
-
     // clear out the fields in this one just to be safe
     __memclr( new, sizeof(pcb_t) );
 
@@ -127,11 +434,11 @@ pcb_t *_pcb_alloc( void ) {
 }
 
 /**
-** _pcb_free() - return a PCB to the free list
+** _pcb_free() - return a PCB to its cache
 **
 ** Deallocates the supplied PCB
 **
-** @param pcb   The PCB to be put on the free list
+** @param pcb   The PCB to be freed
 */
 void _pcb_free( pcb_t *pcb ) {
 
@@ -143,9 +450,7 @@ void _pcb_free( pcb_t *pcb ) {
     // mark it as unused (just in case)
     pcb->state = Unused;
 
-    // stick it at the front of the list
-    pcb->context = (context_t *) _free_pcbs;
-    _free_pcbs = pcb;
+    _km_cache_free( _pcb_cache, pcb );
 }
 
 /**
@@ -158,21 +463,260 @@ void _pcb_free( pcb_t *pcb ) {
 ** @return A pointer to the relevant PCB, or NULL
 */
 pcb_t *_pcb_find_pid( pid_t pid ) {
+    uint32_t n = PID_SLOT(pid);
+
+    if( pid <= 0 || n >= _ptable_size ) {
+        return( NULL );
+    }
+
+    // the slot may have been reused since this PID was handed out
+    pcb_t *pcb = _ptable[n].pcb;
+    if( pcb == NULL || pcb->pid != pid ) {
+        return( NULL );
+    }
+
+    return( pcb );
+}
+
+/**
+** _pid_alloc()
+**
+** Reserve a process table slot, growing the table if need be
+**
+** @return The PID for that slot, or E_NO_PROCS
+*/
+pid_t _pid_alloc( void ) {
+    uint32_t n;
+
+    if( _free_head == 0 && !_ptable_grow() ) {
+        return( E_NO_PROCS );
+    }
+
+    n = _free_head;
+    _free_head = _ptable[n].next;
+    if( _free_head == 0 ) {
+        _free_tail = 0;
+    }
+    _ptable[n].next = 0;
+
+    return( PID_MAKE(_ptable[n].gen, n) );
+}
+
+/**
+** _pid_free(pid)
+**
+** Release a process table slot reserved by _pid_alloc()
+**
+** @param pid   The PID
+*/
+void _pid_free( pid_t pid ) {
+    uint32_t n = PID_SLOT(pid);
+
+    assert1( n >= PID_FIRST_FREE && n < _ptable_size );
+
+    // retire this PID
+    _ptable[n].gen = (_ptable[n].gen + 1) & PID_GEN_MASK;
+    _slot_release( n );
+}
+
+/**
+** _proc_add(pcb,parent)
+**
+** Add a new process to the process table slot reserved for its PID,
+** and link it onto its parent's list of children
+**
+** @param pcb      The new process
+** @param parent   Its parent (NULL for init)
+*/
+void _proc_add( pcb_t *pcb, pcb_t *parent ) {
+    uint32_t n = PID_SLOT(pcb->pid);
+
+    // the slot must have been reserved for this PID
+    assert( n < _ptable_size && _ptable[n].pcb == NULL );
 
-    // very straightforward - look through the process table
-    // for a non-NULL entry that has the specified PID
+    _ptable[n].pcb = pcb;
+    ++_active_procs;
 
-    for( int i = 0; i < N_PROCS; ++i ) {
-        if( _ptable[i] != NULL && _ptable[i]->pid == pid ) {
-            // found it!
-            return( _ptable[i] );
+    // link it to its parent
+    if( parent != NULL ) {
+        _kid_link( parent, pcb );
+    }
+}
+
+/**
+** _proc_next(pos)
+**
+** Iterate over the active processes
+**
+** @param pos   Iteration state; set *pos to 0 to begin
+**
+** @return The next active process, or NULL at the end of the table
+*/
+pcb_t *_proc_next( uint32_t *pos ) {
+
+    while( *pos < _ptable_size ) {
+        pcb_t *pcb = _ptable[(*pos)++].pcb;
+        if( pcb != NULL ) {
+            return( pcb );
         }
     }
 
-    // no such PID in the system
     return( NULL );
 }
 
+/**
+** _proc_pool_size(n)
+**
+** Change the number of warm processes kept in the spawn pool; excess
+** ones are released immediately, and new ones are prepared as the
+** idle process finds time
+**
+** @param n   The new pool size
+*/
+void _proc_pool_size( uint32_t n ) {
+    pcb_t *extra = NULL;
+
+    uint32_t flags = _spin_lock_irqsave( &_pool_lock );
+
+    _pool_target = n;
+
+    while( _pool_count > _pool_target ) {
+        pcb_t *pcb = _pool;
+        _pool = pcb->qnext;
+        --_pool_count;
+        pcb->qnext = extra;
+        extra = pcb;
+    }
+
+    _spin_unlock_irqrestore( &_pool_lock, flags );
+
+    // release the excess ones outside the lock
+    while( extra != NULL ) {
+        pcb_t *pcb = extra;
+        extra = pcb->qnext;
+        pcb->qnext = NULL;
+        _proc_unkit( pcb );
+    }
+}
+
+/**
+** _proc_pool_info(count,target)
+**
+** Report the current and target sizes of the spawn pool
+**
+** @param count   Where to put the number of warm processes
+** @param target  Where to put the pool's target size
+*/
+void _proc_pool_info( uint32_t *count, uint32_t *target ) {
+
+    uint32_t flags = _spin_lock_irqsave( &_pool_lock );
+
+    *count = _pool_count;
+    *target = _pool_target;
+
+    _spin_unlock_irqrestore( &_pool_lock, flags );
+}
+
+/**
+** _proc_refill()
+**
+** Add one warm process to the spawn pool, if it is below its target
+** size.  Called from the idle process, with interrupts enabled.
+**
+** @return true if a process was added, else false
+*/
+bool_t _proc_refill( void ) {
+    bool_t added = false;
+
+    if( _pool_count >= _pool_target ) {
+        return( false );
+    }
+
+    // the idle process can be preempted at any point; the allocators
+    // have their own locks, so the process is built (and its memory
+    // cleared) with interrupts enabled, and only the pool itself is
+    // updated with them off
+    pcb_t *pcb = _proc_kit( STACK_PAGES );
+    if( pcb == NULL ) {
+        return( false );
+    }
+
+    uint32_t flags = _spin_lock_irqsave( &_pool_lock );
+
+    // the target may have changed in the meantime
+    if( _pool_count < _pool_target ) {
+        pcb->qnext = _pool;
+        _pool = pcb;
+        ++_pool_count;
+        added = true;
+    }
+
+    _spin_unlock_irqrestore( &_pool_lock, flags );
+
+    if( !added ) {
+        _proc_unkit( pcb );
+    }
+
+    return( added );
+}
+
+/**
+** _proc_started(pcb)
+**
+** Record the spawn-to-first-dispatch latency of a new process
+**
+** @param pcb   The process, which is about to be run for the first time
+*/
+void _proc_started( pcb_t *pcb ) {
+    uint64_t delta = _clk_ns() - pcb->spawned;
+    uint32_t n = 0;
+
+    pcb->spawned = 0;
+
+    if( delta > _spawn_max ) {
+        _spawn_max = delta;
+    }
+
+    // find the power-of-two bucket
+    delta >>= 10;
+    while( delta != 0 && n < SPAWN_HIST - 1 ) {
+        delta >>= 1;
+        ++n;
+    }
+
+    ++_spawn_hist[n];
+}
+
+/**
+** _proc_reparent(old,new)
+**
+** Hand all of a process' children, including any zombies awaiting
+** collection, to another process
+**
+** @param old   The current parent
+** @param new   The new parent
+*/
+void _proc_reparent( pcb_t *old, pcb_t *new ) {
+    pcb_t *kid;
+
+    assert1( old != new );
+
+    while( (kid = old->kids) != NULL ) {
+        _kid_unlink( kid );
+        kid->ppid = new->pid;
+        _kid_link( new, kid );
+
+        // it can be running if it just killed its parent
+        if( kid == _current ) {
+            _vdata_switch( kid );
+        }
+    }
+
+    while( (kid = _pcbq_deque(&old->zombies)) != NULL ) {
+        _pcbq_enque( &new->zombies, kid, 0 );
+    }
+}
+
 /**
 ** _pcb_cleanup(pcb)
 **
@@ -188,25 +732,194 @@ void _pcb_cleanup( pcb_t *pcb ) {
         return;
     }
 
-    // clear the entry in the process table
-    for( int i = 0; i < N_PROCS; ++i ) {
-        if( _ptable[i] == pcb ) {
-            _ptable[i] = NULL;
-            break;
-        }
+    // clear the entry in the process table, and retire its PID
+    uint32_t n = PID_SLOT(pcb->pid);
+    if( n < _ptable_size && _ptable[n].pcb == pcb ) {
+        --_active_procs;
+        _pid_free( pcb->pid );
     }
 
+    // it can't stay on any queue (including its parent's zombie
+    // queue) or on its parent's child list once it's gone
+    _pcbq_remove( pcb );
+    _kid_unlink( pcb );
+
     // release the stack
     if( pcb->stack != NULL ) {
-        _stk_free( pcb->stack );
+        _stk_free( pcb->stack, pcb->stkpages );
     }
 
-    --_active_procs;
+    // let go of the files etc.; if this was the last thread using
+    // them, any file views are dropped
+    if( pcb->share != NULL ) {
+        _share_release( pcb->share );
+        pcb->share = NULL;
+    }
+
+    // release the user library area
+    if( pcb->uarea != NULL ) {
+        _km_slice_free( pcb->uarea );
+        pcb->uarea = NULL;
+    }
 
     // release the PCB
     _pcb_free( pcb );
 }
 
+/*
+** Process queues
+*/
+
+/**
+** _pcbq_init(q,ordered) - initialize an (empty) process queue
+**
+** @param q         The queue
+** @param ordered   Keep the queue in order by key?
+*/
+void _pcbq_init( pcbq_t *q, bool_t ordered ) {
+
+    q->head = q->tail = NULL;
+    q->length = 0;
+    q->ordered = ordered;
+}
+
+/**
+** _pcbq_enque(q,pcb,key) - add a process to a queue
+**
+** The process must not already be on a queue.
+**
+** @param q     The queue
+** @param pcb   The process to add
+** @param key   Ordering key (ignored for FIFO queues)
+*/
+void _pcbq_enque( pcbq_t *q, pcb_t *pcb, uint32_t key ) {
+
+    assert1( pcb->queue == NULL );
+
+    pcb->queue = q;
+    pcb->qkey = key;
+    q->length += 1;
+
+    // find the process this one goes in front of (NULL == the end);
+    // scanning from the back keeps FIFO order among equal keys
+    pcb_t *next = NULL;
+    if( q->ordered ) {
+        pcb_t *prev = q->tail;
+        while( prev != NULL && prev->qkey > key ) {
+            next = prev;
+            prev = prev->qprev;
+        }
+    }
+
+    pcb->qnext = next;
+    if( next == NULL ) {
+        pcb->qprev = q->tail;
+        q->tail = pcb;
+    } else {
+        pcb->qprev = next->qprev;
+        next->qprev = pcb;
+    }
+
+    if( pcb->qprev == NULL ) {
+        q->head = pcb;
+    } else {
+        pcb->qprev->qnext = pcb;
+    }
+}
+
+/**
+** _pcbq_deque(q) - remove the first process from a queue
+**
+** @param q     The queue
+**
+** @return The process, or NULL if the queue is empty
+*/
+pcb_t *_pcbq_deque( pcbq_t *q ) {
+    pcb_t *pcb = q->head;
+
+    if( pcb != NULL ) {
+        _pcbq_remove( pcb );
+    }
+
+    return( pcb );
+}
+
+/**
+** _pcbq_peek(q) - return the first process on a queue without
+** removing it
+**
+** @param q     The queue
+**
+** @return The process, or NULL if the queue is empty
+*/
+pcb_t *_pcbq_peek( pcbq_t *q ) {
+
+    return( q->head );
+}
+
+/**
+** _pcbq_remove(pcb) - take a process off whatever queue it is on
+**
+** @param pcb   The process
+*/
+void _pcbq_remove( pcb_t *pcb ) {
+    pcbq_t *q = pcb->queue;
+
+    // not on a queue?  nothing to do
+    if( q == NULL ) {
+        return;
+    }
+
+    if( pcb->qprev == NULL ) {
+        q->head = pcb->qnext;
+    } else {
+        pcb->qprev->qnext = pcb->qnext;
+    }
+
+    if( pcb->qnext == NULL ) {
+        q->tail = pcb->qprev;
+    } else {
+        pcb->qnext->qprev = pcb->qprev;
+    }
+
+    q->length -= 1;
+    pcb->qnext = pcb->qprev = NULL;
+    pcb->queue = NULL;
+}
+
+/**
+** _pcbq_dump(msg,q) - dump the contents of a process queue
+**
+** @param msg   Optional message to print
+** @param q     Queue to dump
+*/
+void _pcbq_dump( const char *msg, pcbq_t *q ) {
+
+    // report on this queue
+    __cio_printf( "%s: ", msg );
+
+    // first, the basic data
+    __cio_printf( "head %08x tail %08x %d items",
+                  (uint32_t) q->head, (uint32_t) q->tail, q->length );
+    __cio_puts( q->ordered ? " ordered\n" : " FIFO\n" );
+
+    // if there are members in the queue, dump the first five PIDs
+    if( q->length > 0 ) {
+        __cio_puts( " pids: " );
+        pcb_t *tmp;
+        int i = 0;
+        for( tmp = q->head; i < 5 && tmp != NULL; ++i, tmp = tmp->qnext ) {
+            __cio_printf( " [%d]", tmp->pid );
+        }
+
+        if( tmp != NULL ) {
+            __cio_puts( " ..." );
+        }
+
+        __cio_putchar( '\n' );
+    }
+}
+
 /*
 ** Process management/control
 */
@@ -214,7 +927,7 @@ void _pcb_cleanup( pcb_t *pcb ) {
 /**
 ** _proc_init() - initialize the PCB module
 **
-** Allocates the initial set of PCBs, does whatever else is
+** Creates the PCB cache, does whatever else is
 ** needed to make it possible to create processes
 **
 ** Dependencies:
@@ -225,20 +938,33 @@ void _proc_init( void ) {
 
     __cio_puts( " Process:" );
 
-    // allocate an initial slice of PCBs
-    _free_pcbs = NULL;
-    _new_pcbs( true );
+    // PCBs come from their own cache
+    _pcb_cache = _km_cache_create( "pcb", sizeof(pcb_t), KM_PCB );
+    assert( _pcb_cache != NULL );
+
+    // as does the state shared by the threads of a process
+    _share_cache = _km_cache_create( "pshare", sizeof(pshare_t), KM_PCB );
+    assert( _share_cache != NULL );
 
-    // reset the "active" variables
+    // reset the "active" variables, and create the process table
     _active_procs = 0;
-    for( int i = 0; i < N_PROCS; ++i ) {
-        _ptable[i] = NULL;
-    }
+    _ptable = NULL;
+    _ptable_size = 0;
+    _free_head = _free_tail = 0;
+    assert( _ptable_grow() );
 
     // first process is init, PID 1; it's created by system initialization
 
-    // second process is idle, PID 2; it's spawned by init()
-    _next_pid = 2;
+    // second process is idle, PID 2; it's also created by system
+    // initialization, but is not in the process table
+
+    // neither slot is ever on the free list
+
+    // the spawn pool is filled by the idle process
+    _spin_init( &_pool_lock, "pool", LOCK_POOL );
+    _pool = NULL;
+    _pool_count = 0;
+    _pool_target = SPAWN_POOL;
 
     // all done!
     __cio_puts( " done" );
@@ -256,111 +982,94 @@ void _proc_init( void ) {
 ** @param args   Entry point, priority, and command-line arguments
 ** @param pid    PID for new process
 ** @param ppid   PID of parent process
+** @param pages  Stack size, in pages (0 for the default)
 **
 ** @return Pointer to the new process' PCB, or NULL if memory could
 **         not be allocated for the PCB or the stack
 */
 pcb_t *_proc_create( uint32_t args[4], pid_t pid, pid_t ppid, 
-                        uid_t uid, gid_t gid, inode_id_t wDir) {
+                        uid_t uid, gid_t gid, inode_id_t wDir,
+                        uint32_t pages ) {
+    pcb_t *pcb;
 
-    // allocate the necessary data structures
-    pcb_t *pcb = _pcb_alloc();
+    if( pages == 0 ) {
+        pages = STACK_PAGES;
+    }
+
+    pcb = _proc_get( pages );
     if( pcb == NULL ) {
         return( NULL );
     }
 
-    stack_t *stack = _stk_alloc();
-    if( stack == NULL ) {
-        _pcb_free( pcb );
+    // a new process gets its own files, credentials, and directory
+    pcb->share = _share_alloc( uid, gid, wDir );
+    if( pcb->share == NULL ) {
+        _proc_unkit( pcb );
         return( NULL );
     }
 
-    // fill in most of the PCB
-    pcb->stack    = stack;      // user runtime stack
+    // fill in the rest of the PCB
     pcb->pid      = pid;        // unique PID
     pcb->ppid     = ppid;       // parent's PID
-    pcb->gid      = gid;        // provided gid
-    pcb->uid      = uid;        // provided uid
     pcb->state    = New;        // initial state
     pcb->priority = args[1];    // process priority
+    pcb->level    = args[1];    // starts out at its base priority
     pcb->quantum  = Q_STD;      // allotted time slice
-    pcb->wDir     = wDir;       // Working directory
-    // Set all File fd_ts to zero
-    for (int i = 0; i < MAX_OPEN_FILES; i++) {
-        pcb->files[i].inode_id = (inode_id_t) {0, 0};
-        pcb->files[i].offset = 0;
-    }
+    pcb->spawned  = _clk_ns();  // for the latency histogram
 
-    /*
-    ** Set up the initial process stack
-    **
-    ** We reserve two longwords at the bottom of the stack as scratch
-    ** space.  Above that, we simulate a call from exit_helper() with 
-    ** two command-line arguments by pushing the arguments and then
-    ** a "return address" which is the entry point to exit_helper().
-    ** Above that, we place a context_t area that is initialized with
-    ** the standard initial register contents.
-    **
-    ** The stack will then contain the following:
-    **
-    **     esp ->   context        <-- context save area
-    **                ...          <-- context save area
-    **              context        <-- context save area
-    **              exit_helper    <-- return address
-    **              arg 1          <-- command-line arguments
-    **              arg 2
-    **              0              <-- scratch space
-    **              0
-    */
+    // the command-line arguments
+    ARG(pcb,1) = args[2];
+    ARG(pcb,2) = args[3];
 
-    /*
-    ** Stack alignment is controlled by the SysV ABI i386 supplement,
-    ** version 1.2 (June 23, 2016), which states in section 2.2.2:
-    **
-    **   "The end of the input argument area shall be aligned on a 16
-    **   (32 or 64, if __m256 or __m512 is passed on stack) byte boundary.
-    **   In other words, the value (%esp + 4) is always a multiple of 16
-    **   (32 or 64) when control is transferred to the function entry
-    **   point. The stack pointer, %esp, always points to the end of the
-    **   latest allocated stack frame."
-    **
-    ** Isn't technical documentation fun?  Ultimatly, this means that
-    ** the first parameter should be on the stack at an address that is
-    ** a multiple of 16.  Because our stacks are multiples of the page
-    ** size, we just need to ensure that "arg1" is 16 bytes back from 
-    ** the beginning of whatever follows the stack in memory.
-    */
-    
-    // create a pointer to the last longword in the stack
-    uint32_t *sp = ((uint32_t *)(stack + 1)) - 1;
+    // EIP will be the entry point of the user main() function
+    pcb->context->eip = args[0];
 
-    // fill in the two scratch longwords
-    *sp-- = 0;
-    *sp-- = 0;  // stack alignment
-    
-    // next, fill in the two parameters
-    *sp-- = args[3];
-    *sp-- = args[2];   // this entry is aligned
+    return( pcb );
+}
 
-    // add the "return address"
-    *sp = (uint32_t) exit_helper;
+/**
+** _thread_create - create a new thread of a process
+**
+** Like _proc_create(), but the new thread shares the creator's files,
+** credentials, and working directory, and runs at its priority
+**
+** @param creator  The thread creating this one
+** @param entry    Entry point
+** @param arg      Argument passed to the entry point
+** @param pid      PID for the new thread
+** @param pages    Stack size, in pages (0 for THREAD_STACK_PAGES)
+**
+** @return Pointer to the new thread's PCB, or NULL if memory could
+**         not be allocated
+*/
+pcb_t *_thread_create( pcb_t *creator, uint32_t entry, uint32_t arg,
+                       pid_t pid, uint32_t pages ) {
+    pcb_t *pcb;
 
-    // OK, now we need to add the context save area
-    pcb->context = ((context_t *) sp) - 1;
+    if( pages == 0 ) {
+        pages = THREAD_STACK_PAGES;
+    }
 
-    // fill in the critical registers
-    pcb->context->ss = GDT_STACK;
-    pcb->context->gs = GDT_DATA;
-    pcb->context->fs = GDT_DATA;
-    pcb->context->es = GDT_DATA;
-    pcb->context->ds = GDT_DATA;
-    pcb->context->cs = GDT_CODE;
+    pcb = _proc_get( pages );
+    if( pcb == NULL ) {
+        return( NULL );
+    }
 
-    // EIP will be the entry point of the user main() function
-    pcb->context->eip = args[0];
+    pcb->share = creator->share;
+    ++pcb->share->refs;
 
-    // don't forget the flags!
-    pcb->context->eflags = DEFAULT_EFLAGS;
+    pcb->pid      = pid;
+    pcb->ppid     = creator->pid;
+    pcb->state    = New;
+    pcb->priority = creator->priority;
+    pcb->level    = creator->priority;
+    pcb->quantum  = Q_STD;
+    pcb->spawned  = _clk_ns();
+
+    // entry(arg); returning from it exits with its return value
+    ARG(pcb,1) = arg;
+    ARG(pcb,2) = 0;
+    pcb->context->eip = entry;
 
     return( pcb );
 }
@@ -394,16 +1103,17 @@ void _pcb_dump( const char *msg, register pcb_t *p ) {
     }
 
     // now, the contents
-    __cio_printf( " pids %d/%d state %d prio %d",
-                  p->pid, p->ppid, p->state, p->priority );
+    __cio_printf( " pids %d/%d state %d prio %d/%d",
+                  p->pid, p->ppid, p->state, p->priority, p->level );
 
     __cio_printf( "\n ticks %d/%d xit %d",
                   p->ticks, p->quantum, p->exit_status );
 
     // for the event, just print the 32 bits in hex
     __cio_printf( " event %08x", (uint32_t) p->event.other );
-    __cio_printf( "\n context %08x stack %08x",
-                  (uint32_t) p->context, (uint32_t) p->stack );
+    __cio_printf( "\n context %08x stack %08x (%d pages, %d used)",
+                  (uint32_t) p->context, (uint32_t) p->stack, p->stkpages,
+                  _stk_used(p->stack, p->stkpages) );
 
 #ifdef PCB_FILLER
     // and the filler (just to be sure)
@@ -473,13 +1183,12 @@ void _context_dump_all( const char *msg ) {
     }
 
     int n = 0;
-    for( int i = 0; i < N_PROCS; ++i ) {
-        pcb_t *pcb = _ptable[i];
-        if( pcb->state != Unused ) {
-            ++n;
-            __cio_printf( "%2d[%2d]: ", n, i );
-            _context_dump( NULL, pcb->context );
-        }
+    uint32_t pos = 0;
+    pcb_t *pcb;
+    while( (pcb = _proc_next(&pos)) != NULL ) {
+        ++n;
+        __cio_printf( "%2d[%2d]: ", n, PID_SLOT(pcb->pid) );
+        _context_dump( NULL, pcb->context );
     }
 }
 
@@ -489,7 +1198,8 @@ void _context_dump_all( const char *msg ) {
 ** dump the contents of the "active processes" table
 **
 ** @param msg  Optional message to print
-** @param all  Dump all or only part of the relevant data
+** @param all  Dump all or only part of the relevant data (all also
+**             dumps the spinlock statistics)
 */
 void _active_dump( const char *msg, bool_t all ) {
 
@@ -497,14 +1207,14 @@ void _active_dump( const char *msg, bool_t all ) {
         __cio_printf( "%s: ", msg );
     }
 
-    int used = 0;
-    int empty = 0;
+    uint32_t used = 0;
+    uint32_t empty = 0;
 
-    for( int i = 0; i < N_PROCS; ++i ) {
-        register pcb_t *pcb = _ptable[i];
-        if( pcb->state == Unused ) {
+    for( uint32_t i = 0; i < _ptable_size; ++i ) {
+        register pcb_t *pcb = _ptable[i].pcb;
+        if( pcb == NULL ) {
 
-            // an empty slot
+            // an empty (or reserved) slot
             ++empty;
 
         } else {
@@ -519,7 +1229,7 @@ void _active_dump( const char *msg, bool_t all ) {
 
             // things that are always printed
             __cio_printf( " #%d: %d/%d %d %d %d", i, pcb->pid, pcb->ppid, 
-                            pcb->uid, pcb->gid, pcb->state );
+                            pcb->share->uid, pcb->share->gid, pcb->state );
             // do we want more info?
             if( all ) {
                 __cio_printf( " stk %08x EIP %08x\n",
@@ -533,9 +1243,46 @@ void _active_dump( const char *msg, bool_t all ) {
         __cio_putchar( '\n' );
     }
 
-    // sanity check - make sure we saw the correct number of table slots
-    if( (used + empty) != N_PROCS ) {
-        __cio_printf( "Table size %d, used %d + empty %d = %d???\n",
-                      N_PROCS, used, empty, used + empty );
+    // sanity check - make sure the active count is right
+    if( used != _active_procs ) {
+        __cio_printf( "Table size %d, used %d but %d active???\n",
+                      _ptable_size, used, _active_procs );
+    }
+
+    // the full dump includes the spinlock statistics
+    if( all ) {
+        _lock_dump( "Locks" );
+    }
+}
+
+/**
+** _proc_pool_dump(msg)
+**
+** dump the spawn pool state and the spawn latency histogram
+**
+** @param msg  Optional message to print
+*/
+void _proc_pool_dump( const char *msg ) {
+    uint32_t lo = 0;
+
+    if( msg ) {
+        __cio_printf( "%s: ", msg );
+    }
+
+    __cio_printf( "pool %d/%d, spawns %d warm %d cold, max %d us\n",
+                  _pool_count, _pool_target, _spawn_warm, _spawn_cold,
+                  (uint32_t) __udiv64( _spawn_max, 1000, NULL ) );
+
+    // bucket n holds latencies below 2^(n+10) ns; report in us
+    for( int n = 0; n < SPAWN_HIST; ++n ) {
+        uint32_t hi = (1 << (n + 10)) / 1000;
+        if( _spawn_hist[n] != 0 ) {
+            if( n < SPAWN_HIST - 1 ) {
+                __cio_printf( "  %5d-%5d us: %d\n", lo, hi, _spawn_hist[n] );
+            } else {
+                __cio_printf( "  %5d+      us: %d\n", lo, _spawn_hist[n] );
+            }
+        }
+        lo = hi;
     }
 }
@@ -30,6 +30,44 @@
 // PID for the idle() process
 #define PID_IDLE     2
 
+// PID for the I/O worker (see aread())
+#define PID_AIO      3
+
+// A PID is an index into the process table in its low PID_SLOT_BITS
+// bits, plus that slot's generation number in the bits above.  The
+// generation changes each time a slot is freed, so a stale PID won't
+// name a later process which happens to get the same slot.
+
+#define PID_SLOT_BITS   16
+#define PID_MAX_SLOTS   (1 << PID_SLOT_BITS)
+#define PID_GEN_MASK    0x7fff
+
+#define PID_SLOT(pid)   ((pid) & (PID_MAX_SLOTS - 1))
+#define PID_MAKE(g,s)   (((g) << PID_SLOT_BITS) | (s))
+
+// slots 0 (never a PID), init, idle, and the I/O worker are never
+// handed out
+#define PID_FIRST_FREE  (PID_AIO + 1)
+
+// Spawn pool: the idle process keeps up to this many "warm" processes
+// ready (PCB, stack, and user area already cleared, and the initial
+// stack frame and context already built), so that spawn() doesn't
+// have to clear memory.  Can be overridden from the Makefile, and
+// changed at run time with _proc_pool_size().
+
+#ifndef SPAWN_POOL
+#define SPAWN_POOL      8
+#endif
+
+// spawn latency histogram: bucket 0 counts first dispatches within
+// 1024ns of the spawn, and each later bucket covers twice the range
+// of the one before it; the last bucket also counts anything longer
+
+#define SPAWN_HIST      16
+
+// default stack size for a thread, in pages
+#define THREAD_STACK_PAGES  1
+
 // REG(pcb,x) -- access a specific register in a process context
 
 #define REG(pcb,x)  ((pcb)->context->x)
@@ -85,15 +123,41 @@ typedef struct context {
 
 /*
  * Simple FD structure
- * 8 bytes
+ * 12 bytes
  */
 typedef struct fd_s {
     inode_id_t inode_id;
     uint32_t offset;
+    uint8_t view;       // fmap() view held through this descriptor, plus 1 (0 if none)
 } fd_t;
 
+// the parts of a process which all of its threads share:  open files,
+// credentials, and working directory.  each thread (including the
+// original one) holds a reference; the last one out closes the files.
+
+typedef struct pshare_s {
+    uint32_t refs;              // number of PCBs using this
+    inode_id_t wDir;            // ID of the working directory's inode
+    gid_t gid;                  // group ID
+    uid_t uid;                  // user ID
+    fd_t files[MAX_OPEN_FILES]; // File descriptors
+} pshare_t;
+
 //#define PCB_FILLER
 
+// a queue of processes, linked through the PCBs themselves, so that
+// adding and removing a process never allocates and cannot fail
+//
+// FIFO queues add at the end; ordered queues keep their processes in
+// ascending order by key, FIFO among equal keys
+
+typedef struct pcbq_s {
+    struct pcb_s *head;     // first process
+    struct pcb_s *tail;     // last process
+    uint32_t length;        // current occupancy count
+    bool_t ordered;         // order by key (vs. FIFO)?
+} pcbq_t;
+
 // the process control block
 //
 // fields are ordered by size to avoid padding
@@ -108,42 +172,66 @@ typedef struct pcb_s {
     context_t *context;     // pointer to context save area on stack
     stack_t *stack;         // pointer to process stack
 
-    inode_id_t wDir;          // ID of the working directory's inode
+    pshare_t *share;        // files, credentials, and working directory
 
     int32_t exit_status;    // termination status, for parent's use
     event_t event;          // what this process is waiting for
 
-    // two-byte values
+    // isr_stubs.S (TRACE_CX) reads these at offsets 20 and 24
     pid_t pid;              // unique PID for this process
     pid_t ppid;             // PID of the parent
-    
-    gid_t gid;              // group ID of this process
-    uid_t uid;              // user ID of this process
 
     // one-byte values
     state_t state;          // current state (see common.h)
-    prio_t priority;        // process priority (MLQ queue level)
+    prio_t priority;        // base priority (see scheduler.c)
 
     uint8_t quantum;        // quantum for this process
     uint8_t ticks;          // ticks remaining in current slice
 
-    fd_t files[MAX_OPEN_FILES]; // File descriptors
+    // kept at the end so the assembly offsets above don't move
+    void *uarea;            // per-process user library area (one slice)
+
+    // scheduling queue links; a process is on at most one of the
+    // ready, sleep, or blocked queues at a time (see pcbq_t)
+    struct pcb_s *qnext;    // next process on the queue
+    struct pcb_s *qprev;    // previous process on the queue
+    struct pcbq_s *queue;   // the queue this process is on, or NULL
+    uint32_t qkey;          // ordering key on that queue
+
+    prio_t level;           // current MLFQ level (ready queue index)
+    uint8_t stkpages;       // size of the stack, in pages
+
+    // process family links, maintained by _proc_add() and _pcb_cleanup();
+    // a zombie stays on its parent's child list until it is collected
+    struct pcb_s *parent;   // parent process (NULL for init)
+    struct pcb_s *kids;     // first child
+    struct pcb_s *sibnext;  // next child of our parent
+    struct pcb_s *sibprev;  // previous child of our parent
+    pcbq_t zombies;         // children which have exited, awaiting wait()
+
+    uint64_t spawned;       // creation time (ns); cleared when first run
+    uint64_t wake_ns;       // nanosleep() deadline (see _clk_nsleep())
+
+    ring_t *ring;           // system call ring (see ring_setup())
+    bool_t awaiting;        // in await()? (cleared by the next syscall)
 } pcb_t;
 
+// shorthand form of queue length query
+#define _pcbq_length(q)     ((q)->length)
+
 
 /*
 ** Globals
 */
 
-// next available PID
-extern pid_t _next_pid;
+// user library area of the current process (NULL if none); this is
+// switched by the dispatcher and read directly by ulibc, so library code
+// has a per-process data area despite the shared address space
+extern void *_uarea;
 
 // active process count
 extern uint32_t _active_procs;
 
-// table of active processes
-extern pcb_t *_ptable[N_PROCS];
-
 /*
 ** Prototypes
 */
@@ -162,14 +250,14 @@ pcb_t *_pcb_alloc( void );
 /**
 ** _pcb_free() - free a PCB
 **
-** @param p   The PCB to be returned to the free list
+** @param p   The PCB to be returned to its cache
 */
 void _pcb_free( pcb_t *p );
 
 /**
 ** _pcb_find_pid(pid)
 **
-** Locate the PCB for the specified PID
+** Locate the PCB for the specified PID, by indexing the process table
 **
 ** @param pid   The PID to look for
 **
@@ -177,6 +265,97 @@ void _pcb_free( pcb_t *p );
 */
 pcb_t *_pcb_find_pid( pid_t pid );
 
+/**
+** _pid_alloc()
+**
+** Reserve a process table slot, growing the table if need be
+**
+** @return The PID for that slot, or E_NO_PROCS
+*/
+pid_t _pid_alloc( void );
+
+/**
+** _pid_free(pid)
+**
+** Release a process table slot reserved by _pid_alloc()
+**
+** @param pid   The PID
+*/
+void _pid_free( pid_t pid );
+
+/**
+** _proc_add(pcb,parent)
+**
+** Add a new process to the process table slot reserved for its PID,
+** and link it onto its parent's list of children
+**
+** @param pcb      The new process
+** @param parent   Its parent (NULL for init)
+*/
+void _proc_add( pcb_t *pcb, pcb_t *parent );
+
+/**
+** _proc_next(pos)
+**
+** Iterate over the active processes
+**
+** @param pos   Iteration state; set *pos to 0 to begin
+**
+** @return The next active process, or NULL at the end of the table
+*/
+pcb_t *_proc_next( uint32_t *pos );
+
+/**
+** _proc_pool_size(n)
+**
+** Change the number of warm processes kept in the spawn pool; excess
+** ones are released immediately, and new ones are prepared as the
+** idle process finds time
+**
+** @param n   The new pool size
+*/
+void _proc_pool_size( uint32_t n );
+
+/**
+** _proc_pool_info(count,target)
+**
+** Report the current and target sizes of the spawn pool
+**
+** @param count   Where to put the number of warm processes
+** @param target  Where to put the pool's target size
+*/
+void _proc_pool_info( uint32_t *count, uint32_t *target );
+
+/**
+** _proc_refill()
+**
+** Add one warm process to the spawn pool, if it is below its target
+** size.  Called from the idle process, with interrupts enabled.
+**
+** @return true if a process was added, else false
+*/
+bool_t _proc_refill( void );
+
+/**
+** _proc_started(pcb)
+**
+** Record the spawn-to-first-dispatch latency of a new process
+**
+** @param pcb   The process, which is about to be run for the first time
+*/
+void _proc_started( pcb_t *pcb );
+
+/**
+** _proc_reparent(old,new)
+**
+** Hand all of a process' children, including any zombies awaiting
+** collection, to another process
+**
+** @param old   The current parent
+** @param new   The new parent
+*/
+void _proc_reparent( pcb_t *old, pcb_t *new );
+
 /**
 ** _pcb_cleanup(pcb)
 **
@@ -186,6 +365,63 @@ pcb_t *_pcb_find_pid( pid_t pid );
 */
 void _pcb_cleanup( pcb_t *pcb );
 
+/*
+** Process queues
+*/
+
+/**
+** _pcbq_init(q,ordered) - initialize an (empty) process queue
+**
+** @param q         The queue
+** @param ordered   Keep the queue in order by key?
+*/
+void _pcbq_init( pcbq_t *q, bool_t ordered );
+
+/**
+** _pcbq_enque(q,pcb,key) - add a process to a queue
+**
+** The process must not already be on a queue.
+**
+** @param q     The queue
+** @param pcb   The process to add
+** @param key   Ordering key (ignored for FIFO queues)
+*/
+void _pcbq_enque( pcbq_t *q, pcb_t *pcb, uint32_t key );
+
+/**
+** _pcbq_deque(q) - remove the first process from a queue
+**
+** @param q     The queue
+**
+** @return The process, or NULL if the queue is empty
+*/
+pcb_t *_pcbq_deque( pcbq_t *q );
+
+/**
+** _pcbq_peek(q) - return the first process on a queue without
+** removing it
+**
+** @param q     The queue
+**
+** @return The process, or NULL if the queue is empty
+*/
+pcb_t *_pcbq_peek( pcbq_t *q );
+
+/**
+** _pcbq_remove(pcb) - take a process off whatever queue it is on
+**
+** @param pcb   The process
+*/
+void _pcbq_remove( pcb_t *pcb );
+
+/**
+** _pcbq_dump(msg,q) - dump the contents of a process queue
+**
+** @param msg   Optional message to print
+** @param q     Queue to dump
+*/
+void _pcbq_dump( const char *msg, pcbq_t *q );
+
 /*
 ** Process management/control
 */
@@ -193,7 +429,7 @@ void _pcb_cleanup( pcb_t *pcb );
 /**
 ** _proc_init() - initialize the process module
 **
-** Allocates the initial set of PCBs, does whatever else is
+** Creates the PCB cache, does whatever else is
 ** needed to make it possible to create processes
 **
 ** Dependencies:
@@ -216,12 +452,33 @@ void _proc_init( void );
 ** @param ppid   PID of parent process
 ** @param uid    UID for the new process
 ** @param gid    GID for the new process
+** @param wDir   Working directory for the new process
+** @param pages  Stack size, in pages (0 for the default)
 **
 ** @return Pointer to the new process' PCB, or NULL if memory could
 **         not be allocated for the PCB or the stack
 */
 pcb_t *_proc_create( uint32_t args[4], pid_t pid, pid_t ppid, 
-						uid_t uid, gid_t gid, inode_id_t wDir);
+						uid_t uid, gid_t gid, inode_id_t wDir,
+						uint32_t pages );
+
+/**
+** _thread_create - create a new thread of a process
+**
+** Like _proc_create(), but the new thread shares the creator's files,
+** credentials, and working directory, and runs at its priority
+**
+** @param creator  The thread creating this one
+** @param entry    Entry point
+** @param arg      Argument passed to the entry point
+** @param pid      PID for the new thread
+** @param pages    Stack size, in pages (0 for THREAD_STACK_PAGES)
+**
+** @return Pointer to the new thread's PCB, or NULL if memory could
+**         not be allocated
+*/
+pcb_t *_thread_create( pcb_t *creator, uint32_t entry, uint32_t arg,
+                       pid_t pid, uint32_t pages );
 
 /*
 ** Debugging/tracing routines
@@ -262,10 +519,20 @@ void _context_dump_all( const char *msg );
 ** dump the contents of the "active processes" table
 **
 ** @param msg  Optional message to print
-** @param all  Dump all or only part of the relevant data
+** @param all  Dump all or only part of the relevant data (all also
+**             dumps the spinlock statistics)
 */
 void _active_dump( const char *msg, bool_t all );
 
+/**
+** _proc_pool_dump(msg)
+**
+** dump the spawn pool state and the spawn latency histogram
+**
+** @param msg  Optional message to print
+*/
+void _proc_pool_dump( const char *msg );
+
 #endif
 
 #endif
@@ -65,20 +65,10 @@ struct queue_s {
 */
 
 /*
-** The list of free qnodes.
-**
-** Organized as a singly-linked list using the 'next' pointer
-** in the qnode structure.
-*/
-static qnode_t *_free_qnodes;
-
-/*
-** The list of free queues.
-**
-** Organized as a singly-linked list using the 'data' pointer
-** in the queue_s structure.
+** The object caches that qnodes and queues are allocated from
 */
-static queue_t _free_queues;
+static cache_t _qnode_cache;
+static cache_t _queue_cache;
 
 /*
 ** PUBLIC GLOBAL VARIABLES
@@ -88,79 +78,6 @@ static queue_t _free_queues;
 ** PRIVATE FUNCTIONS
 */
 
-// forward references
-static void _qn_free( qnode_t * );
-void _que_free( queue_t );
-
-/**
-** _new_qnodes() - allocate a slice and carve it into qnodes
-**
-** @param critical  Should we panic on allocation failure?
-**
-** @return true on success, else false
-*/
-static bool_t _new_qnodes( bool_t critical ) {
-    qnode_t *slice;
-
-    // start by carving off a slice of memory
-    slice = (qnode_t *) _km_slice_alloc();
-
-    // if this is a critical allocation and slice is NULL, we're done
-    assert( !critical || slice != NULL );
-
-    // whew - not critical; NULL slice is still a problem, though
-    if( slice == NULL ) {
-        return( false );
-    }
-
-    // clear out the allocated space
-    __memclr( slice, SLICE_SIZE );
-
-    // free the qnodes!
-    for( int i = 0; i < (SLICE_SIZE / sizeof(qnode_t)); ++i ) {
-        // N.B.: if the slice size is not an integral multiple of
-        // the qnode size, this will leave a small internal fragment
-        // at the end of the allocated block of memory
-        _qn_free( slice + i );
-    }
-
-    // all done!
-    return( true );
-}
-
-/**
-** _new_queues() - allocate a slice and carve it into queues
-**
-** @param critical  Should we panic on allocation failure?
-**
-** @return true on success, else false
-*/
-static bool_t _new_queues( bool_t critical ) {
-    struct queue_s *slice;
-
-    // start by carving off a slice of memory
-    slice = (struct queue_s *) _km_slice_alloc();
-
-    // if this is a critical allocation and slice is NULL, we're done
-    assert( !critical || slice != NULL );
-
-    // whew - not critical; NULL slice is still a problem, though
-    if( slice == NULL ) {
-        return( false );
-    }
-
-    // clear out the allocated space
-    __memclr( slice, SLICE_SIZE );
-
-    // 
-    for( int i = 0; i < (SLICE_SIZE / sizeof(struct queue_s)); ++i ) {
-        _que_free( slice + i );
-    }
-
-    // all done!
-    return( true );
-}
-
 /**
 ** _qn_alloc() - allocate a qnode
 **
@@ -171,22 +88,12 @@ static bool_t _new_queues( bool_t critical ) {
 static qnode_t *_qn_alloc( void ) {
     qnode_t *new;
 
-    // see if there is an available node
-    if( _free_qnodes == NULL ) {
-
-        // no - see if we can create some
-        if( !_new_qnodes(false) ) {
-            // no!  let's just leave quietly
-            return( NULL );
-        }
+    new = (qnode_t *) _km_cache_alloc( _qnode_cache );
+    if( new == NULL ) {
+        // no memory!  let's just leave quietly
+        return( NULL );
     }
 
-    // OK, we know that there is at least one free qnode;
-    // just take the first one from the list
-
-    new = _free_qnodes;
-    _free_qnodes = new->next;
-
     // clear out the fields in this one just to be safe
     new->prev = new->next = new->data = NULL;
     new->key = 0;
@@ -196,17 +103,15 @@ static qnode_t *_qn_alloc( void ) {
 }
 
 /**
-** _qn_free() - return a qnode to the free list
+** _qn_free() - return a qnode to its cache
 **
 ** Deallocates the supplied qnode
 **
-** @param qn   The qnode to be put on the free list
+** @param qn   The qnode to be freed
 */
 static void _qn_free( qnode_t *qn ) {
 
-    // just stick this one at the front of the list
-    qn->next = _free_qnodes;
-    _free_qnodes = qn;
+    _km_cache_free( _qnode_cache, qn );
 }
 
 /*
@@ -216,7 +121,7 @@ static void _qn_free( qnode_t *qn ) {
 /**
 ** _que_init() - initialize the queue module
 **
-** Allocates the initial set of qnodes and set of queues.
+** Creates the caches that qnodes and queues come from.
 **
 ** Dependencies:
 **    Cannot be called before kmem is initialized
@@ -227,12 +132,12 @@ void _que_init( void ) {
     __cio_puts( " Queue:" );
 
     // start with the qnodes
-    _free_qnodes = NULL;
-    _new_qnodes( true );
+    _qnode_cache = _km_cache_create( "qnode", sizeof(qnode_t), KM_QUEUE );
+    assert( _qnode_cache != NULL );
 
     // next, the queues
-    _free_queues = NULL;
-    _new_queues( true );
+    _queue_cache = _km_cache_create( "queue", sizeof(struct queue_s), KM_QUEUE );
+    assert( _queue_cache != NULL );
 
     // all done!
     __cio_puts( " done" );
@@ -250,22 +155,12 @@ void _que_init( void ) {
 queue_t _que_alloc( int (*order)(const void *,const void *) ) {
     queue_t new;
 
-    // see if there is an available node
-    if( _free_queues == NULL ) {
-
-        // no - see if we can create some
-        if( !_new_queues(false) ) {
-            // no!  let's just leave quietly
-            return( NULL );
-        }
+    new = (queue_t) _km_cache_alloc( _queue_cache );
+    if( new == NULL ) {
+        // no memory!  let's just leave quietly
+        return( NULL );
     }
 
-    // OK, we know that there is at least one free qnode;
-    // just take the first one from the list
-
-    new = _free_queues;
-    _free_queues = (queue_t) new->head;
-
     // clear out the fields in this one just to be safe
     new->head = new->tail = NULL;
     new->length = 0;
@@ -276,20 +171,18 @@ queue_t _que_alloc( int (*order)(const void *,const void *) ) {
 }
 
 /**
-** _que_free() - return a queue to the free list
+** _que_free() - return a queue to its cache
 **
 ** Deallocates the supplied queue
 **
-** @param q   The queue to be put on the free list
+** @param q   The queue to be freed
 */
 void _que_free( queue_t q ) {
 
     // sanity check!
     assert1( q != NULL );
 
-    // just stick this one at the front of the list
-    q->head = (qnode_t *) _free_queues;
-    _free_queues = q;
+    _km_cache_free( _queue_cache, q );
 }
 
 /**
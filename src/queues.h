@@ -42,7 +42,7 @@ typedef struct queue_s *queue_t;
 /**
 ** _que_init() - initialize the queue module
 **
-** Allocates the initial set of qnodes and set of queues.
+** Creates the caches that qnodes and queues come from.
 **
 ** Dependencies:
 **    Cannot be called before kmem is initialized
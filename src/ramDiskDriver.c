@@ -3,7 +3,7 @@
 void _rd_init(void) {
     __cio_puts( " RamDisk:" );
 
-    int result = _fs_registerDev((driverInterface_t) {0, 0, _rd_readBlock, _rd_writeBlock});
+    int result = _fs_registerDev((driverInterface_t) {0, 0, _rd_readBlock, _rd_writeBlock, _rd_mapBlock});
     if(result < 0) {
         __cio_printf(" FAILURE (%d)", result);
         return;
@@ -37,4 +37,13 @@ int _rd_writeBlock(uint32_t blockNr, char* buf, uint8_t devId) {
 
     blockCpy(buf, diskPtr);
     return E_SUCCESS;
-}
\ No newline at end of file
+}
+
+char * _rd_mapBlock(uint32_t blockNr, uint8_t devId) {
+    if(devId != 0) {
+        return NULL;    // Only one ramdisk, device 0
+    }
+
+    // The ramdisk is loaded in memory, so a block is just an address
+    return (char *)(DISK_LOAD_POINT + blockNr * BLOCK_SIZE);
+}
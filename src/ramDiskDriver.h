@@ -12,6 +12,7 @@ void _rd_init(void);
 
 int _rd_readBlock(uint32_t blockNr, char* buf, uint8_t devId);
 int _rd_writeBlock(uint32_t blockNr, char* buf, uint8_t devId);
+char * _rd_mapBlock(uint32_t blockNr, uint8_t devId);
 
 
 
@@ -9,12 +9,33 @@
 #define    SP_KERNEL_SRC
 
 #include "common.h"
+#include "clock.h"
+#include "scheduler.h"
 #include "syscalls.h"
+#include "vdata.h"
 
 /*
 ** PRIVATE DEFINITIONS
 */
 
+// The ready queue is a multi-level feedback queue.
+//
+// Each process has a base priority (pcb->priority, set by spawn()
+// and setprio()) and a current level (pcb->level), which selects
+// the ready queue it is placed on.  Lower levels run first.
+//
+//  - a process which uses up its quantum is demoted by MLFQ_STEP
+//    levels, but never below MLFQ_FLOOR (or its base, if lower)
+//  - a process which blocks or sleeps returns to its base priority
+//  - the quantum grows as the level drops (MLFQ_QUANTUM), so batch
+//    jobs switch less often
+//  - every MLFQ_AGE_TICKS ticks, any process which has waited on one
+//    level for MLFQ_STARVE ticks is promoted by MLFQ_STEP levels, up
+//    to PRIO_STD (or its base, if higher), so nothing starves
+//
+// The idle process is never on a ready queue; _dispatch() selects it
+// only when every level is empty.
+
 /*
 ** PRIVATE DATA TYPES
 */
@@ -23,20 +44,88 @@
 ** PRIVATE GLOBAL VARIABLES
 */
 
+// ticks until the next aging pass
+static uint32_t _age_ticks;
+
 /*
 ** PUBLIC GLOBAL VARIABLES
 */
 
-// the ready queue:  a MLQ with four levels
-queue_t _ready[N_QUEUES];
+// the ready queue:  a MLQ with N_QUEUES levels
+pcbq_t _ready[N_QUEUES];
+
+// bit n is set iff _ready[n] is non-empty
+uint32_t _ready_map;
 
 // the current user process
 pcb_t *_current;
 
+// the idle process, run when nothing else is ready
+pcb_t *_idle;
+
 /*
 ** PRIVATE FUNCTIONS
 */
 
+/**
+** _ready_unlink() - take a process off its ready level
+**
+** @param pcb   The process to be removed
+*/
+static void _ready_unlink( pcb_t *pcb ) {
+    pcbq_t *q = &_ready[pcb->level];
+
+    assert( pcb->queue == q );
+
+    _pcbq_remove( pcb );
+    if( _pcbq_length(q) == 0 ) {
+        _ready_map &= ~(1 << pcb->level);
+    }
+}
+
+/**
+** _ready_link() - put a process at the end of its ready level
+**
+** The enqueue time is kept as the queue key, for aging
+**
+** @param pcb   The process to be added
+*/
+static void _ready_link( pcb_t *pcb ) {
+    _pcbq_enque( &_ready[pcb->level], pcb, _system_time );
+    _ready_map |= (1 << pcb->level);
+}
+
+/**
+** _sched_age() - promote processes which have waited too long
+*/
+static void _sched_age( void ) {
+    // level 0 can't go any higher
+    uint32_t map = _ready_map & ~1;
+
+    while( map != 0 ) {
+        uint32_t n = __bsf( map );
+        map &= ~(1 << n);
+
+        // FIFO order means the oldest waiters are at the front
+        pcb_t *pcb = _pcbq_peek( &_ready[n] );
+        while( pcb != NULL && _system_time - pcb->qkey >= MLFQ_STARVE ) {
+            pcb_t *next = pcb->qnext;
+
+            prio_t ceil = pcb->priority < PRIO_STD ?
+                          pcb->priority : PRIO_STD;
+
+            if( pcb->level > ceil ) {
+                _ready_unlink( pcb );
+                pcb->level = pcb->level > ceil + MLFQ_STEP ?
+                             pcb->level - MLFQ_STEP : ceil;
+                _ready_link( pcb );
+            }
+
+            pcb = next;
+        }
+    }
+}
+
 /*
 ** PUBLIC FUNCTIONS
 */
@@ -44,7 +133,7 @@ pcb_t *_current;
 /**
 ** _sched_init() - initialize the scheduler module
 **
-** Allocates the ready queues and resets the "current process" pointer
+** Initializes the ready queues and resets the "current process" pointer
 **
 ** Dependencies:
 **    Cannot be called before queues are initialized
@@ -54,15 +143,16 @@ void _sched_init( void ) {
 
     __cio_puts( " Sched:" );
     
-    // allocate the ready queues
+    // initialize the ready queues
     for( int i = 0; i < N_QUEUES; ++i ) {
-        _ready[i] = _que_alloc( NULL );
-        // at this point, allocation failure is terminal
-        assert( _ready[i] != NULL );
+        _pcbq_init( &_ready[i], false );
     }
+    _ready_map = 0;
+    _age_ticks = MLFQ_AGE_TICKS;
     
     // reset the "current process" pointer
     _current = NULL;
+    _idle = NULL;
     
     __cio_puts( " done" );
 }
@@ -70,7 +160,8 @@ void _sched_init( void ) {
 /**
 ** _schedule() - add a process to the ready queue
 **
-** Enques the supplied process according to its priority value
+** Enques the supplied process according to its current MLFQ level;
+** if the idle process was running, switches to the new process
 **
 ** @param pcb   The process to be scheduled
 */
@@ -86,82 +177,146 @@ void _schedule( pcb_t *pcb ) {
     }
 
     // bad priority value causes a fault
-    assert1( pcb->priority <= PRIO_LOWEST );
+    assert1( pcb->level <= PRIO_LOWEST );
     
     // mark the process as ready to execute
     pcb->state = Ready;
 
-    // add it to the appropriate queue
-    int status = _que_enque( _ready[pcb->priority], pcb, 0 );
+    // add it to the appropriate queue (this can't fail)
+    _ready_link( pcb );
 
-    // failure is not an option!
-    assert( status == E_SUCCESS );
+    // the idle process only runs while nothing else can, so if it
+    // was interrupted, switch to the process we just made ready
+    if( _current == _idle && _idle != NULL ) {
+        _dispatch();
+    }
+}
+
+/**
+** _sched_preempt() - reschedule a process that used up its quantum
+**
+** Demotes the process by MLFQ_STEP levels, then schedules it
+**
+** @param pcb   The process to be rescheduled
+*/
+void _sched_preempt( pcb_t *pcb ) {
+    prio_t floor;
+
+    assert1( pcb != NULL );
+
+    floor = pcb->priority > MLFQ_FLOOR ? pcb->priority : MLFQ_FLOOR;
+    if( pcb->level < floor ) {
+        pcb->level = pcb->level + MLFQ_STEP < floor ?
+                     pcb->level + MLFQ_STEP : floor;
+    }
+
+    _schedule( pcb );
+}
+
+/**
+** _sched_boost() - reward a process for giving up the CPU
+**
+** Moves the process back to its base priority; called when it
+** blocks or sleeps
+**
+** @param pcb   The process being boosted
+*/
+void _sched_boost( pcb_t *pcb ) {
+
+    assert1( pcb != NULL );
+
+    pcb->level = pcb->priority;
+}
+
+/**
+** _sched_tick() - per-tick scheduler housekeeping
+**
+** Called from the clock ISR; periodically ages processes which
+** have been waiting on the ready queue for too long
+*/
+void _sched_tick( void ) {
+
+    if( --_age_ticks == 0 ) {
+        _age_ticks = MLFQ_AGE_TICKS;
+        _sched_age();
+    }
+}
+
+/**
+** _sched_remove() - take a process off the ready queue
+**
+** Unlinks the supplied process from its ready queue level; used when
+** a Ready process is killed
+**
+** @param pcb   The process to be removed
+*/
+void _sched_remove( pcb_t *pcb ) {
+
+    assert1( pcb != NULL );
+
+    _ready_unlink( pcb );
 }
 
 /**
 ** _dispatch() - select a new "current" process
 **
-** Selects the highest-priority process available
+** Selects the highest-priority process available, or the idle
+** process if none is ready
 */
 void _dispatch( void ) {
     pcb_t *new;
-    int n;
-    
-    // we need to loop until we find a process
-    // that's eligible to execute
-
-    while( 1 ) {
+    uint32_t n;
 
-        // find a ready queue that has an available process
-        for( n = 0; n < N_QUEUES; ++n ) {
-            if( _que_length(_ready[n]) > 0 ) {
-                break;
-            }
-        }
-    
-        // this should never happen - if nothing else, the
-        // idle process should be on the "Deferred" queue
-        assert( n < N_QUEUES );
-    
-        // OK, we found a queue; pull the first process from it
-        new = _que_deque( _ready[n] );
+    // with nothing to run, halt in the idle process; the clock
+    // stops ticking until the next timed wakeup is due
+    if( _ready_map == 0 ) {
+        assert( _idle != NULL );
+        _current = _idle;
+        _uarea = _idle->uarea;
+        _vdata_switch( _idle );
+        _idle->state = Running;
+        _clk_idle();
+        return;
+    }
 
-        // failure to deque means something serious has gone wrong
-        assert( new != NULL );
+    // the lowest set bit is the highest-priority non-empty level
+    n = __bsf( _ready_map );
 
-        // if this process is a delayed 'kill', we need to take care
-        // of it; otherwise, we've found our new current process
+    new = _pcbq_deque( &_ready[n] );
 
-        if( new->state == Ready ) {
-            // this is the new current process
-            break;
-        }
+    // failure to deque means the map and the queues disagree
+    assert( new != NULL );
 
-        // this is something of a sanity check - processes on the
-        // ready queue are usually in the Ready state.  however, if
-        // another process used kill() on this process, it may be on
-        // the ready queue in the Killed state.
-
-        if( new->state != Killed ) {
-            // this is a serious problem - we have a process that
-            // was on the ready queue but wasn't in either the Ready
-            // state or the Killed state!
-            __sprint( b256, "*** _dispatch(): found PID %d, state %d\n",
-                     new->pid, new->state );
-            __cio_puts( b256 );
-            PANIC( 0, _dispatch );
-        }
+    if( _pcbq_length(&_ready[n]) == 0 ) {
+        _ready_map &= ~(1 << n);
+    }
 
-        // we found a process, but it has been killed - clean it up,
-        // then loop and pick another process
+    // killed processes are pulled off the ready queue by kill(),
+    // so anything we find here had better be Ready
 
-        _force_exit( new, Killed );
+    if( new->state != Ready ) {
+        __sprint( b256, "*** _dispatch(): found PID %d, state %d\n",
+                 new->pid, new->state );
+        __cio_puts( b256 );
+        PANIC( 0, _dispatch );
     }
     
-    // make this the current process
+    // coming out of idle?  restart the periodic clock
+    _clk_resume();
+
+    // make this the current process, and expose its library area
+    // and its IDs
     _current = new;
+    _uarea = new->uarea;
+    _vdata_switch( new );
 
-    // set its state and remaining quantum
+    // set its state and remaining quantum, which depends on its level
     new->state = Running;
+    new->quantum = MLFQ_QUANTUM( new->level );
     new->ticks = new->quantum;
+
+    // first time it has run?
+    if( new->spawned != 0 ) {
+        _proc_started( new );
+    }
 }
@@ -30,6 +30,15 @@
 // standard process quantum (in ticks)
 #define Q_STD    2
 
+// MLFQ tuning (see scheduler.c)
+#define MLFQ_STEP        4      // levels moved per demotion or aging step
+#define MLFQ_FLOOR       (PRIO_LOWEST - 1)  // lowest level for demotion
+#define MLFQ_AGE_TICKS   100    // how often to look for starving processes
+#define MLFQ_STARVE      500    // how long a process may wait on one level
+
+// quantum for a level: doubles every eight levels
+#define MLFQ_QUANTUM(l)  (Q_STD << ((l) >> 3))
+
 /*
 ** Types
 */
@@ -38,12 +47,18 @@
 ** Globals
 */
 
-// the ready queue:  a MLQ with four levels
-extern queue_t _ready[N_QUEUES];
+// the ready queue:  a MLQ with N_QUEUES levels
+extern pcbq_t _ready[N_QUEUES];
+
+// bit n is set iff _ready[n] is non-empty
+extern uint32_t _ready_map;
 
 // the current user process
 extern pcb_t *_current;
 
+// the idle process, run when nothing else is ready
+extern pcb_t *_idle;
+
 /*
 ** Prototypes
 */
@@ -62,16 +77,55 @@ void _sched_init( void );
 /**
 ** _schedule() - add a process to the ready queue
 **
-** Enques the supplied process according to its priority value
+** Enques the supplied process according to its current MLFQ level;
+** if the idle process was running, switches to the new process
 **
 ** @param pcb   The process to be scheduled
 */
 void _schedule( pcb_t *pcb );
 
+/**
+** _sched_preempt() - reschedule a process that used up its quantum
+**
+** Demotes the process by MLFQ_STEP levels, then schedules it
+**
+** @param pcb   The process to be rescheduled
+*/
+void _sched_preempt( pcb_t *pcb );
+
+/**
+** _sched_boost() - reward a process for giving up the CPU
+**
+** Moves the process back to its base priority; called when it
+** blocks or sleeps
+**
+** @param pcb   The process being boosted
+*/
+void _sched_boost( pcb_t *pcb );
+
+/**
+** _sched_tick() - per-tick scheduler housekeeping
+**
+** Called from the clock ISR; periodically ages processes which
+** have been waiting on the ready queue for too long
+*/
+void _sched_tick( void );
+
+/**
+** _sched_remove() - take a process off the ready queue
+**
+** Unlinks the supplied process from its ready queue level; used when
+** a Ready process is killed
+**
+** @param pcb   The process to be removed
+*/
+void _sched_remove( pcb_t *pcb );
+
 /**
 ** _dispatch() - select a new "current" process
 **
-** Selects the highest-priority process available
+** Selects the highest-priority process available, or the idle
+** process if none is ready
 */
 void _dispatch( void );
 
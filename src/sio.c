@@ -61,8 +61,10 @@
 #include "process.h"
 #include "scheduler.h"
 #include "kernel.h"
+#include "syscalls.h"
 
 #include "klib.h"
+#include "lock.h"
 
 /*
 ** PRIVATE DEFINITIONS
@@ -92,12 +94,18 @@ static int _sending;
     // interrupt register status
 static uint8_t _ier;
 
+    // protects the buffers and the variables above
+static spinlock_t _sio_lock;
+
 /*
 ** PUBLIC GLOBAL VARIABLES
 */
 
 // queue for read-blocked processes
-queue_t _reading;
+pcbq_t _reading;
+
+// queue for processes blocked on a full output buffer
+pcbq_t _writing;
 
 /*
 ** PRIVATE FUNCTIONS
@@ -149,10 +157,13 @@ static void _sio_isr( int vector, int ecode ) {
             // process and awaken the process.
             //
 
+            _spin_lock( &_sio_lock );
+
             if( QLENGTH(READQ) > 0 ) {
 
         pcb = (pcb_t *) QDEQUE( READQ );
         assert( pcb );
+                _spin_unlock( &_sio_lock );
 
                 // return char via arg #2 and count in EAX
         char *buf = (char *) ARG(pcb,2);
@@ -171,6 +182,7 @@ static void _sio_isr( int vector, int ecode ) {
                     *_inlast++ = ch;
                     ++_incount;
                 }
+                _spin_unlock( &_sio_lock );
 
             }
             break;
@@ -183,6 +195,7 @@ static void _sio_isr( int vector, int ecode ) {
 
         case UA4_EIR_TX_INT_PENDING:
             // if there is another character, send it
+            _spin_lock( &_sio_lock );
             if( _sending && _outcount > 0 ) {
                 __outb( UA4_TXD, *_outnext );
                 ++_outnext;
@@ -191,6 +204,19 @@ static void _sio_isr( int vector, int ecode ) {
                     _outnext = _outbuffer;
                 }
                 --_outcount;
+
+                // once the buffer has drained to half full, let any
+                // splice() blocked on a full buffer refill it; they
+                // write to us, so the lock must be released first
+                bool_t drained = _outcount == BUF_SIZE / 2;
+                _spin_unlock( &_sio_lock );
+                if( drained && QLENGTH(&_writing) > 0 ) {
+                    for( int n = QLENGTH(&_writing); n > 0; --n ) {
+                        pcb = (pcb_t *) QDEQUE( &_writing );
+                        assert( pcb );
+                        _splice_resume( pcb );
+                    }
+                }
             } else {
                 // no more data - reset the output vars
                 _outcount = 0;
@@ -198,6 +224,7 @@ static void _sio_isr( int vector, int ecode ) {
                 _sending = 0;
                 // disable TX interrupts
                 _sio_disable( SIO_TX );
+                _spin_unlock( &_sio_lock );
             }
             break;
 
@@ -242,6 +269,8 @@ void _sio_init( void ) {
     ** Initialize SIO variables.
     */
 
+    _spin_init( &_sio_lock, "sio", LOCK_SIO );
+
     __memset( (void *) _inbuffer, sizeof(_inbuffer), 0 );
     _inlast = _innext = _inbuffer;
     _incount = 0;
@@ -252,7 +281,10 @@ void _sio_init( void ) {
     _sending = 0;
 
     // queue of read-blocked processes
-    _reading = _que_alloc( NULL );
+    _pcbq_init( &_reading, false );
+
+    // queue of write-blocked processes
+    _pcbq_init( &_writing, false );
 
     /*
     ** Next, initialize the UART.
@@ -426,6 +458,8 @@ int _sio_readc( void ) {
     // assume there is no character available
     ch = -1;
 
+    _spin_lock( &_sio_lock );
+
     // 
     // If there is a character, return it
     //
@@ -443,6 +477,8 @@ int _sio_readc( void ) {
 
     }
 
+    _spin_unlock( &_sio_lock );
+
     return( ch );
 
 }
@@ -466,7 +502,10 @@ int _sio_reads( char *buf, int length ) {
 
     // if there are no characters, just return 0
 
+    _spin_lock( &_sio_lock );
+
     if( _incount < 1 ) {
+        _spin_unlock( &_sio_lock );
         return( 0 );
     }
 
@@ -490,6 +529,8 @@ int _sio_reads( char *buf, int length ) {
         _inlast = _innext = _inbuffer;
     }
 
+    _spin_unlock( &_sio_lock );
+
     // return the copy count
 
     return( copied );
@@ -497,15 +538,11 @@ int _sio_reads( char *buf, int length ) {
 
 
 /**
-** _sio_writec( ch )
-**
-** Write a character to the serial output
-**
-** usage:    _sio_writec( int ch )
+** _sio_putc( ch ) - guts of _sio_writec(); the caller holds _sio_lock
 **
 ** @param ch   Character to be written (in the low-order 8 bits)
 */
-void _sio_writec( int ch ){
+static void _sio_putc( int ch ){
 
 
     //
@@ -513,7 +550,7 @@ void _sio_writec( int ch ){
     //
 
     if( ch == '\n' ) {
-        _sio_writec( '\r' );
+        _sio_putc( '\r' );
     }
 
     //
@@ -539,6 +576,22 @@ void _sio_writec( int ch ){
 
 }
 
+/**
+** _sio_writec( ch )
+**
+** Write a character to the serial output
+**
+** usage:    _sio_writec( int ch )
+**
+** @param ch   Character to be written (in the low-order 8 bits)
+*/
+void _sio_writec( int ch ){
+
+    _spin_lock( &_sio_lock );
+    _sio_putc( ch );
+    _spin_unlock( &_sio_lock );
+}
+
 /**
 ** _sio_write( buffer, length )
 **
@@ -560,9 +613,11 @@ int _sio_write( const char *buffer, int length ) {
     // If we are currently sending, we want to append all
     // the characters to the output buffer; else, we want
     // to append all but the first character, and then use
-    // _sio_writec() to send the first one out.
+    // _sio_putc() to send the first one out.
     //
 
+    _spin_lock( &_sio_lock );
+
     if( !_sending ) {
         ptr += 1;
         copied++;
@@ -579,15 +634,17 @@ int _sio_write( const char *buffer, int length ) {
     }
 
     //
-    // We use _sio_writec() to send out the first character,
+    // We use _sio_putc() to send out the first character,
     // as it will correctly set all the other necessary
     // variables for us.
     //
 
     if( !_sending ) {
-        _sio_writec( first );
+        _sio_putc( first );
     }
 
+    _spin_unlock( &_sio_lock );
+
     // Return the transfer count
 
 
@@ -595,6 +652,20 @@ int _sio_write( const char *buffer, int length ) {
 
 }
 
+/**
+** _sio_space()
+**
+** Get the amount of free space in the output buffer
+**
+** usage:   int num = _sio_space()
+**
+** @return the number of characters _sio_write() can currently accept
+*/
+int _sio_space( void ) {
+
+    return( BUF_SIZE - _outcount );
+}
+
 /**
 ** _sio_puts( buf )
 **
@@ -609,9 +680,11 @@ int _sio_write( const char *buffer, int length ) {
 int _sio_puts( const char *buffer ) {
     int n;  // must be outside the loop so we can return it
 
+    _spin_lock( &_sio_lock );
     for( n = 0; *buffer; ++n ) {
-        _sio_writec( *buffer++ );
+        _sio_putc( *buffer++ );
     }
+    _spin_unlock( &_sio_lock );
 
     return( n );
 }
@@ -35,7 +35,10 @@
 */
 
 // queue for read-blocked processes
-extern queue_t _reading;
+extern pcbq_t _reading;
+
+// queue for processes blocked on a full output buffer
+extern pcbq_t _writing;
 
 /*
 ** PUBLIC FUNCTIONS
@@ -135,6 +138,17 @@ void _sio_writec( int ch );
 */
 int _sio_write( const char *buffer, int length );
 
+/**
+** _sio_space()
+**
+** Get the amount of free space in the output buffer
+**
+** usage:   int num = _sio_space()
+**
+** @return the number of characters _sio_write() can currently accept
+*/
+int _sio_space( void );
+
 /**
 ** _sio_puts( buf )
 **
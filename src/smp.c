@@ -0,0 +1,367 @@
+/**
+** @file smp.c
+**
+** @author CSCI-452 class of 20205
+**
+** Processor discovery
+**
+** At boot we find the processors and the local and I/O APICs from
+** the ACPI MADT, falling back to the Intel MP specification tables on
+** older firmware.  This is discovery only:  the kernel is uniprocessor,
+** so the application processors are never started, and interrupts
+** stay on the 8259.  _smp_cpu() lets per-processor data (e.g., the
+** held-lock lists in lock.c) be indexed ahead of that.
+*/
+
+#define SP_KERNEL_SRC
+
+#include "common.h"
+
+#include "smp.h"
+
+/*
+** PRIVATE DEFINITIONS
+*/
+
+// where to look for the firmware tables
+#define BDA_EBDA        0x040e      // real-mode segment of the EBDA
+#define BIOS_ROM        0x000e0000
+#define BIOS_ROM_LEN    0x00020000
+#define BASE_MEM_TOP    0x0009fc00  // last KB of base memory
+
+// MADT entry types
+#define MADT_LAPIC      0
+#define MADT_IOAPIC     1
+
+// MP configuration table entry types, and processor flags
+#define MP_PROC         0
+#define MP_IOAPIC       2
+#define MP_PROC_EN      0x01
+#define MP_PROC_BSP     0x02
+
+/*
+** PRIVATE DATA TYPES
+*/
+
+// ACPI root system description pointer
+typedef struct rsdp_s {
+    char sig[8];            // "RSD PTR "
+    uint8_t csum;
+    char oem[6];
+    uint8_t rev;
+    uint32_t rsdt;          // physical address of the RSDT
+} __attribute__((packed)) rsdp_t;
+
+// ACPI system description table header
+typedef struct sdt_s {
+    char sig[4];
+    uint32_t length;        // including this header
+    uint8_t rev;
+    uint8_t csum;
+    char oem[6];
+    char oem_table[8];
+    uint32_t oem_rev;
+    uint32_t creator;
+    uint32_t creator_rev;
+} __attribute__((packed)) sdt_t;
+
+// MP floating pointer structure
+typedef struct mpfp_s {
+    char sig[4];            // "_MP_"
+    uint32_t config;        // physical address of the configuration table
+    uint8_t length;         // in 16-byte units
+    uint8_t rev;
+    uint8_t csum;
+    uint8_t feature[5];
+} __attribute__((packed)) mpfp_t;
+
+// MP configuration table header
+typedef struct mpct_s {
+    char sig[4];            // "PCMP"
+    uint16_t length;
+    uint8_t rev;
+    uint8_t csum;
+    char oem[8];
+    char product[12];
+    uint32_t oem_table;
+    uint16_t oem_size;
+    uint16_t count;         // number of entries
+    uint32_t lapic;         // local APIC address
+    uint16_t ext_length;
+    uint8_t ext_csum;
+    uint8_t reserved;
+} __attribute__((packed)) mpct_t;
+
+/*
+** PRIVATE GLOBAL VARIABLES
+*/
+
+// local and I/O APIC addresses
+static uint32_t _lapic;
+static uint32_t _ioapic;
+
+/*
+** PUBLIC GLOBAL VARIABLES
+*/
+
+cpu_t _cpus[SMP_MAX_CPUS];
+uint32_t _ncpus;
+
+/*
+** PRIVATE FUNCTIONS
+*/
+
+/**
+** _lapic_read(reg) - read a local APIC register
+*/
+static uint32_t _lapic_read( uint32_t reg ) {
+    return( *(volatile uint32_t *) (_lapic + reg) );
+}
+
+/**
+** _sum(p,len) - byte checksum used by both ACPI and MP tables
+**
+** @return 0 if the structure is valid
+*/
+static uint8_t _sum( const void *p, uint32_t len ) {
+    const uint8_t *bp = p;
+    uint8_t sum = 0;
+
+    while( len-- ) {
+        sum += *bp++;
+    }
+
+    return( sum );
+}
+
+/**
+** _match(p,sig,len) - compare a table signature
+**
+** @return true if the first 'len' bytes at p match sig
+*/
+static bool_t _match( const void *p, const char *sig, uint32_t len ) {
+    const char *cp = p;
+
+    while( len-- ) {
+        if( *cp++ != *sig++ ) {
+            return( false );
+        }
+    }
+
+    return( true );
+}
+
+/**
+** _scan(base,len,sig,siglen,csumlen) - look for a firmware structure
+**
+** The structure begins on a 16-byte boundary with the given
+** signature, and the first 'csumlen' bytes sum to zero
+**
+** @return Its address, or 0
+*/
+static uint32_t _scan( uint32_t base, uint32_t len, const char *sig,
+                       uint32_t siglen, uint32_t csumlen ) {
+
+    for( uint32_t p = base; p + csumlen <= base + len; p += 16 ) {
+        if( _match((void *) p, sig, siglen) &&
+                _sum((void *) p, csumlen) == 0 ) {
+            return( p );
+        }
+    }
+
+    return( 0 );
+}
+
+/**
+** _cpu_add(apic,bsp) - record a processor
+*/
+static void _cpu_add( uint8_t apic, bool_t bsp ) {
+
+    if( _ncpus >= SMP_MAX_CPUS ) {
+        return;
+    }
+
+    _cpus[_ncpus].apic_id = apic;
+    _cpus[_ncpus].bsp = bsp;
+    ++_ncpus;
+}
+
+/**
+** _acpi_find() - get the processors from the ACPI MADT
+**
+** @return true if the MADT was found, else false
+*/
+static bool_t _acpi_find( void ) {
+    uint32_t ebda = ((uint32_t) *(uint16_t *) BDA_EBDA) << 4;
+    uint32_t bsp_id = 0;
+    uint32_t p;
+
+    p = _scan( ebda, 1024, "RSD PTR ", 8, sizeof(rsdp_t) );
+    if( p == 0 ) {
+        p = _scan( BIOS_ROM, BIOS_ROM_LEN, "RSD PTR ", 8, sizeof(rsdp_t) );
+    }
+    if( p == 0 ) {
+        return( false );
+    }
+
+    // the RSDT is a header followed by 32-bit table addresses
+    sdt_t *rsdt = (sdt_t *) ((rsdp_t *) p)->rsdt;
+    if( !_match(rsdt->sig, "RSDT", 4) ||
+            _sum(rsdt, rsdt->length) != 0 ) {
+        return( false );
+    }
+
+    uint32_t *tables = (uint32_t *) (rsdt + 1);
+    uint32_t n = (rsdt->length - sizeof(sdt_t)) / sizeof(uint32_t);
+    sdt_t *madt = NULL;
+
+    for( uint32_t i = 0; i < n; ++i ) {
+        sdt_t *t = (sdt_t *) tables[i];
+        if( _match(t->sig, "APIC", 4) && _sum(t, t->length) == 0 ) {
+            madt = t;
+            break;
+        }
+    }
+    if( madt == NULL ) {
+        return( false );
+    }
+
+    // the MADT header is followed by the local APIC address and
+    // a flags word, and then by variable-length entries
+    uint8_t *bp = (uint8_t *) (madt + 1);
+    uint8_t *end = ((uint8_t *) madt) + madt->length;
+
+    _lapic = *(uint32_t *) bp;
+    bp += 8;
+
+    // the firmware lists the bootstrap processor first, but
+    // asking the hardware is more reliable
+    bsp_id = _lapic_read( LAPIC_ID ) >> 24;
+
+    while( bp + 2 <= end && bp[1] >= 2 ) {
+        switch( bp[0] ) {
+
+        case MADT_LAPIC:    // ACPI id, APIC id, flags (bit 0: enabled)
+            if( (*(uint32_t *) (bp + 4)) & 1 ) {
+                _cpu_add( bp[3], bp[3] == bsp_id );
+            }
+            break;
+
+        case MADT_IOAPIC:   // id, reserved, address, GSI base
+            if( _ioapic == 0 ) {
+                _ioapic = *(uint32_t *) (bp + 4);
+            }
+            break;
+        }
+        bp += bp[1];
+    }
+
+    return( _ncpus > 0 );
+}
+
+/**
+** _mp_find() - get the processors from the MP specification tables
+**
+** @return true if the tables were found, else false
+*/
+static bool_t _mp_find( void ) {
+    uint32_t ebda = ((uint32_t) *(uint16_t *) BDA_EBDA) << 4;
+    uint32_t p;
+
+    p = _scan( ebda, 1024, "_MP_", 4, sizeof(mpfp_t) );
+    if( p == 0 ) {
+        p = _scan( BASE_MEM_TOP, 1024, "_MP_", 4, sizeof(mpfp_t) );
+    }
+    if( p == 0 ) {
+        p = _scan( BIOS_ROM, BIOS_ROM_LEN, "_MP_", 4, sizeof(mpfp_t) );
+    }
+    if( p == 0 || ((mpfp_t *) p)->config == 0 ) {
+        // no table, or one of the "default configurations", which
+        // have no configuration table; we treat those as uniprocessor
+        return( false );
+    }
+
+    mpct_t *ct = (mpct_t *) ((mpfp_t *) p)->config;
+    if( !_match(ct->sig, "PCMP", 4) || _sum(ct, ct->length) != 0 ) {
+        return( false );
+    }
+
+    _lapic = ct->lapic;
+
+    // processor entries are 20 bytes long; all the others are 8
+    uint8_t *bp = (uint8_t *) (ct + 1);
+
+    for( uint32_t i = 0; i < ct->count; ++i ) {
+        switch( bp[0] ) {
+
+        case MP_PROC:       // APIC id, version, flags
+            if( bp[3] & MP_PROC_EN ) {
+                _cpu_add( bp[1], (bp[3] & MP_PROC_BSP) != 0 );
+            }
+            bp += 20;
+            break;
+
+        case MP_IOAPIC:     // id, version, flags, address
+            if( _ioapic == 0 ) {
+                _ioapic = *(uint32_t *) (bp + 4);
+            }
+            bp += 8;
+            break;
+
+        default:
+            bp += 8;
+        }
+    }
+
+    return( _ncpus > 0 );
+}
+
+/*
+** PUBLIC FUNCTIONS
+*/
+
+/**
+** _smp_init()
+**
+** Find the processors from the ACPI MADT (or the older MP tables)
+*/
+void _smp_init( void ) {
+
+    __cio_puts( " SMP:" );
+
+    _ncpus = 0;
+    _lapic = LAPIC_DEFAULT;
+    _ioapic = 0;
+
+    if( !_acpi_find() && !_mp_find() ) {
+        // no tables - a plain uniprocessor
+        _ncpus = 0;
+        _cpu_add( 0, true );
+    }
+
+    __cio_printf( " %d CPU%s", _ncpus, _ncpus == 1 ? "" : "s" );
+}
+
+/**
+** _smp_cpu()
+**
+** Figure out which processor we are running on
+**
+** @return Index of this processor in _cpus[]
+*/
+uint32_t _smp_cpu( void ) {
+
+    if( _ncpus <= 1 ) {
+        return( 0 );
+    }
+
+    uint8_t id = _lapic_read( LAPIC_ID ) >> 24;
+
+    for( uint32_t i = 0; i < _ncpus; ++i ) {
+        if( _cpus[i].apic_id == id ) {
+            return( i );
+        }
+    }
+
+    return( 0 );
+}
@@ -0,0 +1,75 @@
+/**
+** @file smp.h
+**
+** @author CSCI-452 class of 20205
+**
+** Processor discovery declarations
+*/
+
+#ifndef SMP_H_
+#define SMP_H_
+
+/*
+** General (C and/or assembly) definitions
+*/
+
+// most processors we will keep track of
+#define SMP_MAX_CPUS    8
+
+// local APIC base address, unless the firmware tables say otherwise
+#define LAPIC_DEFAULT   0xfee00000
+
+// local APIC register offsets
+#define LAPIC_ID        0x020
+
+#ifndef SP_ASM_SRC
+
+/*
+** Start of C-only definitions
+*/
+
+#include "common.h"
+
+/*
+** Types
+*/
+
+// one processor, as described by the firmware
+
+typedef struct cpu_s {
+    uint8_t apic_id;        // its local APIC ID
+    bool_t bsp;             // is this the bootstrap processor?
+} cpu_t;
+
+/*
+** Globals
+*/
+
+// the processors we know about
+extern cpu_t _cpus[SMP_MAX_CPUS];
+extern uint32_t _ncpus;
+
+/*
+** Prototypes
+*/
+
+/**
+** _smp_init()
+**
+** Find the processors from the ACPI MADT (or the older MP tables)
+*/
+void _smp_init( void );
+
+/**
+** _smp_cpu()
+**
+** Figure out which processor we are running on
+**
+** @return Index of this processor in _cpus[]
+*/
+uint32_t _smp_cpu( void );
+
+#endif
+/* SP_ASM_SRC */
+
+#endif
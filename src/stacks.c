@@ -11,6 +11,10 @@
 #include "common.h"
 
 #include "stacks.h"
+#include "lock.h"
+#include "process.h"
+#include "scheduler.h"
+#include "syscalls.h"
 
 /*
 ** PRIVATE DEFINITIONS
@@ -26,10 +30,11 @@
 
 // stack management
 //
-// our "free list" uses the first word in the stack
-// as a pointer to the next free stack
+// there is a "free list" for each stack size; each uses the
+// first word in the stack as a pointer to the next free stack
 
-static stack_t *_free_stacks;
+static stack_t *_free_stacks[STACK_MAX_PAGES + 1];
+static spinlock_t _stk_lock;
 
 /*
 ** PUBLIC GLOBAL VARIABLES
@@ -57,11 +62,14 @@ void _stk_init( void ) {
 
     __cio_puts( " Stacks:" );
 
-    // no preallocation here, so the initial free list is empty
-    _free_stacks = NULL;
+    // no preallocation here, so the initial free lists are empty
+    _spin_init( &_stk_lock, "stacks", LOCK_STACK );
+    for( int i = 0; i <= STACK_MAX_PAGES; ++i ) {
+        _free_stacks[i] = NULL;
+    }
 
     // allocate the first stack for the OS
-    _system_stack = _stk_alloc();
+    _system_stack = _stk_alloc( STACK_PAGES );
     assert( _system_stack != NULL );
 
     // set the initial ESP for the OS - it should point to the
@@ -76,68 +84,170 @@ void _stk_init( void ) {
 }
 
 /**
-** _stk_alloc() - allocate a stack
+** _stk_alloc(pages) - allocate a stack
+**
+** The stack is cleared, and its overflow guard is in place
+**
+** @param pages The size of the stack, in pages
 **
 ** @return a pointer to the allocated stack, or NULL
 */
-stack_t *_stk_alloc( void ) {
+stack_t *_stk_alloc( uint32_t pages ) {
     stack_t *new;
 
-    // see if there is an available stack
-    if( _free_stacks == NULL ) {
+    // sanity check!
+    if( pages == 0 || pages > STACK_MAX_PAGES ) {
+        return( NULL );
+    }
 
-        // none available - create a new one
-        new = (stack_t *) _km_page_alloc( STACK_PAGES );
+    // see if there is an available stack
+    uint32_t flags = _spin_lock_irqsave( &_stk_lock );
 
-    } else {
+    new = _free_stacks[pages];
+    if( new != NULL ) {
 
         // OK, we know that there is at least one free stack;
         // just take the first one from the list
-
-        new = _free_stacks;
-
+        //
         // unlink it by making its successor the new head of
         // the list.  this is strange, because GCC is weird
         // about doing something like
-        //     _free_stacks = (stack_t *) new[0];
+        //     _free_stacks[pages] = (stack_t *) new[0];
         // because 'new' is an array type
         //
-        _free_stacks = (stack_t *) ((uint32_t *)new)[0];
+        _free_stacks[pages] = (stack_t *) ((uint32_t *)new)[0];
 
-        // clear out the fields in this one just to be safe
-        __memclr( new, sizeof(stack_t) );
+    }
+
+    _spin_unlock_irqrestore( &_stk_lock, flags );
+
+    if( new == NULL ) {
+
+        // none available - create a new one
+        new = (stack_t *) _km_page_alloc( pages, KM_STACK );
+        if( new == NULL ) {
+            return( NULL );
+        }
 
     }
 
+    // clear it out, so that we can find its high-water mark later
+    __memclr( new, pages * PAGE_SIZE );
+
+    // put the guard in place
+    for( int i = 0; i < STACK_GUARD_WORDS; ++i ) {
+        ((uint32_t *)new)[i] = STACK_GUARD;
+    }
+
     // pass it back to the caller
     return( new );
 }
 
 /**
-** _stk_free() - return a stack to the free list
+** _stk_free(stk,pages) - return a stack to the free list
 **
 ** Deallocates the supplied stack
 **
 ** @param stk   The stack to be returned to the free list
+** @param pages The size of the stack, in pages
 */
-void _stk_free( stack_t *stk ) {
+void _stk_free( stack_t *stk, uint32_t pages ) {
 
     // sanity check!
     if( stk == NULL ) {
         return;
     }
 
+    assert1( pages > 0 && pages <= STACK_MAX_PAGES );
+
     // just stick this one at the front of the list
 
     // start by making its first word point to the
     // current head of the free list.  again, we have
     // to work around the "array type" issue here
 
-    ((uint32_t *)stk)[0] = (uint32_t) _free_stacks;
+    uint32_t flags = _spin_lock_irqsave( &_stk_lock );
+
+    ((uint32_t *)stk)[0] = (uint32_t) _free_stacks[pages];
 
     // now, this one is the new head of the list
 
-    _free_stacks = stk;
+    _free_stacks[pages] = stk;
+
+    _spin_unlock_irqrestore( &_stk_lock, flags );
+}
+
+/**
+** _stk_intact(stk) - check the overflow guard of a stack
+**
+** @param stk   The stack
+**
+** @return true if the guard is intact, else false
+*/
+bool_t _stk_intact( stack_t *stk ) {
+
+    for( int i = 0; i < STACK_GUARD_WORDS; ++i ) {
+        if( ((uint32_t *)stk)[i] != STACK_GUARD ) {
+            return( false );
+        }
+    }
+
+    return( true );
+}
+
+/**
+** _stk_used(stk,pages) - find the high-water mark of a stack
+**
+** Stacks start out cleared, so this is the distance from the end of
+** the stack to the lowest non-zero longword above the guard.  (It will
+** be a little low if the deepest longwords used were all zero.)
+**
+** @param stk   The stack
+** @param pages The size of the stack, in pages
+**
+** @return The number of bytes of the stack which have been used
+*/
+uint32_t _stk_used( stack_t *stk, uint32_t pages ) {
+    uint32_t *sp = ((uint32_t *) stk) + STACK_GUARD_WORDS;
+    uint32_t *end = STACK_END( stk, pages );
+
+    while( sp < end && *sp == 0 ) {
+        ++sp;
+    }
+
+    return( (end - sp) * sizeof(uint32_t) );
+}
+
+/**
+** _stk_check(pcb) - check the overflow guard of a process' stack
+**
+** If the guard has been overwritten, the process is killed and another
+** one is dispatched; the idle process can't be killed, so an overflow
+** of its stack is a panic
+**
+** @param pcb   The current process
+**
+** @return true if the process was killed, else false
+*/
+bool_t _stk_check( pcb_t *pcb ) {
+
+    if( _stk_intact(pcb->stack) ) {
+        return( false );
+    }
+
+    __sprint( b256, "PID %d overflowed its %d-page stack",
+              pcb->pid, pcb->stkpages );
+
+    if( pcb == _idle ) {
+        _kpanic( "_stk_check", b256 );
+    }
+
+    WARNING( b256 );
+
+    _force_exit( pcb, Killed );
+    _dispatch();
+
+    return( true );
 }
 
 /*
@@ -149,13 +259,15 @@ void _stk_free( stack_t *stk ) {
 */
 
 /**
-** _stk_dump(msg,stk,lim)
+** _stk_dump(msg,stk,pages,lim)
 **
-** Dumps the contents of this stack to the console.  Assumes the stack
-** is a multiple of four words in length.
+** Dumps the contents of this stack to the console, along with its
+** high-water mark.  Assumes the stack is a multiple of four words
+** in length.
 **
 ** @param msg   An optional message to print before the dump
 ** @param s     The stack to dump out
+** @param pages The size of the stack, in pages
 ** @param lim   Limit on the number of words to dump (0 for all)
 */
 
@@ -163,8 +275,10 @@ void _stk_free( stack_t *stk ) {
 #define HBUFSZ      48
 #define CBUFSZ      24
 
-void _stk_dump( const char *msg, stack_t *stk, uint32_t limit ) {
-    int words = sizeof(stack_t) / sizeof(uint32_t);
+void _stk_dump( const char *msg, stack_t *stk, uint32_t pages,
+                uint32_t limit ) {
+    int total = pages * (PAGE_SIZE / sizeof(uint32_t));
+    int words = total;
     int eliding = 0;
     char oldbuf[HBUFSZ], buf[HBUFSZ], cbuf[CBUFSZ];
     uint32_t addr = (uint32_t ) stk;
@@ -180,16 +294,16 @@ void _stk_dump( const char *msg, stack_t *stk, uint32_t limit ) {
             words = (words & 0xfffffffc) + 4;
         }
         // skip to the new starting point
-        sp += (STACK_WORDS - words);
+        sp += (total - words);
         addr = (uint32_t) sp;
     }
 
     __cio_puts( "*** stack" );
     if( msg != NULL ) {
-        __cio_printf( " (%s):\n", msg );
-    } else {
-        __cio_puts( ":\n" );
+        __cio_printf( " (%s)", msg );
     }
+    __cio_printf( ": used %d of %d bytes%s\n", _stk_used(stk,pages),
+                  pages * PAGE_SIZE, _stk_intact(stk) ? "" : ", OVERFLOWED" );
 
     /**
     ** Output lines begin with the 8-digit address, followed by a hex
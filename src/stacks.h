@@ -29,12 +29,28 @@
 //
 // for simplicity, our stack is a multiple of the page size
 
-// number of pages in a stack
+// number of pages in a stack, unless a process asks for another size
 #define STACK_PAGES      4
 
+// the largest stack a process may ask for
+#define STACK_MAX_PAGES  16
+
 #define STACK_SIZE      (PAGE_SIZE * STACK_PAGES)
 #define STACK_WORDS     (STACK_SIZE / sizeof(uint32_t))
 
+// pointer to the longword just past the end of a stack of 'n' pages
+#define STACK_END(stk,n)    (((uint32_t *)(stk)) + \
+                             (n) * (PAGE_SIZE / sizeof(uint32_t)))
+
+// overflow guard
+//
+// without paging we can't put an unmapped page below each stack, so
+// instead the lowest few longwords hold a known pattern; if that has
+// changed, the stack has overflowed into whatever lies below it
+
+#define STACK_GUARD_WORDS   4
+#define STACK_GUARD         0xdeadbeef
+
 /*
 ** Types
 */
@@ -42,6 +58,10 @@
 // the stack
 //
 // somewhat anticlimactic....
+//
+// this is the default size; a stack with some other number of pages
+// is still referenced through a stack_t pointer, and its size is
+// passed along separately
 
 typedef uint32_t stack_t[STACK_WORDS];
 
@@ -53,6 +73,9 @@ typedef uint32_t stack_t[STACK_WORDS];
 ** Prototypes
 */
 
+// the process module includes us, so we can't include it here
+struct pcb_s;
+
 /**
 ** _stk_init() - initialize the stack module
 **
@@ -66,34 +89,78 @@ typedef uint32_t stack_t[STACK_WORDS];
 void _stk_init( void );
 
 /**
-** _stk_alloc() - allocate a stack
+** _stk_alloc(pages) - allocate a stack
+**
+** The stack is cleared, and its overflow guard is in place
+**
+** @param pages The size of the stack, in pages
 **
 ** @return pointer to the allocated stack, or NULL
 */
-stack_t *_stk_alloc( void );
+stack_t *_stk_alloc( uint32_t pages );
 
 /**
-** _stk_free() - free a stack
+** _stk_free(stk,pages) - free a stack
 **
 ** @param stk   The stack to be returned to the free list
+** @param pages The size of the stack, in pages
+*/
+void _stk_free( stack_t *stk, uint32_t pages );
+
+/**
+** _stk_intact(stk) - check the overflow guard of a stack
+**
+** @param stk   The stack
+**
+** @return true if the guard is intact, else false
+*/
+bool_t _stk_intact( stack_t *stk );
+
+/**
+** _stk_check(pcb) - check the overflow guard of a process' stack
+**
+** If the guard has been overwritten, the process is killed and another
+** one is dispatched; the idle process can't be killed, so an overflow
+** of its stack is a panic
+**
+** @param pcb   The current process
+**
+** @return true if the process was killed, else false
+*/
+bool_t _stk_check( struct pcb_s *pcb );
+
+/**
+** _stk_used(stk,pages) - find the high-water mark of a stack
+**
+** Stacks start out cleared, so this is the distance from the end of
+** the stack to the lowest non-zero longword above the guard.  (It will
+** be a little low if the deepest longwords used were all zero.)
+**
+** @param stk   The stack
+** @param pages The size of the stack, in pages
+**
+** @return The number of bytes of the stack which have been used
 */
-void _stk_free( stack_t *stk );
+uint32_t _stk_used( stack_t *stk, uint32_t pages );
 
 /*
 ** Debugging/tracing routines
 */
 
 /**
-** _stk_dump(msg,stk,lim)
+** _stk_dump(msg,stk,pages,lim)
 **
-** Dumps the contents of this stack to the console.  Assumes the stack
-** is a multiple of four words in length.
+** Dumps the contents of this stack to the console, along with its
+** high-water mark.  Assumes the stack is a multiple of four words
+** in length.
 **
 ** @param msg   An optional message to print before the dump
 ** @param stk   The stack to dump out
+** @param pages The size of the stack, in pages
 ** @param lim   Limit on the number of words to dump (0 for all)
 */
-void _stk_dump( const char *msg, register stack_t *stk, uint32_t lim );
+void _stk_dump( const char *msg, register stack_t *stk, uint32_t pages,
+                uint32_t lim );
 
 #endif
 
@@ -24,6 +24,7 @@
 #include "clock.h"
 #include "cio.h"
 #include "sio.h"
+#include "vdata.h"
 
 #include "fs.h"
 #include "kfs.h"
@@ -36,10 +37,35 @@ extern void exit_helper( void );
 */
 static int _sys_seekFile( const char* path, inode_id_t * currentDir);
 
+// wait_on() queues; a power of two, so the hash is just a mask
+#define FUTEX_BUCKETS   16
+#define FUTEX_HASH(a)   ((((uint32_t) (a)) >> 2) & (FUTEX_BUCKETS - 1))
+
+// aread() and awrite() requests, in flight or awaiting collection,
+// across the whole system
+#define AIO_MAX_REQS    32
+
 /*
 ** PRIVATE DATA TYPES
 */
 
+// one aread() or awrite() request
+//
+// a request is queued until the I/O worker has run it, then held
+// until its owner collects the result with await()
+
+typedef struct aioreq_s {
+    pcb_t *owner;               // requesting process (NULL if free)
+    uint32_t token;             // its name for the request
+    bool_t write;               // awrite() (vs. aread())?
+    bool_t done;                // has the worker run it?
+    fd_t fd;                    // the file, at the requested offset
+    char *buf;                  // the caller's buffer
+    uint32_t len;               // bytes to transfer
+    int32_t result;             // what read() or write() would return
+    struct aioreq_s *next;      // next queued request
+} aioreq_t;
+
 /*
 ** PRIVATE GLOBAL VARIABLES
 */
@@ -51,14 +77,61 @@ static int _sys_seekFile( const char* path, inode_id_t * currentDir);
 
 static void (*_syscalls[N_SYSCALLS])( uint32_t args[] );
 
+// processes blocked in wait_on(), hashed by address; each one's
+// event.other holds the address it is waiting on
+static pcbq_t _futex[FUTEX_BUCKETS];
+
+// the requests, and the queue of those not yet run (oldest first)
+static aioreq_t _aio_reqs[AIO_MAX_REQS];
+static aioreq_t *_aio_head;
+static aioreq_t *_aio_tail;
+
+// processes blocked in await() without a timeout; those with one
+// sleep on the timing wheel instead
+static pcbq_t _aio_waiting;
+
+// is the I/O worker blocked for want of requests?
+static bool_t _aio_idle;
+
 /*
 ** PUBLIC GLOBAL VARIABLES
 */
 
+// the process which runs aread() and awrite() requests
+pcb_t *_aio_worker;
+
 /*
 ** PRIVATE FUNCTIONS
 */
 
+/**
+** Name:  _sys_call
+**
+** Validate a system call code and run its handler
+**
+** @param syscode   The code
+** @param args      The arguments
+*/
+static void _sys_call( uint32_t syscode, uint32_t args[4] ) {
+
+    // validate the code
+    if( syscode >= N_SYSCALLS ) {
+        // uh-oh....
+        __sprint( b256, "PID %d bad syscall %d", _current->pid, syscode );
+        WARNING( b256 );
+        // force a call to exit()
+        syscode = SYS_exit;
+        args[0] = E_BAD_SYSCALL;
+    }
+
+    // whatever this is, the process isn't in an await() which
+    // timed out any more
+    _current->awaiting = false;
+
+    // handle the system call
+    _syscalls[syscode]( args );
+}
+
 /**
 ** Name:  _sys_isr
 **
@@ -75,6 +148,13 @@ static void _sys_isr( int vector, int code ) {
     // much less likely to occur, but still potentially problematic
     assert2( _current->context != NULL );
 
+    // a process which has run off the end of its stack doesn't
+    // get to make any more requests
+    if( _stk_check(_current) ) {
+        __outb( PIC_PRI_CMD_PORT, PIC_EOI );
+        return;
+    }
+
     // retrieve the arguments to the system call
     // (even if they aren't needed)
     uint32_t args[4];
@@ -83,24 +163,261 @@ static void _sys_isr( int vector, int code ) {
     args[2] = ARG( _current, 3 );
     args[3] = ARG( _current, 4 );
 
-    // retrieve the code
-    uint32_t syscode = REG( _current, eax );
+    // retrieve the code, and handle the system call
+    _sys_call( REG(_current,eax), args );
 
-    // validate the code
-    if( syscode >= N_SYSCALLS ) {
-        // uh-oh....
-        __sprint( b256, "PID %d bad syscall %d", _current->pid, syscode );
-        WARNING( b256 );
-        // force a call to exit()
-        syscode = SYS_exit;
-        args[0] = E_BAD_SYSCALL;
+    // tell the PIC we're done
+    __outb( PIC_PRI_CMD_PORT, PIC_EOI );
+}
+
+/**
+** _sys_lockNode - lock an inode for the current syscall
+**
+** On failure the error is returned to the process.  (No lock is held
+** across a dispatch, so it is never busy; see kfs.h.)
+**
+** @param id      The inode to lock
+** @param write   True for a write lock, false for a read lock
+**
+** @return E_SUCCESS if the lock is held, else the syscall should
+**         return immediately
+*/
+static int _sys_lockNode( inode_id_t id, bool_t write ) {
+    int ret = _fs_lock( id, write, _current );
+
+    if( ret < 0 ) {
+        RET(_current) = ret;
     }
 
-    // handle the system call
-    _syscalls[syscode]( args );
+    return( ret );
+}
 
-    // tell the PIC we're done
-    __outb( PIC_PRI_CMD_PORT, PIC_EOI );
+/**
+** _futex_cancel - take a killed process out of wait_on()
+**
+** @param pcb   A Blocked process
+**
+** @return true if it was blocked in wait_on(), else false
+*/
+static bool_t _futex_cancel( pcb_t *pcb ) {
+
+    if( pcb->queue < &_futex[0] || pcb->queue >= &_futex[FUTEX_BUCKETS] ) {
+        return( false );
+    }
+
+    _pcbq_remove( pcb );
+    return( true );
+}
+
+/**
+** _aio_collect - collect finished requests for an await()
+**
+** Each entry gets its request's result, or E_AGAIN if the request
+** is still queued, or E_NOT_FOUND if there is no such request.
+** Collected requests are freed.
+**
+** @param pcb      The process doing the await()
+** @param ev       Its tokens
+** @param n        How many there are
+** @param pending  If not NULL, where to put the number still queued
+**
+** @return The number of requests collected
+*/
+static uint32_t _aio_collect( pcb_t *pcb, aio_t *ev, uint32_t n,
+                              uint32_t *pending ) {
+    uint32_t found = 0;
+    uint32_t queued = 0;
+
+    for( uint32_t i = 0; i < n; ++i ) {
+        aioreq_t *req = NULL;
+
+        for( int j = 0; j < AIO_MAX_REQS; ++j ) {
+            if( _aio_reqs[j].owner == pcb &&
+                _aio_reqs[j].token == ev[i].token ) {
+                req = &_aio_reqs[j];
+                break;
+            }
+        }
+
+        if( req == NULL ) {
+            ev[i].result = E_NOT_FOUND;
+        } else if( !req->done ) {
+            ev[i].result = E_AGAIN;
+            ++queued;
+        } else {
+            ev[i].result = req->result;
+            req->owner = NULL;
+            ++found;
+        }
+    }
+
+    if( pending != NULL ) {
+        *pending = queued;
+    }
+
+    return( found );
+}
+
+/**
+** _aio_notify - tell a process that one of its requests has finished
+**
+** If it is in await() for that request, it collects the result and
+** is rescheduled; otherwise, the result waits for its next await().
+**
+** @param pcb   The request's owner
+*/
+static void _aio_notify( pcb_t *pcb ) {
+
+    // once an await() times out, the process is Ready (or Running)
+    // until its next system call clears the flag (see _sys_call())
+    if( !pcb->awaiting ||
+        (pcb->state != Blocked && pcb->state != Sleeping) ) {
+        return;
+    }
+
+    uint32_t n = _aio_collect( pcb, (aio_t *) ARG(pcb,1), ARG(pcb,2), NULL );
+    if( n == 0 ) {
+        // not one it is waiting for
+        return;
+    }
+
+    if( pcb->state == Blocked ) {
+        _pcbq_remove( pcb );
+    } else {
+        _clk_cancel( pcb );
+    }
+
+    pcb->awaiting = false;
+    RET(pcb) = n;
+    _schedule( pcb );
+}
+
+/**
+** _aio_cancel - take a killed process out of await()
+**
+** @param pcb   A Blocked process
+**
+** @return true if it was blocked in await(), else false
+*/
+static bool_t _aio_cancel( pcb_t *pcb ) {
+
+    if( !pcb->awaiting ) {
+        return( false );
+    }
+
+    _pcbq_remove( pcb );
+    return( true );
+}
+
+/**
+** _aio_release - drop all of an exiting process' requests
+**
+** Queued requests are taken off the queue, so the worker never
+** touches the process' buffers once it is gone.
+**
+** @param pcb   The process
+*/
+static void _aio_release( pcb_t *pcb ) {
+    aioreq_t *prev = NULL;
+
+    for( aioreq_t *req = _aio_head; req != NULL; req = req->next ) {
+        if( req->owner != pcb ) {
+            prev = req;
+            continue;
+        }
+        if( prev == NULL ) {
+            _aio_head = req->next;
+        } else {
+            prev->next = req->next;
+        }
+        if( _aio_tail == req ) {
+            _aio_tail = prev;
+        }
+    }
+
+    for( int i = 0; i < AIO_MAX_REQS; ++i ) {
+        if( _aio_reqs[i].owner == pcb ) {
+            _aio_reqs[i].owner = NULL;
+        }
+    }
+}
+
+/**
+** _aio_submit - do the real work for aread() and awrite()
+**
+** The permissions are checked now, with the caller's credentials;
+** the worker only does the transfer.
+**
+** @param args   The channel, buffer, length, and file offset
+** @param write  True for awrite(), false for aread()
+*/
+static void _aio_submit( uint32_t args[4], bool_t write ) {
+    uint32_t chan = args[0];
+    uint32_t token = ARG(_current,5);  // doesn't fit in args[]
+    aioreq_t *req = NULL;
+
+    // files only; the console and SIO have their own ways to wait
+    if( chan < 2 || chan >= 2 + MAX_OPEN_FILES ) {
+        RET(_current) = E_BAD_CHANNEL;
+        return;
+    }
+
+    fd_t * fd = &_current->share->files[chan - 2];
+    if(fd->inode_id.devID == 0 && fd->inode_id.idx == 0) {    // Blank fd_t
+        RET(_current) = E_BAD_CHANNEL;
+        return;
+    }
+
+    bool_t canRead, canWrite;
+    int ret = _fs_getPermission(fd->inode_id, _current->share->uid, _current->share->gid, &canRead, &canWrite, NULL);
+    if(ret < 0 || !(write ? canWrite : canRead)) {
+        RET(_current) = E_NO_PERMISSION;
+        return;
+    }
+
+    // tokens must be unique among this process' requests
+    for( int i = 0; i < AIO_MAX_REQS; ++i ) {
+        if( _aio_reqs[i].owner == _current ) {
+            if( _aio_reqs[i].token == token ) {
+                RET(_current) = E_BAD_PARAM;
+                return;
+            }
+        } else if( _aio_reqs[i].owner == NULL && req == NULL ) {
+            req = &_aio_reqs[i];
+        }
+    }
+
+    if( req == NULL ) {
+        RET(_current) = E_BUSY;
+        return;
+    }
+
+    req->owner = _current;
+    req->token = token;
+    req->write = write;
+    req->done = false;
+    req->fd.inode_id = fd->inode_id;
+    req->fd.offset = args[3];      // writes append (see _sys_aio_serve())
+    req->fd.view = 0;
+    req->buf = (char *) args[1];
+    req->len = args[2];
+    req->next = NULL;
+
+    if( _aio_head == NULL ) {
+        _aio_head = req;
+    } else {
+        _aio_tail->next = req;
+    }
+    _aio_tail = req;
+
+    // the worker runs at System priority, so it gets the request as
+    // soon as this process blocks or uses up its quantum
+    if( _aio_idle ) {
+        _aio_idle = false;
+        _schedule( _aio_worker );
+    }
+
+    RET(_current) = E_SUCCESS;
 }
 
 /**
@@ -170,7 +487,7 @@ static void _sys_read( uint32_t args[4] ) {
         }
 
         // File channel
-        fd_t * fd = &_current->files[chan - 2];
+        fd_t * fd = &_current->share->files[chan - 2];
         if(fd->inode_id.devID == 0 && fd->inode_id.idx == 0) {    // Blank fd_t
             RET(_current) = E_BAD_CHANNEL;  // Can't read from a blank fd
             return;
@@ -178,7 +495,7 @@ static void _sys_read( uint32_t args[4] ) {
 
         // Check that you have read permissions
         bool_t canRead;
-        int ret = _fs_getPermission(fd->inode_id, _current->uid, _current->gid, &canRead, NULL, NULL);
+        int ret = _fs_getPermission(fd->inode_id, _current->share->uid, _current->share->gid, &canRead, NULL, NULL);
         if(ret < 0) {
             __cio_printf("*ERROR* in _sys_read: Failed to read file %d.%d's permissions (%d)\n", fd->inode_id.devID, fd->inode_id.idx, ret);
             RET(_current) = E_NO_PERMISSION;
@@ -189,7 +506,13 @@ static void _sys_read( uint32_t args[4] ) {
             return;
         }
 
+        // Shared with other readers, but not with a writer
+        if(_sys_lockNode(fd->inode_id, false) < 0) {
+            return;
+        }
+
         n = _fs_read(fd, buf, length); // Read from file
+        _fs_unlock(fd->inode_id, false);
     }
 
     // if there was data (or EOF), return the byte count to the process;
@@ -202,9 +525,10 @@ static void _sys_read( uint32_t args[4] ) {
 
         // mark it as blocked
         _current->state = Blocked;
+        _sched_boost( _current );
 
         // put it on the SIO input queue
-        assert( _que_enque(_reading,_current,0) == E_SUCCESS );
+        _pcbq_enque( &_reading, _current, 0 );
 
         // select a new current process
         _dispatch();
@@ -243,7 +567,7 @@ static void _sys_write( uint32_t args[4] ) {
         }
 
         // File channel
-        fd_t * fd = &_current->files[chan - 2];
+        fd_t * fd = &_current->share->files[chan - 2];
         if(fd->inode_id.devID == 0 && fd->inode_id.idx == 0) {    // Blank fd_t
             RET(_current) = E_BAD_CHANNEL;  // Can't write to a blank fd
             return;
@@ -251,7 +575,7 @@ static void _sys_write( uint32_t args[4] ) {
         
         // Check that you have read permissions
         bool_t canWrite;
-        ret = _fs_getPermission(fd->inode_id, _current->uid, _current->gid, NULL, &canWrite, NULL);
+        ret = _fs_getPermission(fd->inode_id, _current->share->uid, _current->share->gid, NULL, &canWrite, NULL);
         if(ret < 0) {
             __cio_printf("*ERROR* in _sys_write: Failed to read file %d.%d's permissions (%d)\n", fd->inode_id.devID, fd->inode_id.idx, ret);
             RET(_current) = E_NO_PERMISSION;
@@ -262,7 +586,12 @@ static void _sys_write( uint32_t args[4] ) {
             return;
         }
 
+        if(_sys_lockNode(fd->inode_id, true) < 0) {
+            return;
+        }
+
         ret = _fs_write(fd, buf, length); // write to file
+        _fs_unlock(fd->inode_id, true);
     }
 
     RET(_current) = ret; // Return proper status
@@ -321,6 +650,7 @@ static void _sys_setprio( uint32_t args[4] ) {
     } else {
         RET(_current) = _current->priority;
         _current->priority = args[0];
+        _current->level = args[0];
     }
 }
 
@@ -349,7 +679,7 @@ static void _sys_kill( uint32_t args[4] ) {
     }
     
     // Can only kill your own procs (unless root or sudo)
-    if(!(_current->uid == UID_ROOT || _current->gid == GID_SUDO) && _current->uid != pcb->uid) {
+    if(!(_current->share->uid == UID_ROOT || _current->share->gid == GID_SUDO) && _current->share->uid != pcb->share->uid) {
         RET(_current) = E_NO_PERMISSION;
         return;
     }
@@ -358,14 +688,33 @@ static void _sys_kill( uint32_t args[4] ) {
     // how we process the victim depends on its current state:
     switch( pcb->state ) {
     
-        // for the first three of these states, the process is on
-        // a queue somewhere; just mark it as 'Killed', and when it
-        // comes off that queue via _schedule() or _dispatch() we
-        // will clean it up
+        // Ready and Sleeping processes hold nothing but their queue
+        // link, so we unlink them and clean them up right away
+
+    case Ready:
+        _sched_remove( pcb );
+        _force_exit( pcb, Killed );
+        RET(_current) = E_SUCCESS;
+        break;
 
-    case Ready:    // FALL THROUGH
-    case Blocked:  // FALL THROUGH
     case Sleeping:
+        _clk_cancel( pcb );
+        _force_exit( pcb, Killed );
+        RET(_current) = E_SUCCESS;
+        break;
+
+        // a Blocked process may be in the middle of something (e.g.,
+        // a splice to the SIO) that only its wakeup path knows how
+        // to finish; mark it as 'Killed', and when that path hands
+        // it to _schedule() we will clean it up
+
+    case Blocked:
+        // except that wait_on() and await() hold nothing at all
+        if( _futex_cancel(pcb) || _aio_cancel(pcb) ) {
+            _force_exit( pcb, Killed );
+            RET(_current) = E_SUCCESS;
+            break;
+        }
         pcb->state = Killed;
         // FALL THROUGH
 
@@ -423,20 +772,91 @@ static void _sys_sleep( uint32_t args[4] ) {
         // process is actually going to sleep - calculate wakeup time
         _current->event.wakeup = _system_time + ticks;
         _current->state = Sleeping;
+        _sched_boost( _current );
 
         // add to the sleep queue
-        if( _que_enque(_sleeping,_current,_current->event.wakeup) !=
-                E_SUCCESS ) {
-            // something went wrong!
-            WARNING( "cannot enque(_sleeping,_current)" );
-            _schedule( _current );
-        }
+        _clk_sleep( _current );
     }
 
     // either way, need a new "current" process
     _dispatch();
 }
 
+/**
+** _sys_nanosleep - put the current process to sleep for some number
+**                  of nanoseconds
+**
+** implements:
+**    void nanosleep( uint64_t ns );
+*/
+static void _sys_nanosleep( uint32_t args[4] ) {
+    uint64_t ns = ((uint64_t) args[1] << 32) | args[0];
+
+    if( ns == 0 ) {
+
+        // just yielding, as with sleep(0)
+        _schedule( _current );
+
+    } else {
+
+        _current->state = Sleeping;
+        _sched_boost( _current );
+
+        // on the wheel, then a one-shot for the part of a tick
+        _clk_nsleep( _current, _clk_ns() + ns );
+    }
+
+    _dispatch();
+}
+
+/**
+** _spawn - do the real work for spawn() and spawn_stack()
+**
+** @param args   The entry point, priority, and command-line arguments
+** @param pages  Stack size for the new process, in pages (0 for default)
+*/
+static void _spawn( uint32_t args[4], uint32_t pages ) {
+    pid_t pid;
+
+    // verify that there is an entry point
+    if( args[0] == NULL ) {
+        RET(_current) = E_BAD_PARAM;
+        return;
+    }
+
+    // and that the priority is legal
+    if( args[1] > PRIO_LOWEST ) {
+        RET(_current) = E_BAD_PARAM;
+        return;
+    }
+
+    // is there room for one more process in the system?
+    pid = _pid_alloc();
+    if( pid < 0 ) {
+        RET(_current) = E_NO_PROCS;
+        return;
+    }
+
+    // create the process
+    pcb_t *pcb = _proc_create( args, pid, _current->pid, 
+                                _current->share->uid, _current->share->gid, _current->share->wDir,
+                                pages );
+    if( pcb == NULL ) {
+        _pid_free( pid );
+        RET(_current) = E_NO_MEMORY;
+        return;
+    }
+
+    // the parent gets the PID of the child as its return value
+    RET(_current) = pcb->pid;  // parent
+    
+    // add the child to the "active process" table
+    _proc_add( pcb, _current );
+
+    // schedule the child
+    _schedule( pcb );
+}
+
 /**
 ** _sys_spawn - create a new process
 **
@@ -445,119 +865,488 @@ static void _sys_sleep( uint32_t args[4] ) {
 **                 prio_t prio, uint32_t arg1, uint32_t arg2 );
 */
 static void _sys_spawn( uint32_t args[4] ) {
-    
-    // is there room for one more process in the system?
-    if( _active_procs >= N_PROCS ) {
+
+    _spawn( args, 0 );
+}
+
+/**
+** _sys_spawn_stack - create a new process with a given stack size
+**
+** implements:
+**    pid_t spawn_stack( int (*entry)(uint32_t,uint32_t),
+**                       prio_t prio, uint32_t arg1, uint32_t arg2,
+**                       uint32_t size );
+*/
+static void _sys_spawn_stack( uint32_t args[4] ) {
+
+    // the size is the fifth argument, which _sys_isr() doesn't fetch
+    uint32_t size = ARG( _current, 5 );
+
+    // round it up to whole pages
+    uint32_t pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    if( pages > STACK_MAX_PAGES ) {
+        RET(_current) = E_BAD_PARAM;
+        return;
+    }
+
+    _spawn( args, pages );
+}
+
+/**
+** _wait_zombie - take a zombie child which wait() may collect
+**
+** Threads are left on the queue for thread_join()
+**
+** @param parent   The process which called wait()
+**
+** @return The zombie, or NULL if there isn't one
+*/
+static pcb_t *_wait_zombie( pcb_t *parent ) {
+    pcb_t *zombie = _pcbq_peek( &parent->zombies );
+
+    while( zombie != NULL && zombie->share == parent->share ) {
+        zombie = zombie->qnext;
+    }
+
+    if( zombie != NULL ) {
+        _pcbq_remove( zombie );
+    }
+
+    return( zombie );
+}
+
+/**
+** _wait_deliver - hand a terminated child to its waiting parent
+**
+** Completes the parent's wait() call and reclaims the child; the
+** caller is responsible for getting the parent running again
+**
+** @param parent   The process which called wait()
+** @param child    The terminated child
+*/
+static void _wait_deliver( pcb_t *parent, pcb_t *child ) {
+
+    // return the zombie's PID
+    RET(parent) = child->pid;
+
+    // see if the parent wants the termination status; wait() passes
+    // the pointer first, and thread_join() (which records the thread
+    // it is waiting for in event.other) second
+    int32_t *ptr = (int32_t *) ARG( parent, parent->event.other ? 2 : 1 );
+    if( ptr != NULL ) {
+        // yes - return it
+        // *****************************************************
+        // Potential VM issue here!  This code assigns the exit
+        // status into a variable in the parent's address space.  
+        // This works in the baseline because we aren't using
+        // any type of memory protection.  If address space
+        // separation is implemented, this code will very likely
+        // STOP WORKING, and will need to be fixed.
+        // *****************************************************
+        *ptr = child->exit_status;
+    }
+
+    // clean up the zombie now
+    _pcb_cleanup( child );
+}
+
+/**
+** _sys_wait - wait for a child process to terminate
+**
+** implements:
+**    pid_t wait( int32_t *status );
+*/
+static void _sys_wait( uint32_t args[4] ) {
+    pcb_t *zombie;
+
+    // any child will do
+    _current->event.other = NULL;
+
+    // case 1:  no children (threads don't count; they are
+    // collected with thread_join())
+
+    pcb_t *kid = _current->kids;
+    while( kid != NULL && kid->share == _current->share ) {
+        kid = kid->sibnext;
+    }
+
+    if( kid == NULL ) {
+        // return the bad news
         RET(_current) = E_NO_PROCS;
         return;
     }
 
+    // case 2:  children, but none are zombies
+
+    zombie = _wait_zombie( _current );
+    if( zombie == NULL ) {
+        // block this process until one of them terminates;
+        // _force_exit() will hand that child to us directly
+        _current->state = Waiting;
+        _dispatch();
+        return;
+    }
+
+    // case 3:  bingo!
+
+    _wait_deliver( _current, zombie );
+}
+
+/**
+** _sys_thread_spawn - create a new thread of this process
+**
+** implements:
+**    pid_t thread_spawn( int32_t (*entry)(void *), void *arg,
+**                        uint32_t size );
+*/
+static void _sys_thread_spawn( uint32_t args[4] ) {
+    pid_t pid;
+
     // verify that there is an entry point
     if( args[0] == NULL ) {
         RET(_current) = E_BAD_PARAM;
         return;
     }
 
-    // and that the priority is legal
-    if( args[1] > PRIO_LOWEST ) {
-        RET(_current) = E_BAD_PARAM;
+    // round the stack size up to whole pages
+    uint32_t pages = (args[2] + PAGE_SIZE - 1) / PAGE_SIZE;
+    if( pages > STACK_MAX_PAGES ) {
+        RET(_current) = E_BAD_PARAM;
+        return;
+    }
+
+    // threads take up process table slots, too
+    pid = _pid_alloc();
+    if( pid < 0 ) {
+        RET(_current) = E_NO_PROCS;
+        return;
+    }
+
+    pcb_t *pcb = _thread_create( _current, args[0], args[1], pid, pages );
+    if( pcb == NULL ) {
+        _pid_free( pid );
+        RET(_current) = E_NO_MEMORY;
+        return;
+    }
+
+    RET(_current) = pcb->pid;
+
+    // it's our child, so we (or init) will collect it
+    _proc_add( pcb, _current );
+
+    _schedule( pcb );
+}
+
+/**
+** _sys_thread_join - wait for a particular thread to terminate
+**
+** implements:
+**    pid_t thread_join( pid_t tid, int32_t *status );
+*/
+static void _sys_thread_join( uint32_t args[4] ) {
+    pcb_t *pcb = _pcb_find_pid( (pid_t) args[0] );
+
+    if( pcb == NULL || pcb->parent != _current ) {
+        RET(_current) = E_NO_CHILDREN;
+        return;
+    }
+
+    // child processes are collected with wait()
+    if( pcb->share != _current->share ) {
+        RET(_current) = E_BAD_PARAM;
+        return;
+    }
+
+    // _wait_deliver() and _force_exit() look for this
+    _current->event.other = pcb;
+
+    // already done?  take it off our zombie queue
+    if( pcb->state == Zombie ) {
+        _pcbq_remove( pcb );
+        _wait_deliver( _current, pcb );
+        return;
+    }
+
+    // block until _force_exit() hands it to us
+    _current->state = Waiting;
+    _dispatch();
+}
+
+/**
+** _sys_wait_on - block while a word in memory holds a given value
+**
+** System calls run with interrupts disabled, so nothing can change
+** the word between the check and the block.
+**
+** implements:
+**    int32_t wait_on( volatile uint32_t *addr, uint32_t val );
+*/
+static void _sys_wait_on( uint32_t args[4] ) {
+    volatile uint32_t *addr = (volatile uint32_t *) args[0];
+
+    if( addr == NULL || (args[0] & 3) != 0 ) {
+        RET(_current) = E_BAD_PARAM;
+        return;
+    }
+
+    if( *addr != args[1] ) {
+        RET(_current) = E_AGAIN;
+        return;
+    }
+
+    // this is what it will see once it is woken
+    RET(_current) = E_SUCCESS;
+
+    _current->state = Blocked;
+    _current->event.other = (void *) addr;
+    _pcbq_enque( &_futex[FUTEX_HASH(addr)], _current, 0 );
+
+    _dispatch();
+}
+
+/**
+** _sys_wake - wake processes blocked in wait_on()
+**
+** implements:
+**    int32_t wake( volatile uint32_t *addr, uint32_t n );
+*/
+static void _sys_wake( uint32_t args[4] ) {
+    void *addr = (void *) args[0];
+    pcbq_t *q = &_futex[FUTEX_HASH(addr)];
+    pcb_t *pcb, *next;
+    uint32_t woken = 0;
+
+    // the bucket may hold waiters for other addresses, too
+    for( pcb = q->head; pcb != NULL && woken < args[1]; pcb = next ) {
+        next = pcb->qnext;
+        if( pcb->event.other == addr ) {
+            _pcbq_remove( pcb );
+            _schedule( pcb );
+            ++woken;
+        }
+    }
+
+    RET(_current) = woken;
+}
+
+/**
+** _sys_ring_setup - register (or drop) this process' system call ring
+**
+** implements:
+**    int32_t ring_setup( ring_t *ring );
+*/
+static void _sys_ring_setup( uint32_t args[4] ) {
+    ring_t *ring = (ring_t *) args[0];
+
+    if( ((uint32_t) ring & 3) != 0 ) {
+        RET(_current) = E_BAD_PARAM;
+        return;
+    }
+
+    // both rings start out empty
+    if( ring != NULL ) {
+        ring->sq_head = ring->sq_tail = 0;
+        ring->cq_head = ring->cq_tail = 0;
+    }
+
+    _current->ring = ring;
+    RET(_current) = E_SUCCESS;
+}
+
+/**
+** _sys_submit - run the system calls queued on this process' ring
+**
+** Each call runs to completion before the next one starts, so all the
+** calls taken from the ring have completed when this returns, and
+** wait_min is met whenever that many were taken.
+**
+** None of the calls allowed on the ring can block, so they all run
+** in this one system call.
+**
+** implements:
+**    int32_t submit( uint32_t n, uint32_t wait_min );
+*/
+static void _sys_submit( uint32_t args[4] ) {
+    pcb_t *pcb = _current;
+    ring_t *ring = pcb->ring;
+    uint32_t n = args[0];
+    uint32_t done = 0;
+
+    if( ring == NULL || args[1] > n ) {
+        RET(pcb) = E_BAD_PARAM;
+        return;
+    }
+
+    // stop when the submissions run out, or there's no room to
+    // post another completion
+    while( done < n && ring->sq_head != ring->sq_tail &&
+           ring->cq_tail - ring->cq_head < RING_SIZE ) {
+
+        rsqe_t *sqe = &ring->sq[ring->sq_head & (RING_SIZE - 1)];
+        uint32_t xargs[4] = { sqe->args[0], sqe->args[1], sqe->args[2], 0 };
+        int32_t result;
+
+        switch( sqe->code ) {
+        case SYS_read:
+            // an SIO read (or an empty one) would block the process
+            // with its completion due to the submit() arguments
+            if( xargs[0] == CHAN_SIO || xargs[2] == 0 ) {
+                result = xargs[2] == 0 ? 0 : E_BAD_CHANNEL;
+                break;
+            }
+            // FALL THROUGH
+
+        case SYS_write:
+        case SYS_fopen:
+        case SYS_fclose:
+        case SYS_getinode:
+        case SYS_dirname:
+            _syscalls[sqe->code]( xargs );
+            assert( _current == pcb );
+            result = RET(pcb);
+            break;
+
+        default:
+            result = E_BAD_SYSCALL;
+        }
+
+        rcqe_t *cqe = &ring->cq[ring->cq_tail & (RING_SIZE - 1)];
+        cqe->tag = sqe->tag;
+        cqe->result = result;
+        ++ring->cq_tail;
+        ++ring->sq_head;
+        ++done;
+    }
+
+    RET(pcb) = done;
+}
+
+/**
+** _sys_aread - queue a read from a file
+**
+** implements:
+**    int32_t aread( int chan, void *buf, uint32_t len, uint32_t off,
+**                   uint32_t token );
+*/
+static void _sys_aread( uint32_t args[4] ) {
+    _aio_submit( args, false );
+}
+
+/**
+** _sys_awrite - queue a write to a file
+**
+** implements:
+**    int32_t awrite( int chan, const void *buf, uint32_t len, uint32_t off,
+**                    uint32_t token );
+*/
+static void _sys_awrite( uint32_t args[4] ) {
+    _aio_submit( args, true );
+}
+
+/**
+** _sys_await - collect the results of aread() and awrite() requests
+**
+** If none of the requests has finished, the process blocks (or, with
+** a timeout, sleeps) until the worker finishes one of them.  If the
+** timeout expires first, it sees a return value of 0.  Waiting
+** forever for requests which don't exist is an error.
+**
+** implements:
+**    int32_t await( aio_t *ev, uint32_t n, uint32_t timeout );
+*/
+static void _sys_await( uint32_t args[4] ) {
+    aio_t *ev = (aio_t *) args[0];
+    uint32_t n = args[1];
+    uint32_t timeout = args[2];
+
+    if( ev == NULL || n == 0 ) {
+        RET(_current) = E_BAD_PARAM;
+        return;
+    }
+
+    uint32_t pending;
+
+    RET(_current) = _aio_collect( _current, ev, n, &pending );
+    if( RET(_current) > 0 || timeout == 0 ) {
         return;
     }
 
-    // create the process
-    pcb_t *pcb = _proc_create( args, _next_pid++, _current->pid, 
-                                _current->uid, _current->gid, _current->wDir);
-    if( pcb == NULL ) {
-        RET(_current) = E_NO_MEMORY;
+    if( pending == 0 && timeout == AIO_FOREVER ) {
+        RET(_current) = E_NOT_FOUND;
         return;
     }
 
-    // the parent gets the PID of the child as its return value
-    RET(_current) = pcb->pid;  // parent
-    
-    // schedule the child
-    _schedule( pcb );
-    
-    // add the child to the "active process" table
-    ++_active_procs;
+    // nothing yet; _aio_notify() will deliver the results
+    _current->awaiting = true;
+    _sched_boost( _current );
 
-    // find an empty process table slot
-    int i;
-    for( i = 0; i < N_PROCS; ++i ) {
-        if( _ptable[i] == NULL ) {
-            break;
-        }
+    if( timeout == AIO_FOREVER ) {
+        _current->state = Blocked;
+        _pcbq_enque( &_aio_waiting, _current, 0 );
+    } else {
+        _current->event.wakeup = _system_time + MS_TO_TICKS( timeout );
+        _current->state = Sleeping;
+        _clk_sleep( _current );
     }
-    
-    // if we didn't find one, we have a serious problem
-    assert( i < N_PROCS );
-    
-    // add this to the table
-    _ptable[i] = pcb;
+
+    _dispatch();
 }
 
 /**
-** _sys_wait - wait for a child process to terminate
+** _sys_aio_serve - run the oldest queued aread() or awrite() request
+**
+** Made only by the I/O worker, over and over.  With nothing queued,
+** the worker blocks until _aio_submit() reschedules it.
+**
+** The file system only appends, so a write goes at the end of the
+** file as it is when the worker gets to it; writes queued together
+** land in the order they were queued.
 **
 ** implements:
-**    pid_t wait( int32_t *status );
+**    int32_t aio_serve( void );
 */
-static void _sys_wait( uint32_t args[4] ) {
-    int children = 0;
-    int i;
-    
-    // see if this process has any children, and if so,
-    // whether one of them has terminated
-    for( i = 0; i < N_PROCS; ++i ) {
-        if( _ptable[i] != NULL && _ptable[i]->ppid == _current->pid ) {
-            ++children;
-            if( _ptable[i]->state == Zombie ) {
-                break;
-            }
-        }
-    }       
-
-    // case 1:  no children
+static void _sys_aio_serve( uint32_t args[4] ) {
+    aioreq_t *req = _aio_head;
+    int n;
 
-    if( children < 1 ) {
-        // return the bad news
-        RET(_current) = E_NO_PROCS;
+    if( _current != _aio_worker ) {
+        RET(_current) = E_NO_PERMISSION;
         return;
     }
-    
-    // case 2:  children, but none are zombies
 
-    if( i >= N_PROCS ) {
-        // block this process until one of them terminates
-        _current->state = Waiting;
+    if( req == NULL ) {
+        _aio_idle = true;
+        _current->state = Blocked;
         _dispatch();
         return;
     }
-    
-    // case 3:  bingo!
-    
-    // return the zombie's PID
-    RET(_current) = _ptable[i]->pid;
-    
-    // see if the parent wants the termination status
-    int32_t *ptr = (int32_t *) (args[0]);
-    if( ptr != NULL ) {
-        // yes - return it
-        // *****************************************************
-        // Potential VM issue here!  This code assigns the exit
-        // status into a variable in the parent's address space.  
-        // This works in the baseline because we aren't using
-        // any type of memory protection.  If address space
-        // separation is implemented, this code will very likely
-        // STOP WORKING, and will need to be fixed.
-        // *****************************************************
-        *ptr = _ptable[i]->exit_status;
+
+    // if the lock can't be had, the request fails with that error
+    n = _fs_lock(req->fd.inode_id, req->write, _current);
+    if( n >= 0 ) {
+        if( req->write ) {
+            inode_t node;
+            n = _fs_getInode(req->fd.inode_id, &node);
+            if(n >= 0) {
+                req->fd.offset = node.nBytes;
+                n = _fs_write(&req->fd, req->buf, req->len);
+            }
+        } else {
+            n = _fs_read(&req->fd, req->buf, req->len);
+        }
+        _fs_unlock(req->fd.inode_id, req->write);
     }
-    
-    // clean up the zombie now
-    _pcb_cleanup( _ptable[i] );
-    
-    return;
+
+    _aio_head = req->next;
+    if( _aio_head == NULL ) {
+        _aio_tail = NULL;
+    }
+
+    req->result = n;
+    req->done = true;
+    _aio_notify( req->owner );
+
+    RET(_current) = E_SUCCESS;
 }
 
 /**
@@ -567,7 +1356,7 @@ static void _sys_wait( uint32_t args[4] ) {
 **    uid_t getuid( void );
 */
 static void _sys_getuid ( uint32_t args[4] ) {
-    RET(_current) = _current->uid;
+    RET(_current) = _current->share->uid;
 }
 
 /**
@@ -577,7 +1366,7 @@ static void _sys_getuid ( uint32_t args[4] ) {
 **    gid_t getgid( void );
 */
 static void _sys_getgid ( uint32_t args[4] ) {
-    RET(_current) = _current->gid;
+    RET(_current) = _current->share->gid;
 }
 
 /**
@@ -589,62 +1378,18 @@ static void _sys_getgid ( uint32_t args[4] ) {
 static void _sys_setuid ( uint32_t args[4] ) {
     uid_t uid = args[0];
     
-    if (_current->uid == uid) { // Report success for same user
+    if (_current->share->uid == uid) { // Report success for same user
         RET(_current) = E_SUCCESS;
-    } else if (_current->uid != UID_ROOT) { // Return no permissions if non-root user
+    } else if (_current->share->uid != UID_ROOT) { // Return no permissions if non-root user
         RET(_current) = E_NO_PERMISSION;
     } else { // Otherwise update uid, set default gid, and return success
-        _current->uid = uid;
-        _current->gid = GID_USER;
+        _current->share->uid = uid;
+        _current->share->gid = GID_USER;
+        _vdata_switch( _current );
         RET(_current) = E_SUCCESS;
     }
 }
 
-/**
- * _sys_fGetLn - Helper to grab a file's next line
- * 
- * @param fd The file descriptor to read from
- * @param buf The buffer to read into
- * @param bufLen The length of the buffer
- * 
- * @return The number of bytes read (<0 on error, E_EOF on EOF)
- */
-static int _sys_fGetLn(fd_t* fd, char * buf, int bufLen) {
-    int ret, nRead;
-
-    for(nRead = 0; nRead < bufLen - 1;) {
-        ret = _fs_read(fd, buf + nRead, 1);
-        if(ret == 0 || ret == E_EOF) {
-            if(nRead > 0) {
-                break;
-            }
-
-            buf[nRead] = 0;
-            return E_EOF;
-        } else if (ret < 0) {
-            __cio_printf("*ERROR* in _sys_fGetLn: Failed to read from file (%d)\n", ret);
-            return E_FAILURE;
-        }
-
-        switch(buf[nRead]) {
-            case '\b':
-            case '\r':
-            case 0:
-                continue;
-            case '\n':
-            default:
-                break;
-        }
-        if(buf[nRead] == '\n') {
-            break;
-        }
-
-        nRead++;
-    }
-    buf[nRead] = 0;
-    return nRead;
-}
-
 /**
 ** _sys_setgid - attempts to modify the gid of the current process
 ** 
@@ -659,28 +1404,31 @@ static void _sys_setgid ( uint32_t args[4] ) {
     int ret;
 
     char buf[bufSize];
-    fd_t fd = {{0, 0}, 0};
+    fs_stream_t groups;
+    inode_id_t groupsId;
 
     // If this is the user's or the open gid perform the change and return success
     if (gid == GID_USER || gid == GID_OPEN) {
-        _current->gid = gid;
+        _current->share->gid = gid;
+        _vdata_switch( _current );
         RET(_current) = E_SUCCESS;
         return;
     } 
 
-    // Create an FD for the groups file
-    ret = _sys_seekFile("/.groups", &(fd.inode_id));
+    // Open a buffered stream on the groups file
+    ret = _sys_seekFile("/.groups", &groupsId);
     if(ret < 0) {
         __cio_printf("*ERROR* in _sys_setgid: Failed to seek group file (%d)\n", ret);
         RET(_current) = E_NOT_FOUND;
         return;
     }
+    _fs_streamOpen(&groups, groupsId);
     
     // Read the file line by line to look for a matching entry
     while(true) {
         char * dataPtr = buf;
 
-        ret = _sys_fGetLn(&fd, buf, bufSize);
+        ret = _fs_streamGetLn(&groups, buf, bufSize);
         if(ret == E_EOF) {
             break;
         } else if (ret < 0) {
@@ -709,7 +1457,7 @@ static void _sys_setgid ( uint32_t args[4] ) {
         }
 
         // Try to match current uid to the group's user list
-        bool_t matching = (_current->uid == UID_ROOT); // Skip matching root user
+        bool_t matching = (_current->share->uid == UID_ROOT); // Skip matching root user
         while(!matching && *dataPtr) {
             uid_t fUid = 0;
             while(*(dataPtr) != ':' && *(dataPtr)) {
@@ -718,12 +1466,13 @@ static void _sys_setgid ( uint32_t args[4] ) {
             }
             dataPtr++;
 
-            if(fUid == _current->uid) {
+            if(fUid == _current->share->uid) {
                 matching = true;
             }
         }
         if(matching) {  // Update gid on success
-            _current->gid = gid;
+            _current->share->gid = gid;
+            _vdata_switch( _current );
             RET(_current) = E_SUCCESS;
         } else {        // Fail if not on the list
             RET(_current) = E_NO_PERMISSION;
@@ -760,7 +1509,7 @@ static int _sys_seekFile(const char* path, inode_id_t * currentDir) {
     int i = 0;
 
     // Get starting inode (either working directory or root directory)
-    *currentDir = _current->wDir;
+    *currentDir = _current->share->wDir;
     if(path[0] == '/') {
         *currentDir = (inode_id_t){0, 1};
         i++;
@@ -814,8 +1563,8 @@ static void _sys_fopen( uint32_t args[4]) {
 
     // Check if process has available files
     for (fdIdx = 0; fdIdx < MAX_OPEN_FILES; fdIdx++) {
-        if(_current->files[fdIdx].inode_id.devID == 0 && 
-            _current->files[fdIdx].inode_id.idx == 0) {
+        if(_current->share->files[fdIdx].inode_id.devID == 0 && 
+            _current->share->files[fdIdx].inode_id.idx == 0) {
             break;
         } else if (fdIdx == MAX_OPEN_FILES - 1) {
             __cio_printf("*ERROR* in _sys_fopen: Out of file pointers\n");
@@ -851,7 +1600,7 @@ static void _sys_fopen( uint32_t args[4]) {
 
     // Check that we have either read or write permissions on this
     bool_t canRead, canWrite;
-    _fs_nodePermission(&tgt, _current->uid, _current->gid, &canRead, &canWrite, NULL);
+    _fs_nodePermission(&tgt, _current->share->uid, _current->share->gid, &canRead, &canWrite, NULL);
     if(!canRead && !canWrite) {
         __cio_printf("*ERROR* in _sys_fopen: No rw permissions on this file\n");
         RET(_current) = E_NO_PERMISSION;
@@ -859,8 +1608,8 @@ static void _sys_fopen( uint32_t args[4]) {
     }
 
     // Setup the file descriptor with this file and return the file type
-    _current->files[fdIdx].inode_id = currentDir;
-    _current->files[fdIdx].offset = (append) ? tgt.nBytes : 0;
+    _current->share->files[fdIdx].inode_id = currentDir;
+    _current->share->files[fdIdx].offset = (append) ? tgt.nBytes : 0;
     
     RET(_current) = fdIdx + 2; // Add channel (2) How do I return this? 
 }
@@ -881,15 +1630,21 @@ static void _sys_fclose (uint32_t args[4]) {
 
     fdIdx = args[0] - 2;
 
-    if(_current->files[fdIdx].inode_id.devID == 0 && 
-            _current->files[fdIdx].inode_id.idx == 0) {
+    if(_current->share->files[fdIdx].inode_id.devID == 0 && 
+            _current->share->files[fdIdx].inode_id.idx == 0) {
         RET(_current) = E_BAD_CHANNEL;   // Fail on null file
         return;
     }
 
+    // Drop any view of the file taken through this descriptor
+    if(_current->share->files[fdIdx].view != 0) {
+        _fs_unmap(_current->share->files[fdIdx].view - 1);
+        _current->share->files[fdIdx].view = 0;
+    }
+
     // NULL out the closed file and return success
-    _current->files[fdIdx].inode_id.devID = 0;
-    _current->files[fdIdx].inode_id.idx = 0;
+    _current->share->files[fdIdx].inode_id.devID = 0;
+    _current->share->files[fdIdx].inode_id.idx = 0;
 
     RET(_current) = E_SUCCESS;
 }
@@ -915,9 +1670,15 @@ static void _sys_fcreate  (uint32_t args[4]) {
         return;
     }
 
+    // Hold the parent until the new entry is in place
+    if(_sys_lockNode(currentDir, true) < 0) {
+        return;
+    }
+
     // Get the parent inode
     result = _fs_getInode(currentDir, &pNode);
     if(result < 0){
+        _fs_unlock(currentDir, true);
         RET(_current) = E_NO_CHILDREN;
         return;
     }
@@ -925,6 +1686,7 @@ static void _sys_fcreate  (uint32_t args[4]) {
     // Fail if parent node is not a directory
     if(pNode.nodeType != INODE_DIR_TYPE) {
         __cio_printf("*ERROR* in _sys_fcreate: path \"%s\" leads to non-directory\n", path);
+        _fs_unlock(currentDir, true);
         RET(_current) = E_BAD_PARAM;
         return;
     }
@@ -936,6 +1698,7 @@ static void _sys_fcreate  (uint32_t args[4]) {
 
         result = _fs_getNodeEnt(&pNode, i, &temp);
         if(result < 0) { 
+            _fs_unlock(currentDir, true);
             RET(_current) = E_BAD_PARAM;
             return;
         }
@@ -953,6 +1716,7 @@ static void _sys_fcreate  (uint32_t args[4]) {
         }
         if (matched) {
             __cio_printf("ERROR in _sys_fcreate: %s already exists in DIR\n", name);
+            _fs_unlock(currentDir, true);
             RET(_current) = E_BAD_PARAM;
             return;
         }
@@ -960,9 +1724,10 @@ static void _sys_fcreate  (uint32_t args[4]) {
 
     // Fail if no write permission in this directory
     bool_t canWrite;
-    _fs_nodePermission(&pNode, _current->uid, _current->gid, NULL, &canWrite, NULL);
+    _fs_nodePermission(&pNode, _current->share->uid, _current->share->gid, NULL, &canWrite, NULL);
     if(!canWrite) {
         __cio_printf("*ERROR* in _sys_fcreate: Cannot create entries in \"%s\"\n", path);
+        _fs_unlock(currentDir, true);
         RET(_current) = E_NO_PERMISSION;
         return;
     }
@@ -970,6 +1735,7 @@ static void _sys_fcreate  (uint32_t args[4]) {
     // Find next free inode
     result = _fs_allocNode(currentDir.devID, &newID);
     if(result < 0) {
+        _fs_unlock(currentDir, true);
         RET(_current) = E_NO_DATA;
         return;
     }
@@ -977,14 +1743,15 @@ static void _sys_fcreate  (uint32_t args[4]) {
     // Get the inode via the index
     result = _fs_getInode(newID, &newNode);
     if(result < 0) {
+        _fs_unlock(currentDir, true);
         RET(_current) = E_NOT_FOUND;
         return;
     }    
     
     // Setup default inode values
     newNode.id = newID;
-    newNode.uid = _current->uid;
-    newNode.gid = _current->gid;
+    newNode.uid = _current->share->uid;
+    newNode.gid = _current->share->gid;
     newNode.permissions = DEFAULT_PERMISSIONS;     // Default to open access
     newNode.nRefs = 0; // No references yet
     newNode.nBlocks = 0;
@@ -1003,6 +1770,7 @@ static void _sys_fcreate  (uint32_t args[4]) {
     // Write the inode
     result = _fs_setInode(newNode);
     if(result < 0) {
+        _fs_unlock(currentDir, true);
         RET(_current) = E_NOT_FOUND;
         return;
     }
@@ -1010,10 +1778,12 @@ static void _sys_fcreate  (uint32_t args[4]) {
     // Update parent Inode
     result = _fs_addDirEnt(currentDir, name, newID);
     if(result < 0) {
+        _fs_unlock(currentDir, true);
         RET(_current) = E_FAILURE;
         return;
     }
 
+    _fs_unlock(currentDir, true);
     RET(_current) = E_SUCCESS;
 }
 
@@ -1044,20 +1814,35 @@ static void _sys_fremove (uint32_t args[4]) {
         return; 
     }
 
+    // Lock the directory, then the entry being removed
+    if(_sys_lockNode(targetDirID, true) < 0) {
+        return;
+    }
+    result = _fs_lock(childId, true, _current);
+    if(result < 0) {
+        _fs_unlock(targetDirID, true);
+        RET(_current) = result;
+        return;
+    }
+
     // Read the child node in
     inode_t child;
     result = _fs_getInode(childId, &child);
     if(result < 0) {
         __cio_printf("*ERROR* in _sys_fremove: Could not grab for \"%s/%s\"\n", path, name);
+        _fs_unlock(childId, true);
+        _fs_unlock(targetDirID, true);
         RET(_current) = E_NOT_FOUND;
         return;
     }
 
     // Actually check node priveleges
     bool_t canMeta;
-    result = _fs_nodePermission(&child, _current->uid, _current->gid, NULL, NULL, &canMeta);
+    result = _fs_nodePermission(&child, _current->share->uid, _current->share->gid, NULL, NULL, &canMeta);
     if(!canMeta) {
         __cio_printf("*ERROR* in _sys_fremove: Do not have meta priveleges for \"%s/%s\"\n", path, name);
+        _fs_unlock(childId, true);
+        _fs_unlock(targetDirID, true);
         RET(_current) = E_NO_PERMISSION;
         return; 
     }
@@ -1065,6 +1850,8 @@ static void _sys_fremove (uint32_t args[4]) {
     // Check that the child is not a directory with referands
     if(child.nodeType == INODE_DIR_TYPE && child.nBytes > 1 && child.nRefs == 1) {
         __cio_printf("*ERROR* in _sys_fremove: Cannot remove non-empty directory \"%s/%s\"\n", path, name);
+        _fs_unlock(childId, true);
+        _fs_unlock(targetDirID, true);
         RET(_current) = E_FAILURE;
         return; 
     }
@@ -1073,10 +1860,14 @@ static void _sys_fremove (uint32_t args[4]) {
     result = _fs_rmDirEnt(targetDirID, name);
     if(result < 0) {
         __cio_printf("*ERROR*in _sys_fremove: Cannot remove entry from directory (fremove)\n");
+        _fs_unlock(childId, true);
+        _fs_unlock(targetDirID, true);
         RET(_current) = E_FAILURE;
         return; 
     }
 
+    _fs_unlock(childId, true);
+    _fs_unlock(targetDirID, true);
     RET(_current) = E_SUCCESS;
     return;
 }
@@ -1115,10 +1906,20 @@ static void _sys_fmove (uint32_t args[4]) {
         return;
     }
 
+    // Lock both directories (in a fixed order, so two moves cannot each be 
+    // holding the other's directory)
+    result = _fs_lockDirs(sourceDir, destDir, _current);
+    if(result < 0) {
+        RET(_current) = result;
+        return;
+    }
+
     // Read the source node from the disk
     result = _fs_getInode(sourceDir, &sourceNode);
     if(result < 0) {
         __cio_printf("*ERROR* in _sys_fmove: Failed to grab inode %d.%d (%d)\n", sourceDir.devID, sourceDir.idx, result);
+        _fs_unlock(destDir, true);
+        _fs_unlock(sourceDir, true);
         RET(_current) = E_BAD_PARAM;
         return;
     }
@@ -1126,15 +1927,19 @@ static void _sys_fmove (uint32_t args[4]) {
     // Check that the source is a directory inode
     if(sourceNode.nodeType != INODE_DIR_TYPE) {
         __cio_printf("*ERROR* in _sys_fmove: Node at \"%s\" is not a directory\n", sPath);
+        _fs_unlock(destDir, true);
+        _fs_unlock(sourceDir, true);
         RET(_current) = E_NO_CHILDREN;
         return;
     }
 
     // Check that we have write priveleges in source node
     bool_t permitted;
-    _fs_nodePermission(&sourceNode, _current->uid, _current->gid, NULL, &permitted, NULL);
+    _fs_nodePermission(&sourceNode, _current->share->uid, _current->share->gid, NULL, &permitted, NULL);
     if(!permitted) {
         __cio_printf("*ERROR* in _sys_fmove: Cannot write to node \"%s\"\n", sPath);
+        _fs_unlock(destDir, true);
+        _fs_unlock(sourceDir, true);
         RET(_current) = E_NO_PERMISSION;
         return;
     }
@@ -1143,6 +1948,8 @@ static void _sys_fmove (uint32_t args[4]) {
     result = _fs_getInode(destDir, &destNode);
     if(result < 0) {
         __cio_printf("*ERROR* in _sys_fmove: Failed to grab inode %d.%d (%d)\n", destDir.devID, destDir.idx, result);
+        _fs_unlock(destDir, true);
+        _fs_unlock(sourceDir, true);
         RET(_current) = E_BAD_PARAM;
         return;
     }
@@ -1150,14 +1957,18 @@ static void _sys_fmove (uint32_t args[4]) {
     // Check that the dest is a directory inode
     if(destNode.nodeType != INODE_DIR_TYPE) {
         __cio_printf("*ERROR* in _sys_fmove: Node at \"%s\" is not a directory\n", dPath);
+        _fs_unlock(destDir, true);
+        _fs_unlock(sourceDir, true);
         RET(_current) = E_NO_CHILDREN;
         return;
     }
 
     // Check that we can write to dest
-    _fs_nodePermission(&destNode, _current->uid, _current->gid, NULL, &permitted, NULL);
+    _fs_nodePermission(&destNode, _current->share->uid, _current->share->gid, NULL, &permitted, NULL);
     if(!permitted) {
         __cio_printf("*ERROR* in _sys_fmove: Cannot write to node \"%s\"\n", dPath);
+        _fs_unlock(destDir, true);
+        _fs_unlock(sourceDir, true);
         RET(_current) = E_NO_PERMISSION;
         return;
     }
@@ -1166,18 +1977,35 @@ static void _sys_fmove (uint32_t args[4]) {
     result = _fs_getSubDir(sourceDir, sName, &copyTarg); 
     if(result < 0) {
         __cio_printf("*ERROR* Unable to get \"%s\" in \"%s\"\n", sName, sourceDir);
+        _fs_unlock(destDir, true);
+        _fs_unlock(sourceDir, true);
         RET(_current) = E_FAILURE;
         return;
     }
 
+    // The entry's inode changes too (its reference count)
+    result = _fs_lock(copyTarg, true, _current);
+    if(result < 0) {
+        _fs_unlock(destDir, true);
+        _fs_unlock(sourceDir, true);
+        RET(_current) = result;
+        return;
+    }
+
     //Check that we have meta permissions for the file in question
-    result = _fs_getPermission(copyTarg, _current->uid, _current->gid, NULL, &permitted, NULL);
+    result = _fs_getPermission(copyTarg, _current->share->uid, _current->share->gid, NULL, &permitted, NULL);
     if(result < 0) {
         __cio_printf("*ERROR* in _sys_fmove: Could not get permissions for node \"%s/%s\"\n", sPath, sName);
+        _fs_unlock(copyTarg, true);
+        _fs_unlock(destDir, true);
+        _fs_unlock(sourceDir, true);
         RET(_current) = E_NO_PERMISSION;
         return;
     } else if(!permitted) {
         __cio_printf("*ERROR* in _sys_fmove: No meta priveleges on node \"%s/%s\"\n", sPath, sName);
+        _fs_unlock(copyTarg, true);
+        _fs_unlock(destDir, true);
+        _fs_unlock(sourceDir, true);
         RET(_current) = E_NO_PERMISSION;
         return;
     }
@@ -1187,12 +2015,18 @@ static void _sys_fmove (uint32_t args[4]) {
     result = _fs_addDirEnt(destDir, dName, copyTarg);
     if(result < 0) {
         __cio_printf("*ERROR* Unable to add \"%s\" to \"%s\"\n", dName, destDir);
+        _fs_unlock(copyTarg, true);
+        _fs_unlock(destDir, true);
+        _fs_unlock(sourceDir, true);
         RET(_current) = E_FAILURE;
         return;
     }
     
-    // Remove the file from source
+    // Remove the file from source (our locks let its own locking through)
     _sys_fremove(args);
+    _fs_unlock(copyTarg, true);
+    _fs_unlock(destDir, true);
+    _fs_unlock(sourceDir, true);
     if(result < 0) {
         __cio_printf("*ERROR* Unable to remove \"%s\" from \"%s\"\n", sName, sourceDir);
         RET(_current) = E_FAILURE;
@@ -1282,7 +2116,7 @@ static void _sys_dirname (uint32_t args[4]) {
 
     // Check that we can read from this node
     bool_t canRead;
-    _fs_nodePermission(&node, _current->uid, _current->gid, &canRead, NULL, NULL);
+    _fs_nodePermission(&node, _current->share->uid, _current->share->gid, &canRead, NULL, NULL);
     if(!canRead) {
         __cio_printf("*ERROR* in _sys_dirname: Not permitted to read from node \"%s\"\n", path);
         RET(_current) = E_NO_PERMISSION;
@@ -1346,7 +2180,7 @@ static void _sys_fchown(uint32_t args[4]) {
 
     // Check that we have permissions
     bool_t canMeta;
-    _fs_nodePermission(&node, _current->uid, _current->gid, NULL, NULL, &canMeta);
+    _fs_nodePermission(&node, _current->share->uid, _current->share->gid, NULL, NULL, &canMeta);
     if(!canMeta) {
         __cio_printf("*ERROR* in _sys_fchown: No meta permissions on %s\n", path);
         RET(_current) = E_NO_PERMISSION;
@@ -1401,7 +2235,7 @@ static void _sys_fSetPerm(uint32_t args[4]) {
 
     // Check that we have permissions
     bool_t canMeta;
-    _fs_nodePermission(&node, _current->uid, _current->gid, NULL, NULL, &canMeta);
+    _fs_nodePermission(&node, _current->share->uid, _current->share->gid, NULL, NULL, &canMeta);
     if(!canMeta) {
         __cio_printf("*ERROR* in _sys_fSetPerm: No meta permissions on %s\n", path);
         RET(_current) = E_NO_PERMISSION;
@@ -1462,7 +2296,7 @@ static void _sys_setDir(uint32_t args[4]) {
 
     // Check that we have read permissions here
     bool_t canRead;
-    _fs_nodePermission(&node, _current->uid, _current->gid, &canRead, NULL, NULL);
+    _fs_nodePermission(&node, _current->share->uid, _current->share->gid, &canRead, NULL, NULL);
     if(!canRead) {
         __cio_printf("*ERROR* in _sys_setDir: No read permissions in \"%s\"\n", path);
         RET(_current) = E_NO_PERMISSION;
@@ -1470,15 +2304,266 @@ static void _sys_setDir(uint32_t args[4]) {
     }
 
     // Update the working directory and exit successfully
-    _current->wDir = id;
+    _current->share->wDir = id;
     RET(_current) = E_SUCCESS;
     return;
 }
 
+/**
+** _splice_sio - move as much of a splice() as the SIO will take
+**
+** The transfer state lives in the process' context:  RET(pcb) holds the
+** count moved so far, and the length argument is decremented as data
+** is accepted, so the transfer can be continued from the SIO ISR.
+**
+** @param pcb   The process doing the splice()
+**
+** @return true if the transfer is complete, false if the SIO output
+**         buffer filled up first
+*/
+static bool_t _splice_sio( pcb_t *pcb ) {
+    fd_t *fd = &pcb->share->files[ARG(pcb,1) - 2];
+    char *data;
+    int n;
+
+    while( ARG(pcb,3) > 0 ) {
+        int space = _sio_space();
+        if( space == 0 ) {
+            return( false );
+        }
+
+        n = _fs_peek( fd, &data, ARG(pcb,3) < space ? ARG(pcb,3) : space );
+        if( n < 0 ) {
+            // report errors (or EOF) only if nothing was moved
+            if( RET(pcb) == 0 ) {
+                RET(pcb) = n;
+            }
+            break;
+        }
+
+        n = _sio_write( data, n );
+        fd->offset += n;
+        RET(pcb) += n;
+        ARG(pcb,3) -= n;
+    }
+
+    return( true );
+}
+
+/**
+ ** _sys_splice - copy file data directly to the console or SIO
+ **
+ ** Blocks (on the SIO write queue) if the SIO output buffer fills; the
+ ** SIO ISR continues the transfer as the buffer drains.  The inode's
+ ** read lock is held only while data is being moved, never while the
+ ** process is blocked, so a writer may get in between two chunks (as
+ ** it could between two read()s).
+ **
+ ** implements: 
+ **    int32_t splice(int inChan, int outChan, uint32_t length);
+ */
+static void _sys_splice( uint32_t args[4] ) {
+    uint32_t inChan = args[0];
+    uint32_t outChan = args[1];
+    uint32_t length = args[2];
+
+    // Input must be an open file
+    if(inChan < 2 || inChan >= 2 + MAX_OPEN_FILES) {
+        RET(_current) = E_BAD_CHANNEL;
+        return;
+    }
+
+    fd_t * fd = &_current->share->files[inChan - 2];
+    if(fd->inode_id.devID == 0 && fd->inode_id.idx == 0) {    // Blank fd_t
+        RET(_current) = E_BAD_CHANNEL;
+        return;
+    }
+
+    // Check that you have read permissions
+    bool_t canRead;
+    int ret = _fs_getPermission(fd->inode_id, _current->share->uid, _current->share->gid, &canRead, NULL, NULL);
+    if(ret < 0 || !canRead) {
+        __cio_printf("*ERROR* in _sys_splice: No read permission on file %d.%d\n", fd->inode_id.devID, fd->inode_id.idx);
+        RET(_current) = E_NO_PERMISSION;
+        return;
+    }
+
+    if(outChan != CHAN_CONS && outChan != CHAN_SIO) {
+        RET(_current) = E_BAD_CHANNEL;
+        return;
+    }
+    if(_sys_lockNode(fd->inode_id, false) < 0) {
+        return;
+    }
+
+    RET(_current) = 0;
+
+    switch( outChan ) {
+    case CHAN_CONS:
+        // the console never fills, so this all happens now
+        while( length > 0 ) {
+            char *data;
+            int n = _fs_peek(fd, &data, length);
+            if(n < 0) {
+                if(RET(_current) == 0) {
+                    RET(_current) = n;
+                }
+                break;
+            }
+
+            __cio_write(data, n);
+            fd->offset += n;
+            RET(_current) += n;
+            length -= n;
+        }
+        _fs_unlock(fd->inode_id, false);
+        break;
+
+    case CHAN_SIO:
+        if( _splice_sio(_current) ) {
+            _fs_unlock(fd->inode_id, false);
+        } else {
+            // wait (without the lock) for the output buffer to drain
+            _fs_unlock(fd->inode_id, false);
+            _current->state = Blocked;
+            _pcbq_enque( &_writing, _current, 0 );
+            _dispatch();
+        }
+        break;
+    }
+}
+
+/**
+ ** _sys_fmap - maps a read-only view of an open file into memory
+ **
+ ** implements: 
+ **    int32_t fmap(int chan, const char ** ptr, uint32_t * len);
+ */
+static void _sys_fmap( uint32_t args[4] ) {
+    uint32_t chan = args[0];
+    const char ** ptr = (const char **) args[1];
+    uint32_t * len = (uint32_t *) args[2];
+
+    if(chan < 2 || chan >= 2 + MAX_OPEN_FILES || ptr == NULL || len == NULL) {
+        RET(_current) = E_BAD_CHANNEL;
+        return;
+    }
+
+    fd_t * fd = &_current->share->files[chan - 2];
+    if(fd->inode_id.devID == 0 && fd->inode_id.idx == 0) {    // Blank fd_t
+        RET(_current) = E_BAD_CHANNEL;
+        return;
+    }
+
+    // Check that you have read permissions
+    bool_t canRead;
+    int ret = _fs_getPermission(fd->inode_id, _current->share->uid, _current->share->gid, &canRead, NULL, NULL);
+    if(ret < 0 || !canRead) {
+        __cio_printf("*ERROR* in _sys_fmap: No read permission on file %d.%d\n", fd->inode_id.devID, fd->inode_id.idx);
+        RET(_current) = E_NO_PERMISSION;
+        return;
+    }
+
+    // A descriptor holds at most one view; remapping picks up any changes
+    char * base;
+    uint32_t size;
+    ret = _fs_map(fd->inode_id, &base, &size);
+    if(ret < 0) {
+        RET(_current) = ret;
+        return;
+    }
+    if(fd->view != 0) {
+        _fs_unmap(fd->view - 1);
+    }
+    fd->view = ret + 1;
+
+    *ptr = base;
+    *len = size;
+    RET(_current) = E_SUCCESS;
+}
+
+/**
+** _sys_meminfo - retrieve the kernel memory accounting information
+**
+** implements:
+**    int32_t meminfo( meminfo_t *info );
+*/
+static void _sys_meminfo( uint32_t args[4] ) {
+    meminfo_t *info = (meminfo_t *) args[0];
+
+    if( info == NULL ) {
+        RET(_current) = E_BAD_PARAM;
+        return;
+    }
+
+    _km_meminfo( info );
+    _proc_pool_info( &info->pool, &info->pool_target );
+    RET(_current) = E_SUCCESS;
+}
+
+/**
+** _sys_gettime_ns - read the high-resolution monotonic clock
+**
+** implements:
+**    int32_t gettime_ns( uint64_t *ns );
+*/
+static void _sys_gettime_ns( uint32_t args[4] ) {
+    uint64_t *ns = (uint64_t *) args[0];
+
+    if( ns == NULL ) {
+        RET(_current) = E_BAD_PARAM;
+        return;
+    }
+
+    *ns = _clk_ns();
+    RET(_current) = E_SUCCESS;
+}
+
 /*
 ** PUBLIC FUNCTIONS
 */
 
+/**
+** Name:  _splice_resume
+**
+** Continue a splice() to the SIO that blocked on a full output buffer;
+** called from the SIO ISR once there is room again
+**
+** The blocked process holds no lock, so the read lock is taken again
+** for each chunk.  Nothing holds an inode lock while waiting, and this
+** runs with interrupts disabled, so no writer can be holding it now.
+**
+** @param pcb   Pointer to the PCB for the blocked process
+*/
+void _splice_resume( pcb_t *pcb ) {
+    inode_id_t id = pcb->share->files[ARG(pcb,1) - 2].inode_id;
+
+    // killed while waiting?  let the scheduler clean it up
+    if( pcb->state == Killed ) {
+        _schedule( pcb );
+        return;
+    }
+
+    // the file may have been closed by another thread, and the
+    // lock table may be full; either way, keep what was moved
+    if( (id.devID == 0 && id.idx == 0) || _fs_lock(id, false, pcb) < 0 ) {
+        if( RET(pcb) == 0 ) {
+            RET(pcb) = E_BAD_CHANNEL;
+        }
+        _schedule( pcb );
+        return;
+    }
+
+    bool_t done = _splice_sio( pcb );
+    _fs_unlock( id, false );
+
+    if( done ) {
+        _schedule( pcb );
+    } else {
+        _pcbq_enque( &_writing, pcb, 0 );
+    }
+}
+
 /**
 ** Name:  _sys_init
 **
@@ -1526,6 +2611,28 @@ void _sys_init( void ) {
     _syscalls[ SYS_fchown]    = _sys_fchown;
     _syscalls[ SYS_fSetPerm]  = _sys_fSetPerm;
     _syscalls[ SYS_setDir]    = _sys_setDir;
+    _syscalls[ SYS_splice ]   = _sys_splice;
+    _syscalls[ SYS_fmap ]     = _sys_fmap;
+    _syscalls[ SYS_meminfo ]  = _sys_meminfo;
+    _syscalls[ SYS_gettime_ns ] = _sys_gettime_ns;
+    _syscalls[ SYS_spawn_stack ] = _sys_spawn_stack;
+    _syscalls[ SYS_thread_spawn ] = _sys_thread_spawn;
+    _syscalls[ SYS_thread_join ]  = _sys_thread_join;
+    _syscalls[ SYS_wait_on ]      = _sys_wait_on;
+    _syscalls[ SYS_wake ]         = _sys_wake;
+    _syscalls[ SYS_ring_setup ]   = _sys_ring_setup;
+    _syscalls[ SYS_submit ]       = _sys_submit;
+    _syscalls[ SYS_aread ]        = _sys_aread;
+    _syscalls[ SYS_awrite ]       = _sys_awrite;
+    _syscalls[ SYS_await ]        = _sys_await;
+    _syscalls[ SYS_aio_serve ]    = _sys_aio_serve;
+
+    _syscalls[ SYS_nanosleep ]    = _sys_nanosleep;
+
+    for( int i = 0; i < FUTEX_BUCKETS; ++i ) {
+        _pcbq_init( &_futex[i], false );
+    }
+    _pcbq_init( &_aio_waiting, false );
 
 
     /*
@@ -1541,6 +2648,27 @@ void _sys_init( void ) {
     __cio_puts( " done" );
 }
 
+/**
+** Name:  _sys_fast
+**
+** Second-level handler for the fast system call entry (see isr_stubs.S).
+** Unlike _sys_isr(), there is no interrupt to acknowledge, and the
+** arguments are used where they sit on the caller's stack.
+**
+** @param code   The system call code
+** @param args   The arguments, in place on the caller's stack
+*/
+void _sys_fast( uint32_t code, uint32_t args[4] ) {
+
+    assert( _current != NULL );
+
+    if( _stk_check(_current) ) {
+        return;
+    }
+
+    _sys_call( code, args );
+}
+
 /**
 ** Name:  _force_exit
 **
@@ -1550,63 +2678,58 @@ void _sys_init( void ) {
 ** @param state    Termination status for the process
 */
 void _force_exit( pcb_t *victim, int32_t status ) {
-    pid_t us = victim->pid;
+    pcb_t *parent = victim->parent;
+    pcb_t *init = _pcb_find_pid( PID_INIT );
+
+    // record the termination status, for whoever collects it
+    victim->exit_status = status;
+
+    // nobody is left to collect its aread() and awrite() results
+    _aio_release( victim );
 
     // reparent all the children of this process so that
     // when they terminate init() will collect them
-    for( int i = 0; i < N_PROCS; ++i ) {
-        // if (A) this is an active process, and
-        //    (B) it's in a "really active" state, and
-        //    (C) it's a child of this process,
-        // hand it off to 'init'
-        if( _ptable[i] != NULL
-            && _ptable[i]->state >= Ready
-            && _ptable[i]->ppid == us) {
-            _ptable[i]->ppid = PID_INIT;
+    if( victim != init ) {
+        _proc_reparent( victim, init );
+
+        // if that gave a waiting init some zombies, it can
+        // collect one of them right now
+        if( init->state == Waiting && init->event.other == NULL ) {
+            pcb_t *zombie = _wait_zombie( init );
+            if( zombie != NULL ) {
+                _wait_deliver( init, zombie );
+                _schedule( init );
+            }
         }
     }
 
-    // locate this process' parent
-    pcb_t *parent = _pcb_find_pid( victim->ppid );
-
-    // every process has a parent, even if it's 'init'
-    assert( parent != NULL );
+    // only init has no parent; nobody is left to collect it
+    if( parent == NULL ) {
+        victim->state = Zombie;
+        return;
+    }
     
-    if( parent->state != Waiting ) {
+    if( parent->state != Waiting ||
+        (parent->event.other == NULL ? victim->share == parent->share
+                                     : parent->event.other != victim) ) {
     
-        // if the parent isn't currently waiting, turn
-        // the exiting process into a zombie
+        // if the parent isn't currently waiting (or is joining
+        // a different thread, or is in wait() and we are one of
+        // its threads), turn the exiting process into a zombie,
+        // and queue it for the parent's next wait() or thread_join()
         victim->state = Zombie;
+        _pcbq_enque( &parent->zombies, victim, 0 );
 
-        // leave it alone and unchanged for now
         return;
     }
         
     // OK, we know that the parent is currently waiting.  Waiting
-    // processes, like Zombie processes, are not on an actual queue;
-    // instead, they exist solely in the process table, with their
-    // state indicating their condition.
+    // processes are not on an actual queue; instead, their state
+    // indicates their condition, and the exiting child hands
+    // itself over directly.
 
-    // Give the parent this child's PID
-    RET(parent) = victim->pid;
-
-    // if the parent wants it, also return this child's status
-    int32_t *ptr = (int32_t *) ARG( parent, 1 );
-    if( ptr != NULL ) {
-        // *****************************************************
-        // Potential VM issue here!  This code assigns the exit
-        // status into a variable in the parent's address space.  
-        // This works in the baseline because we aren't using
-        // any type of memory protection.  If address space
-        // separation is implemented, this code will very likely
-        // STOP WORKING, and will need to be fixed.
-        // *****************************************************
-        *ptr = status;
-    }
+    _wait_deliver( parent, victim );
 
     // switch the parent back on to process the info we gave it
     _schedule( parent );
-
-    // clean up this process
-    _pcb_cleanup( victim );
 }
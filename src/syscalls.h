@@ -51,9 +51,37 @@
 #define SYS_fchown    23
 #define SYS_fSetPerm  24
 #define SYS_setDir    25
+#define SYS_splice    26
+#define SYS_fmap      27
+
+// System information
+#define SYS_meminfo   28
+#define SYS_gettime_ns 29
+
+// Process creation
+#define SYS_spawn_stack 30
+
+// Threads
+#define SYS_thread_spawn 31
+#define SYS_thread_join  32
+#define SYS_wait_on      33
+#define SYS_wake         34
+
+// Batching
+#define SYS_ring_setup   35
+#define SYS_submit       36
+
+// Asynchronous I/O
+#define SYS_aread        37
+#define SYS_awrite       38
+#define SYS_await        39
+#define SYS_aio_serve    40
+
+// Timing
+#define SYS_nanosleep    41
 
 // UPDATE THIS DEFINITION IF MORE SYSCALLS ARE ADDED!
-#define N_SYSCALLS    26
+#define N_SYSCALLS    42
 
 // dummy system call code for testing our ISR
 #define SYS_bogus     0xbad
@@ -61,6 +89,11 @@
 // interrupt vector entry for system calls
 #define INT_VEC_SYSCALL   0x80
 
+// The user library makes system calls through __sys_fast, which leaves
+// SYSCALL_FAST in the context's error code field; 'int $0x80' (still
+// accepted) leaves 0.
+#define SYSCALL_FAST        1
+
 #ifndef SP_ASM_SRC
 
 /*
@@ -70,6 +103,10 @@
 ** the C compiler should be put here.
 */
 
+// user code may include this for the system call codes (e.g., to queue
+// calls on a system call ring), but the rest is for the kernel only
+#ifdef SP_KERNEL_SRC
+
 /*
 ** Types
 */
@@ -78,6 +115,9 @@
 ** Globals
 */
 
+// the process which runs aread() and awrite() requests
+extern pcb_t *_aio_worker;
+
 /*
 ** Prototypes
 */
@@ -89,6 +129,16 @@
 */
 void _sys_init( void );
 
+/**
+** Name:  _sys_fast
+**
+** Second-level handler for the fast system call entry (see isr_stubs.S)
+**
+** @param code   The system call code
+** @param args   The arguments, in place on the caller's stack
+*/
+void _sys_fast( uint32_t code, uint32_t args[4] );
+
 /**
 ** Name:  _force_exit
 **
@@ -99,6 +149,19 @@ void _sys_init( void );
 */
 void _force_exit( pcb_t *victim, int32_t status );
 
+/**
+** Name:  _splice_resume
+**
+** Continue a splice() to the SIO that blocked on a full output buffer;
+** called from the SIO ISR once there is room again
+**
+** @param pcb   Pointer to the PCB for the blocked process
+*/
+void _splice_resume( pcb_t *pcb );
+
+#endif
+/* SP_KERNEL_SRC */
+
 #endif
 /* SP_ASM_SRC */
 
@@ -25,10 +25,60 @@
 ** Types
 */
 
+// size of the buffer used by a buffered input stream (one disk block)
+#define STREAM_BUF_SIZE 512
+
+/*
+** Buffered input stream over a channel or open file
+**
+** Streams are allocated by the caller (usually on its stack), as there
+** is no per-process heap; each refill pulls up to STREAM_BUF_SIZE bytes
+** with a single read() call.
+*/
+typedef struct stream_s {
+    int chan;                   // channel or file descriptor being read
+    int32_t pos;                // index of the next unread byte in buf
+    int32_t len;                // number of valid bytes in buf
+    int32_t status;             // sticky E_EOF/error from the last refill
+    char buf[STREAM_BUF_SIZE];  // buffered data
+} FILE;
+
+/*
+** Output buffering modes (see setvbuf())
+*/
+#define BUF_DEFAULT 0   // channel default:  line for CONS, full for SIO
+#define BUF_NONE    1   // every write goes straight to the channel
+#define BUF_LINE    2   // flushed at each newline, or when full
+#define BUF_FULL    3   // flushed only when full, on fflush(), or on exit
+
+// capacity of each per-channel output buffer
+#define OUTBUF_SIZE 508
+
+// output buffer for one channel
+typedef struct outbuf_s {
+    uint16_t count;             // number of bytes waiting to be written
+    uint8_t mode;               // buffering mode (BUF_*)
+    uint8_t unused;
+    char data[OUTBUF_SIZE];     // pending output
+} outbuf_t;
+
+/*
+** Per-process user library area
+**
+** The kernel gives every process one zeroed slice for this and points
+** _uarea at the running process' copy, so it must fit in 1KB.
+*/
+typedef struct uarea_s {
+    outbuf_t out[2];            // indexed by CHAN_CONS / CHAN_SIO
+} uarea_t;
+
 /*
 ** Globals
 */
 
+// user library area of the running process (maintained by the kernel)
+extern void *_uarea;
+
 /*
 ** Prototypes
 */
@@ -47,6 +97,8 @@
 **
 ** usage:	exit(status);
 **
+** Any buffered output (see bwrite()) is flushed first.
+**
 ** @param status   Termination status of this process
 **
 ** @return Does not return
@@ -88,6 +140,7 @@ int32_t write( int chan, const void *buffer, uint32_t length );
 */
 pid_t getpid( void );
 
+
 /**
 ** getppid - retrieve PID of the parent of this process
 **
@@ -115,6 +168,16 @@ time_t gettime( void );
 */
 prio_t getprio( void );
 
+/**
+** getprio_int - getprio(), made through 'int $0x80' rather than the
+** fast system call entry (for benchmarking)
+**
+** usage:   n = getprio_int();
+**
+** @returns The current priority of this process
+*/
+prio_t getprio_int( void );
+
 /**
 ** setprio - sets the priority for this process
 **
@@ -163,6 +226,174 @@ void sleep( uint32_t msec );
 */
 pid_t spawn( int (*entry)(uint32_t,uint32_t), prio_t, uint32_t, uint32_t );
 
+/**
+** spawn_stack - create a new process with a particular stack size
+**
+** usage:   pid = spawn_stack(entry,prio,arg1,arg2,size);
+**
+** @param entry The function which is the entry point of the new code
+** @param prio  The desired priority for the new process
+** @param arg1  The first command-line argument
+** @param arg2  The second command-line argument
+** @param size  Stack size in bytes (rounded up to whole pages), or 0
+**              for the default
+**
+** @returns PID of the new process, or an error code
+*/
+pid_t spawn_stack( int (*entry)(uint32_t,uint32_t), prio_t, uint32_t,
+                   uint32_t, uint32_t size );
+
+/**
+** thread_spawn - create a new thread of this process
+**
+** usage:   tid = thread_spawn(entry,arg,size);
+**
+** The thread shares this process' open files, user and group IDs, and
+** working directory, and runs at its priority.  Returning from the
+** entry point terminates the thread, with the return value as status.
+**
+** @param entry The function the thread runs
+** @param arg   Argument passed to it
+** @param size  Stack size in bytes (rounded up to whole pages), or 0
+**              for the default (one page)
+**
+** @returns PID of the new thread, or an error code
+*/
+pid_t thread_spawn( int32_t (*entry)(void *), void *arg, uint32_t size );
+
+/**
+** thread_join - wait for a particular thread to terminate
+**
+** usage:   tid = thread_join(tid,&status);
+**
+** @param tid    PID of a thread created by this one
+** @param status Pointer to int32_t into which the thread's status is
+**               placed, or NULL
+**
+** @returns The PID of the thread, or an error code
+*/
+pid_t thread_join( pid_t tid, int32_t *status );
+
+/**
+** wait_on - block while a word in memory holds a given value
+**
+** usage:   n = wait_on(&word,val);
+**
+** @param addr  The (4-byte aligned) word
+** @param val   The value it is expected to hold
+**
+** @returns E_SUCCESS once woken by wake(), E_AGAIN if *addr != val, or
+**          E_BAD_PARAM for a bad address
+*/
+int32_t wait_on( volatile uint32_t *addr, uint32_t val );
+
+/**
+** wake - wake processes blocked in wait_on() for a word in memory
+**
+** usage:   n = wake(&word,count);
+**
+** @param addr  The word
+** @param n     Most processes to wake
+**
+** @returns The number of processes woken
+*/
+int32_t wake( volatile uint32_t *addr, uint32_t n );
+
+/**
+** ring_setup - register a system call ring for this process
+**
+** usage:   n = ring_setup(&ring);
+**
+** The ring is emptied.  A NULL ring drops the registered one.
+**
+** @param ring  The ring (must be word-aligned)
+**
+** @returns 0 on success, else an error code
+*/
+int32_t ring_setup( ring_t *ring );
+
+/**
+** submit - run system calls queued on this process' ring
+**
+** usage:   n = submit(count,wait_min);
+**
+** Only read(), write(), fopen(), fclose(), getinode() and dirname() may
+** be queued; anything else completes with E_BAD_SYSCALL.  Calls are run
+** in order, each to completion, so whatever was taken from the ring has
+** completed when this returns.  It stops early if the submission ring
+** empties or the completion ring fills.
+**
+** @param n         Most calls to take from the ring
+** @param wait_min  Least calls to have completed (at most n)
+**
+** @returns The number of calls taken, else an error code
+*/
+int32_t submit( uint32_t n, uint32_t wait_min );
+
+/**
+** aread - start a read from a file
+**
+** usage:   n = aread(chan,buf,len,off,token);
+**
+** Returns at once; the read is done in the background by the kernel's
+** I/O worker, and its result (as read() would return it) is collected
+** with await().  The file's own offset is neither used nor changed.
+**
+** @param chan  File channel to read from
+** @param buf   Where to put the data (must stay valid until collected)
+** @param len   Bytes to read
+** @param off   Offset in the file to read from
+** @param token Names the request in await() (unique among this
+**              process' uncollected requests)
+**
+** @returns 0 on success, else an error code (E_BUSY if too many
+**          requests are outstanding)
+*/
+int32_t aread( int chan, void *buf, uint32_t len, uint32_t off,
+               uint32_t token );
+
+/**
+** awrite - start a write to a file
+**
+** usage:   n = awrite(chan,buf,len,off,token);
+**
+** As aread(), but writing; the result is what write() would return.
+** Files can only be appended to, so the data goes at the end of the
+** file as it is when the write is done, and off is ignored; writes
+** are done in the order they were queued.
+**
+** @param chan  File channel to write to
+** @param buf   The data (must stay valid until collected)
+** @param len   Bytes to write
+** @param off   Ignored (kept to match aread())
+** @param token Names the request in await()
+**
+** @returns 0 on success, else an error code
+*/
+int32_t awrite( int chan, const void *buf, uint32_t len, uint32_t off,
+                uint32_t token );
+
+/**
+** await - collect the results of aread() and awrite() requests
+**
+** usage:   n = await(ev,n,timeout);
+**
+** Each entry's result is filled in:  the request's result if it has
+** finished, E_AGAIN if it hasn't, or E_NOT_FOUND if there is no such
+** request.  Finished requests are forgotten once collected.  If none
+** of them has finished, waits until one does or the timeout expires.
+**
+** @param ev        The tokens of the requests to collect
+** @param n         How many there are
+** @param timeout   Most milliseconds to wait (0 to just check, or
+**                  AIO_FOREVER)
+**
+** @returns The number of requests collected (0 on a timeout), else an
+**          error code (E_NOT_FOUND if waiting forever for requests
+**          which don't exist)
+*/
+int32_t await( aio_t *ev, uint32_t n, uint32_t timeout );
+
 /**
 ** wait - wait for a child process to terminate
 **
@@ -174,7 +405,7 @@ pid_t spawn( int (*entry)(uint32_t,uint32_t), prio_t, uint32_t, uint32_t );
 ** @returns The PID of the terminated child, or an error code
 **
 ** If there are no children in the system, returns an error code (*status
-** is unchanged).
+** is unchanged).  Threads are not collected here; see thread_join().
 **
 ** If there are one or more children in the system and at least one has
 ** terminated but hasn't yet been cleaned up, cleans up that process and
@@ -356,6 +587,77 @@ int32_t fSetPerm(char * path, uint32_t permissions);
  */
 int32_t setDir(char * path);
 
+/**
+ * splice - Copies data from an open file directly to the console or SIO, 
+ *          without passing it through a user buffer
+ * 
+ * usage: n = splice(int inChan, int outChan, uint32_t length);
+ * 
+ * @param inChan The file channel to read from (starting at its offset)
+ * @param outChan The channel to write to (CHAN_CONS or CHAN_SIO)
+ * @param length The max number of bytes to copy
+ * 
+ * @return The number of bytes copied, or an error code (E_EOF if the file 
+ *         was already at its end)
+ */
+int32_t splice(int inChan, int outChan, uint32_t length);
+
+/**
+ * fmap - Gets a read-only view of an entire open file in memory. Files on 
+ *        the ramdisk with contiguous blocks are viewed in place; others are 
+ *        copied once and the copy is shared by later maps. The view stays 
+ *        valid until the file is closed (or mapped again), and must not be 
+ *        written to. An in-place view is the file itself: appends don't 
+ *        touch the bytes it covers, but if the file is removed, its blocks 
+ *        (and so the view's contents) may be reused.
+ * 
+ * usage: fmap(int chan, const char ** ptr, uint32_t * len);
+ * 
+ * @param chan The file channel to map
+ * @param ptr A return pointer for the start of the file data
+ * @param len A return pointer for the length of the file
+ * 
+ * @return A standard exit status (0 on success, <0 on failure)
+ */
+int32_t fmap(int chan, const char ** ptr, uint32_t * len);
+
+/**
+** meminfo - retrieve the kernel memory accounting information
+**
+** usage:   n = meminfo(&info);
+**
+** @param info  Where to put the information (page counts, the
+**              usage statistics for each KM_* allocation tag, and
+**              the size of the spawn pool)
+**
+** @returns 0 on success, else an error code
+*/
+int32_t meminfo( meminfo_t *info );
+
+/**
+** gettime_ns - read the high-resolution monotonic clock
+**
+** usage:   n = gettime_ns(&ns);
+**
+** @param ns    Where to put the time, in nanoseconds since boot
+**
+** @returns 0 on success, else an error code
+*/
+int32_t gettime_ns( uint64_t *ns );
+
+/**
+** nanosleep - put the current process to sleep for some number
+**             of nanoseconds
+**
+** usage:   nanosleep(ns);
+**
+** Unlike sleep(), the wakeup need not wait for a clock tick; a
+** nanosleep of 0 just yields the processor.
+**
+** @param ns   Desired sleep time (in ns)
+*/
+void nanosleep( uint64_t ns );
+
 /*
 **********************************************
 ** CONVENIENT "SHORTHAND" VERSIONS OF SYSCALLS
@@ -446,6 +748,195 @@ int32_t readLn(int chan, char* buf, uint32_t length, bool_t doEcho);
 */
 int32_t fReadLn(int fp, char* buf, uint32_t length);
 
+/*
+**********************************************
+** BUFFERED INPUT FUNCTIONS
+**********************************************
+*/
+
+/**
+** finit(stream,chan) - prepare a caller-allocated stream for reading
+**
+** @param stream The stream to initialize
+** @param chan   The channel or file descriptor to read from
+*/
+void finit( FILE *stream, int chan );
+
+/**
+** getc(stream) - read the next character from a buffered stream
+**
+** @param stream The stream to read from
+**
+** @returns The character read (as an unsigned value), or an error code
+**          (E_EOF at the end of the stream)
+*/
+int32_t getc( FILE *stream );
+
+/**
+** ungetc(ch,stream) - push one character back onto a buffered stream
+**
+** @param ch     The character to push back
+** @param stream The stream to push it onto
+**
+** @returns The character pushed back, or E_FAILURE if there is no room
+*/
+int32_t ungetc( int32_t ch, FILE *stream );
+
+/**
+** fgets(buf,size,stream) - read a line (including the newline) from a
+**                          buffered stream
+**
+** @param buf    Buffer to read into (always NUL-terminated)
+** @param size   Maximum capacity of the buffer
+** @param stream The stream to read from
+**
+** @returns buf, or NULL if nothing could be read
+*/
+char *fgets( char *buf, uint32_t size, FILE *stream );
+
+/**
+** fgetLn(stream,buf,length) - buffered equivalent of fReadLn(); reads to
+**                             the next newline or end of buffer, dropping
+**                             carriage returns and the newline itself
+**
+** @param stream The stream to read from
+** @param buf    Buffer to read into
+** @param length Maximum capacity of the buffer
+**
+** @returns  The count of bytes transferred, or an error code (E_EOF at
+**           the end of the stream)
+*/
+int32_t fgetLn( FILE *stream, char *buf, uint32_t length );
+
+/*
+**********************************************
+** BUFFERED OUTPUT FUNCTIONS
+**********************************************
+*/
+
+/*
+** Output to CHAN_CONS and CHAN_SIO made through these routines is held
+** in a per-process buffer and written with one write() call when the
+** buffer fills, at a newline (line-buffered channels), on fflush(),
+** before readLn() or a buffered input refill, and when the process
+** calls exit() or returns from its main function.  The unbuffered
+** cwrite*() and swrite*() routines flush pending output for their
+** channel first, so output order is preserved.  Output from a process
+** that is killed is lost.
+*/
+
+/**
+** bwrite(chan,buf,size) - buffered write of a sized buffer
+**
+** @param chan The channel to write to
+** @param buf  The buffer to write
+** @param size The number of bytes to write
+**
+** @returns The number of bytes accepted, or an error code
+*/
+int32_t bwrite( int chan, const char *buf, uint32_t size );
+
+/**
+** bwrites(chan,str) - buffered write of a NUL-terminated string
+**
+** @param chan The channel to write to
+** @param str  The string to write
+**
+** @returns The number of bytes accepted, or an error code
+*/
+int32_t bwrites( int chan, const char *str );
+
+/**
+** fflush(chan) - write out any output buffered for a channel
+**
+** @param chan The channel to flush
+**
+** @returns The return value from calling write(), or E_SUCCESS if
+**          there was nothing to write
+*/
+int32_t fflush( int chan );
+
+/**
+** fflushall() - write out all buffered output for this process
+*/
+void fflushall( void );
+
+/**
+** setvbuf(chan,mode) - select the buffering mode for a channel
+**
+** @param chan The channel to modify
+** @param mode The new mode (BUF_*)
+**
+** @returns E_SUCCESS, E_BAD_CHANNEL or E_BAD_PARAM
+*/
+int32_t setvbuf( int chan, int mode );
+
+/**
+** printf(fmt,...) - buffered formatted output to the SIO
+**
+** @param fmt Format string (as for sprint())
+**
+** @returns The number of characters produced
+*/
+int32_t printf( char *fmt, ... );
+
+/**
+** cprintf(fmt,...) - buffered formatted output to the console
+**
+** @param fmt Format string (as for sprint())
+**
+** @returns The number of characters produced
+*/
+int32_t cprintf( char *fmt, ... );
+
+/*
+**********************************************
+** SYSTEM CALL RING FUNCTIONS
+**********************************************
+*/
+
+/**
+** ring_queue(ring,code,a0,a1,a2,tag) - queue a system call on a ring
+**
+** The call is not made until the next submit().
+**
+** @param ring  The ring
+** @param code  System call code (SYS_*)
+** @param a0    First argument
+** @param a1    Second argument
+** @param a2    Third argument
+** @param tag   Handed back in the call's completion
+**
+** @returns E_SUCCESS, or E_BUSY if the submission ring is full
+*/
+int32_t ring_queue( ring_t *ring, uint32_t code, uint32_t a0,
+                    uint32_t a1, uint32_t a2, uint32_t tag );
+
+/**
+** ring_reap(ring,cqe) - take the oldest completion from a ring
+**
+** @param ring  The ring
+** @param cqe   Where to put the completion
+**
+** @returns true if there was one, else false
+*/
+bool_t ring_reap( ring_t *ring, rcqe_t *cqe );
+
+/**
+** ring_run(ring,n,cqes) - run calls queued on a ring, and reap them all
+**
+** Makes as many submit() calls as it takes, reaping completions in
+** between, until all n calls have completed.
+**
+** @param ring  The ring
+** @param n     Number of calls queued
+** @param cqes  Where to put the n completions, in the order they came
+**
+** @returns The number of completions reaped (n unless the kernel
+**          stopped taking calls), or an error code from submit()
+*/
+int32_t ring_run( ring_t *ring, uint32_t n, rcqe_t *cqes );
+
 /*
 **********************************************
 ** STRING MANIPULATION FUNCTIONS
@@ -610,7 +1101,8 @@ void sprint( char *dst, char *fmt, ... );
 ** exit_helper() - dummy "startup" function
 **
 ** calls exit(%eax) - serves as the "return to" code for main()
-** functions, in case they don't call exit() themselves
+** functions, in case they don't call exit() themselves; as exit()
+** flushes buffered output, nothing is lost when main() just returns
 */
 void exit_helper( void );
 
@@ -16,6 +16,13 @@
 ** PRIVATE DATA TYPES
 */
 
+// destination for the formatter used by sprint() and printf()
+typedef struct fmtout_s {
+    char *dst;          // string being built, or NULL for a channel
+    int chan;           // channel receiving buffered output
+    int32_t count;      // number of characters produced so far
+} fmtout_t;
+
 /*
 ** PRIVATE GLOBAL VARIABLES
 */
@@ -28,6 +35,260 @@
 ** PRIVATE FUNCTIONS
 */
 
+/**
+** _outbuf(chan) - locate this process' output buffer for a channel
+**
+** @param chan The channel of interest
+**
+** @returns A pointer to the buffer, or NULL if the channel is not
+**          buffered (or the process has no library area)
+*/
+static outbuf_t *_outbuf( int chan ) {
+    uarea_t *ua = (uarea_t *) _uarea;
+
+    if( ua == NULL || (chan != CHAN_CONS && chan != CHAN_SIO) ) {
+        return( NULL );
+    }
+
+    return( &ua->out[chan] );
+}
+
+/**
+** _oflush(chan,ob) - write out the contents of an output buffer
+**
+** The SIO may accept only part of the data if its output ring is
+** full; in that case, we yield the CPU and try again.
+**
+** @param chan The channel being flushed
+** @param ob   The buffer for that channel
+**
+** @returns E_SUCCESS, or the error code from write()
+*/
+static int32_t _oflush( int chan, outbuf_t *ob ) {
+    uint32_t done = 0;
+    int32_t n;
+
+    while( done < ob->count ) {
+        n = write( chan, ob->data + done, ob->count - done );
+        if( n < 0 ) {
+            ob->count = 0;
+            return( n );
+        } else if( n == 0 ) {
+            sleep( 0 );
+        }
+        done += n;
+    }
+
+    ob->count = 0;
+
+    return( E_SUCCESS );
+}
+
+/**
+** _fmt_put(out,str,len) - send formatted characters to their destination
+**
+** @param out The destination
+** @param str The characters
+** @param len How many characters there are
+*/
+static void _fmt_put( fmtout_t *out, const char *str, int len ) {
+
+    if( out->dst != NULL ) {
+        for( int i = 0; i < len; ++i ) {
+            *out->dst++ = str[i];
+        }
+    } else {
+        bwrite( out->chan, str, len );
+    }
+
+    out->count += len;
+}
+
+/**
+** _fmt_pad(out,extra,padchar) - send padding to a destination
+**
+** @param out     The destination
+** @param extra   How many padding bytes to add
+** @param padchar What character to pad with
+*/
+static void _fmt_pad( fmtout_t *out, int extra, int padchar ) {
+    char padding[16];
+
+    for( int i = 0; i < 16; ++i ) {
+        padding[i] = (char) padchar;
+    }
+
+    while( extra > 0 ) {
+        int n = extra > 16 ? 16 : extra;
+        _fmt_put( out, padding, n );
+        extra -= n;
+    }
+}
+
+/**
+** _fmt_padstr(out,str,len,width,leftadjust,padchar) - send a padded
+**                                                     string
+**
+** @param out        The destination
+** @param str        The string to be padded
+** @param len        The string length, or -1
+** @param width      The desired final length of the string
+** @param leftadjust Should the string be left-justified?
+** @param padchar    What character to pad with
+*/
+static void _fmt_padstr( fmtout_t *out, char *str, int len, int width,
+                         int leftadjust, int padchar ) {
+    int extra;
+
+    if( len < 0 ) {
+        len = strlen( str );
+    }
+
+    extra = width - len;
+    if( extra > 0 && !leftadjust ) {
+        _fmt_pad( out, extra, padchar );
+    }
+
+    _fmt_put( out, str, len );
+
+    if( extra > 0 && leftadjust ) {
+        _fmt_pad( out, extra, padchar );
+    }
+}
+
+/**
+** _fmt(out,fmt,ap) - formatted output engine for sprint() and printf()
+**
+** @param out The destination
+** @param fmt Format string
+** @param ap  Pointer to the first "value" parameter
+**
+** NOTE:  relies heavily on the x86 parameter passing convention
+** (parameters are pushed onto the stack in reverse order as
+** 32-bit values).
+*/
+static void _fmt( fmtout_t *out, char *fmt, int32_t *ap ) {
+    char buf[ 12 ];
+    char ch;
+    char *str;
+    int leftadjust;
+    int width;
+    int len;
+    int padchar;
+
+    // iterate through the format string
+    while( *fmt != '\0' ){
+        /*
+        ** Ordinary characters are passed along as a single run
+        */
+        if( *fmt != '%' ){
+            str = fmt;
+            while( *fmt != '\0' && *fmt != '%' ) {
+                ++fmt;
+            }
+            _fmt_put( out, str, fmt - str );
+            continue;
+        }
+
+        /*
+        ** It's the start of a format code; get the padding and
+        ** width options (if there).  Alignment must come at the
+        ** beginning, then fill, then width.
+        */
+        ++fmt;
+        leftadjust = 0;
+        padchar = ' ';
+        width = 0;
+        ch = *fmt++;
+        if( ch == '-' ){
+            leftadjust = 1;
+            ch = *fmt++;
+        }
+        if( ch == '0' ){
+            padchar = '0';
+            ch = *fmt++;
+        }
+        while( ch >= '0' && ch <= '9' ){
+            width *= 10;
+            width += ch - '0';
+            ch = *fmt++;
+        }
+
+        /*
+        ** What data type do we have?
+        */
+        switch( ch ) {
+
+        case 'c':  // characters are passed as 32-bit values
+            ch = *ap++;
+            buf[ 0 ] = ch;
+            buf[ 1 ] = '\0';
+            _fmt_padstr( out, buf, 1, width, leftadjust, padchar );
+            break;
+
+        case 'd':
+            len = cvt_dec( buf, *ap++ );
+            _fmt_padstr( out, buf, len, width, leftadjust, padchar );
+            break;
+
+        case 's':
+            str = (char *) (*ap++);
+            _fmt_padstr( out, str, -1, width, leftadjust, padchar );
+            break;
+
+        case 'x':
+            len = cvt_hex( buf, *ap++ );
+            _fmt_padstr( out, buf, len, width, leftadjust, padchar );
+            break;
+
+        case 'o':
+            len = cvt_oct( buf, *ap++ );
+            _fmt_padstr( out, buf, len, width, leftadjust, padchar );
+            break;
+
+        case '\0':
+            // format string ended in the middle of a format code
+            --fmt;
+            break;
+
+        }
+    }
+}
+
+/**
+** _frefill(stream) - refill a stream's buffer with a single read()
+**
+** @param stream The stream to refill
+**
+** @returns The number of bytes now buffered, or an error code (E_EOF
+**          at the end of the stream)
+*/
+static int32_t _frefill( FILE *stream ) {
+    int32_t n;
+
+    if( stream->status < 0 ) {
+        return( stream->status );
+    }
+
+    // make sure any prompt is visible before we wait for input
+    fflushall();
+
+    n = read( stream->chan, stream->buf, STREAM_BUF_SIZE );
+    if( n == 0 ) {
+        n = E_EOF;
+    }
+
+    stream->pos = 0;
+    if( n < 0 ) {
+        stream->len = 0;
+        stream->status = n;
+    } else {
+        stream->len = n;
+    }
+
+    return( n );
+}
+
 /*
 ** PUBLIC FUNCTIONS
 */
@@ -46,6 +307,7 @@
 ** @returns The return value from calling write()
 */
 int32_t cwritech( char ch ) {
+   fflush( CHAN_CONS );
    return( write(CHAN_CONS,&ch,1) );
 }
 
@@ -57,6 +319,7 @@ int32_t cwritech( char ch ) {
 */
 int32_t cwrites( const char *str ) {
    int len = strlen(str);
+   fflush( CHAN_CONS );
    return( write(CHAN_CONS,str,len) );
 }
 
@@ -69,6 +332,7 @@ int32_t cwrites( const char *str ) {
 ** @returns The return value from calling write()
 */
 int32_t cwrite( const char *buf, uint32_t size ) {
+   fflush( CHAN_CONS );
    return( write(CHAN_CONS,buf,size) );
 }
 
@@ -80,6 +344,7 @@ int32_t cwrite( const char *buf, uint32_t size ) {
 ** @returns The return value from calling write()
 */
 int32_t swritech( char ch ) {
+   fflush( CHAN_SIO );
    return( write(CHAN_SIO,&ch,1) );
 }
 
@@ -92,6 +357,7 @@ int32_t swritech( char ch ) {
 */
 int32_t swrites( const char *str ) {
    int len = strlen(str);
+   fflush( CHAN_SIO );
    return( write(CHAN_SIO,str,len) );
 }
 
@@ -104,6 +370,7 @@ int32_t swrites( const char *str ) {
 ** @returns The return value from calling write()
 */
 int32_t swrite( const char *buf, uint32_t size ) {
+   fflush( CHAN_SIO );
    return( write(CHAN_SIO,buf,size) );
 }
 
@@ -131,6 +398,9 @@ int32_t readLn(int chan, char* buf, uint32_t length, bool_t doEcho) {
         return E_BAD_CHANNEL;
     }
 
+    // Make sure any prompt is visible before we wait for input
+    fflushall();
+
     buf[length - 1] = 0; //set last byte to null just in case
     
     while(i < length - 1) {
@@ -237,6 +507,428 @@ int32_t fReadLn(int fp, char* buf, uint32_t length) {
     return i;
 }
 
+/*
+**********************************************
+** BUFFERED INPUT FUNCTIONS
+**********************************************
+*/
+
+/**
+** finit(stream,chan) - prepare a caller-allocated stream for reading
+**
+** @param stream The stream to initialize
+** @param chan   The channel or file descriptor to read from
+*/
+void finit( FILE *stream, int chan ) {
+    stream->chan = chan;
+    stream->pos = 0;
+    stream->len = 0;
+    stream->status = E_SUCCESS;
+}
+
+/**
+** getc(stream) - read the next character from a buffered stream
+**
+** @param stream The stream to read from
+**
+** @returns The character read (as an unsigned value), or an error code
+**          (E_EOF at the end of the stream)
+*/
+int32_t getc( FILE *stream ) {
+    int32_t n;
+
+    if( stream->pos >= stream->len ) {
+        n = _frefill( stream );
+        if( n < 0 ) {
+            return( n );
+        }
+    }
+
+    return( (uint8_t) stream->buf[stream->pos++] );
+}
+
+/**
+** ungetc(ch,stream) - push one character back onto a buffered stream
+**
+** @param ch     The character to push back
+** @param stream The stream to push it onto
+**
+** @returns The character pushed back, or E_FAILURE if there is no room
+*/
+int32_t ungetc( int32_t ch, FILE *stream ) {
+
+    if( ch < 0 ) {
+        return( E_FAILURE );
+    }
+
+    if( stream->pos > 0 ) {
+        // normal case:  step back over the byte we just consumed
+        stream->buf[--stream->pos] = (char) ch;
+    } else if( stream->len == 0 ) {
+        // nothing buffered yet, so the pushed byte is the buffer
+        stream->buf[0] = (char) ch;
+        stream->len = 1;
+    } else {
+        return( E_FAILURE );
+    }
+
+    return( ch );
+}
+
+/**
+** fgets(buf,size,stream) - read a line (including the newline) from a
+**                          buffered stream
+**
+** @param buf    Buffer to read into (always NUL-terminated)
+** @param size   Maximum capacity of the buffer
+** @param stream The stream to read from
+**
+** @returns buf, or NULL if nothing could be read
+*/
+char *fgets( char *buf, uint32_t size, FILE *stream ) {
+    uint32_t i = 0;
+
+    if( size == 0 ) {
+        return( NULL );
+    }
+
+    while( i < size - 1 ) {
+        if( stream->pos >= stream->len && _frefill(stream) < 0 ) {
+            break;
+        }
+
+        // copy straight out of the buffer up to (and including) a newline
+        char ch = 0;
+        while( i < size - 1 && stream->pos < stream->len && ch != '\n' ) {
+            ch = stream->buf[stream->pos++];
+            buf[i++] = ch;
+        }
+
+        if( ch == '\n' ) {
+            break;
+        }
+    }
+
+    buf[i] = 0;
+
+    return( i > 0 ? buf : NULL );
+}
+
+/**
+** fgetLn(stream,buf,length) - buffered equivalent of fReadLn(); reads to
+**                             the next newline or end of buffer, dropping
+**                             carriage returns and the newline itself
+**
+** @param stream The stream to read from
+** @param buf    Buffer to read into
+** @param length Maximum capacity of the buffer
+**
+** @returns  The count of bytes transferred, or an error code (E_EOF at
+**           the end of the stream)
+*/
+int32_t fgetLn( FILE *stream, char *buf, uint32_t length ) {
+    uint32_t i = 0;
+    int32_t result;
+
+    while( i < length - 1 ) {
+        if( stream->pos >= stream->len ) {
+            result = _frefill( stream );
+            if( result < 0 ) {
+                if( i > 0 ) {
+                    break;
+                }
+                buf[0] = 0;
+                return( result );
+            }
+        }
+
+        char ch = stream->buf[stream->pos++];
+
+        if( ch == '\n' ) {
+            break;
+        } else if( ch == '\b' || ch == '\0' || ch == '\r' ) {
+            continue;
+        }
+
+        buf[i++] = ch;
+    }
+
+    buf[i] = 0;
+
+    return( i );
+}
+
+/*
+**********************************************
+** BUFFERED OUTPUT FUNCTIONS
+**********************************************
+*/
+
+/**
+** bwrite(chan,buf,size) - buffered write of a sized buffer
+**
+** @param chan The channel to write to
+** @param buf  The buffer to write
+** @param size The number of bytes to write
+**
+** @returns The number of bytes accepted, or an error code
+*/
+int32_t bwrite( int chan, const char *buf, uint32_t size ) {
+    outbuf_t *ob = _outbuf( chan );
+    int32_t result;
+    bool_t newline = false;
+    int mode;
+
+    // unbuffered channels (and processes without buffers) just write
+    if( ob == NULL ) {
+        return( write(chan,buf,size) );
+    }
+
+    mode = ob->mode;
+    if( mode == BUF_DEFAULT ) {
+        mode = (chan == CHAN_CONS) ? BUF_LINE : BUF_FULL;
+    }
+
+    // things too big to buffer (or unbuffered) go out directly,
+    // once anything already waiting has been sent
+    if( mode == BUF_NONE || size >= OUTBUF_SIZE ) {
+        if( ob->count > 0 ) {
+            result = _oflush( chan, ob );
+            if( result < 0 ) {
+                return( result );
+            }
+        }
+        return( write(chan,buf,size) );
+    }
+
+    for( uint32_t i = 0; i < size; ++i ) {
+        if( ob->count == OUTBUF_SIZE ) {
+            result = _oflush( chan, ob );
+            if( result < 0 ) {
+                return( result );
+            }
+        }
+        ob->data[ob->count++] = buf[i];
+        if( buf[i] == '\n' ) {
+            newline = true;
+        }
+    }
+
+    if( mode == BUF_LINE && newline ) {
+        result = _oflush( chan, ob );
+        if( result < 0 ) {
+            return( result );
+        }
+    }
+
+    return( size );
+}
+
+/**
+** bwrites(chan,str) - buffered write of a NUL-terminated string
+**
+** @param chan The channel to write to
+** @param str  The string to write
+**
+** @returns The number of bytes accepted, or an error code
+*/
+int32_t bwrites( int chan, const char *str ) {
+    return( bwrite(chan,str,strlen(str)) );
+}
+
+/**
+** fflush(chan) - write out any output buffered for a channel
+**
+** @param chan The channel to flush
+**
+** @returns The return value from calling write(), or E_SUCCESS if
+**          there was nothing to write
+*/
+int32_t fflush( int chan ) {
+    outbuf_t *ob = _outbuf( chan );
+
+    if( ob == NULL || ob->count == 0 ) {
+        return( E_SUCCESS );
+    }
+
+    return( _oflush(chan,ob) );
+}
+
+/**
+** fflushall() - write out all buffered output for this process
+*/
+void fflushall( void ) {
+    fflush( CHAN_CONS );
+    fflush( CHAN_SIO );
+}
+
+/**
+** setvbuf(chan,mode) - select the buffering mode for a channel
+**
+** @param chan The channel to modify
+** @param mode The new mode (BUF_*)
+**
+** @returns E_SUCCESS, E_BAD_CHANNEL or E_BAD_PARAM
+*/
+int32_t setvbuf( int chan, int mode ) {
+    outbuf_t *ob = _outbuf( chan );
+
+    if( ob == NULL ) {
+        return( E_BAD_CHANNEL );
+    }
+
+    if( mode < BUF_DEFAULT || mode > BUF_FULL ) {
+        return( E_BAD_PARAM );
+    }
+
+    // pending output was buffered under the old rules
+    fflush( chan );
+    ob->mode = mode;
+
+    return( E_SUCCESS );
+}
+
+/**
+** printf(fmt,...) - buffered formatted output to the SIO
+**
+** @param fmt Format string (as for sprint())
+**
+** @returns The number of characters produced
+*/
+int32_t printf( char *fmt, ... ) {
+    fmtout_t out;
+
+    out.dst = NULL;
+    out.chan = CHAN_SIO;
+    out.count = 0;
+
+    _fmt( &out, fmt, (int32_t *)(&fmt) + 1 );
+
+    return( out.count );
+}
+
+/**
+** cprintf(fmt,...) - buffered formatted output to the console
+**
+** @param fmt Format string (as for sprint())
+**
+** @returns The number of characters produced
+*/
+int32_t cprintf( char *fmt, ... ) {
+    fmtout_t out;
+
+    out.dst = NULL;
+    out.chan = CHAN_CONS;
+    out.count = 0;
+
+    _fmt( &out, fmt, (int32_t *)(&fmt) + 1 );
+
+    return( out.count );
+}
+
+/*
+**********************************************
+** SYSTEM CALL RING FUNCTIONS
+**********************************************
+*/
+
+/**
+** ring_queue(ring,code,a0,a1,a2,tag) - queue a system call on a ring
+**
+** The call is not made until the next submit().
+**
+** @param ring  The ring
+** @param code  System call code (SYS_*)
+** @param a0    First argument
+** @param a1    Second argument
+** @param a2    Third argument
+** @param tag   Handed back in the call's completion
+**
+** @returns E_SUCCESS, or E_BUSY if the submission ring is full
+*/
+int32_t ring_queue( ring_t *ring, uint32_t code, uint32_t a0,
+                    uint32_t a1, uint32_t a2, uint32_t tag ) {
+
+    if( ring->sq_tail - ring->sq_head >= RING_SIZE ) {
+        return( E_BUSY );
+    }
+
+    rsqe_t *sqe = &ring->sq[ring->sq_tail & (RING_SIZE - 1)];
+    sqe->code = code;
+    sqe->args[0] = a0;
+    sqe->args[1] = a1;
+    sqe->args[2] = a2;
+    sqe->tag = tag;
+
+    // the entry must be filled in before the kernel can see it
+    __asm__ __volatile__( "" ::: "memory" );
+    ++ring->sq_tail;
+
+    return( E_SUCCESS );
+}
+
+/**
+** ring_reap(ring,cqe) - take the oldest completion from a ring
+**
+** @param ring  The ring
+** @param cqe   Where to put the completion
+**
+** @returns true if there was one, else false
+*/
+bool_t ring_reap( ring_t *ring, rcqe_t *cqe ) {
+
+    if( ring->cq_head == ring->cq_tail ) {
+        return( false );
+    }
+
+    *cqe = ring->cq[ring->cq_head & (RING_SIZE - 1)];
+    ++ring->cq_head;
+
+    return( true );
+}
+
+/**
+** ring_run(ring,n,cqes) - run calls queued on a ring, and reap them all
+**
+** Makes as many submit() calls as it takes, reaping completions in
+** between, until all n calls have completed.
+**
+** @param ring  The ring
+** @param n     Number of calls queued
+** @param cqes  Where to put the n completions, in the order they came
+**
+** @returns The number of completions reaped (n unless the kernel
+**          stopped taking calls), or an error code from submit()
+*/
+int32_t ring_run( ring_t *ring, uint32_t n, rcqe_t *cqes ) {
+    uint32_t taken = 0;
+    uint32_t reaped = 0;
+
+    while( reaped < n ) {
+        int32_t ret = 0;
+
+        if( taken < n ) {
+            ret = submit( n - taken, 0 );
+            if( ret < 0 ) {
+                return( ret );
+            }
+            taken += ret;
+        }
+
+        uint32_t before = reaped;
+        while( reaped < n && ring_reap(ring, &cqes[reaped]) ) {
+            ++reaped;
+        }
+
+        // nothing taken and nothing to reap: it will never finish
+        if( ret == 0 && reaped == before ) {
+            break;
+        }
+    }
+
+    return( reaped );
+}
+
 /*
 **********************************************
 ** STRING MANIPULATION FUNCTIONS
@@ -539,100 +1231,25 @@ char *padstr( char *dst, char *str, int len, int width,
 ** 32-bit values).
 */
 void sprint( char *dst, char *fmt, ... ) {
-    int32_t *ap;
-    char buf[ 12 ];
-    char ch;
-    char *str;
-    int leftadjust;
-    int width;
-    int len;
-    int padchar;
+    fmtout_t out;
 
     /*
-    ** Get characters from the format string and process them
-    **
     ** We use the "old-school" method of handling variable numbers
     ** of parameters.  We assume that parameters are passed on the
     ** runtime stack in consecutive longwords; thus, if the first
     ** parameter is at location 'x', the second is at 'x+4', the
-    ** third at 'x+8', etc.  We use a pointer to a 32-bit thing
-    ** to point to the next "thing", and interpret it according
-    ** to the format string.
+    ** third at 'x+8', etc.  The formatter walks a pointer to a
+    ** 32-bit thing through them as directed by the format string.
     */
-    
-    // get the pointer to the first "value" parameter
-    ap = (int *)(&fmt) + 1;
-
-    // iterate through the format string
-    while( (ch = *fmt++) != '\0' ){
-        /*
-        ** Is it the start of a format code?
-        */
-        if( ch == '%' ){
-            /*
-            ** Yes, get the padding and width options (if there).
-            ** Alignment must come at the beginning, then fill,
-            ** then width.
-            */
-            leftadjust = 0;
-            padchar = ' ';
-            width = 0;
-            ch = *fmt++;
-            if( ch == '-' ){
-                leftadjust = 1;
-                ch = *fmt++;
-            }
-            if( ch == '0' ){
-                padchar = '0';
-                ch = *fmt++;
-            }
-            while( ch >= '0' && ch <= '9' ){
-                width *= 10;
-                width += ch - '0';
-                ch = *fmt++;
-            }
-
-            /*
-            ** What data type do we have?
-            */
-            switch( ch ) {
-
-            case 'c':  // characters are passed as 32-bit values
-                ch = *ap++;
-                buf[ 0 ] = ch;
-                buf[ 1 ] = '\0';
-                dst = padstr( dst, buf, 1, width, leftadjust, padchar );
-                break;
-
-            case 'd':
-                len = cvt_dec( buf, *ap++ );
-                dst = padstr( dst, buf, len, width, leftadjust, padchar );
-                break;
 
-            case 's':
-                str = (char *) (*ap++);
-                dst = padstr( dst, str, -1, width, leftadjust, padchar );
-                break;
-
-            case 'x':
-                len = cvt_hex( buf, *ap++ ) + 2;
-                dst = padstr( dst, buf, len, width, leftadjust, padchar );
-                break;
+    out.dst = dst;
+    out.chan = -1;
+    out.count = 0;
 
-            case 'o':
-                len = cvt_oct( buf, *ap++ );
-                dst = padstr( dst, buf, len, width, leftadjust, padchar );
-                break;
-
-            }
-        } else {
-            // no, it's just an ordinary character
-            *dst++ = ch;
-        }
-    }
+    _fmt( &out, fmt, (int32_t *)(&fmt) + 1 );
 
     // NUL-terminate the result
-    *dst = '\0';
+    *out.dst = '\0';
 }
 
 /*
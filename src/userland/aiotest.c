@@ -0,0 +1,133 @@
+#ifndef AIOTEST_H_
+#define AIOTEST_H_
+
+#include "common.h"
+
+// reads kept in flight, and the size of each
+#define AIO_DEPTH   4
+#define AIO_BLOCK   64
+
+// waits for the requests with tokens [from,to) which are still queued,
+// so the worker never writes into a buffer we have given up
+void aioDrain(uint32_t from, uint32_t to) {
+    aio_t ev;
+
+    for(; from < to; from++) {
+        ev.token = from;
+        await(&ev, 1, AIO_FOREVER);     // E_NOT_FOUND if already done
+    }
+}
+
+// queues a read and exits before the I/O worker can get to it
+int32_t aioQuitter(uint32_t arg1, uint32_t arg2) {
+    char buf[AIO_BLOCK];
+    int fp = fopen((char *) arg1, false);
+
+    if(fp < 0) {
+        return fp;
+    }
+
+    // the kernel must drop this, as buf goes away with us
+    return aread(fp, buf, AIO_BLOCK, 0, 1);
+}
+
+int32_t aiotest(uint32_t arg1, uint32_t arg2) {
+    char * path = (char *) arg1;
+    char bufs[AIO_DEPTH][AIO_BLOCK + 1];
+    aio_t ev;
+    uint32_t next = 0;      // offset of the next block to queue
+    uint32_t total = 0;
+    int fp, ret, status;
+
+    fp = fopen(path, false);
+    if(fp < 0) {
+        printf("*ERROR* in aiotest: File open error (%d)\r\n", fp);
+        return E_FAILURE;
+    }
+
+    // Keep AIO_DEPTH reads in flight; the token is the block number,
+    // and each block goes in buffer (token % AIO_DEPTH)
+    printf("\r\n");
+    for(int i = 0; i < AIO_DEPTH; i++, next += AIO_BLOCK) {
+        ret = aread(fp, bufs[i], AIO_BLOCK, next, i);
+        if(ret < 0) {
+            printf("*ERROR* in aiotest: aread failed (%d)\r\n", ret);
+            aioDrain(0, i);
+            fclose(fp);
+            return E_FAILURE;
+        }
+    }
+
+    // Collect them in order; each block is printed while the worker
+    // is busy with the ones after it
+    uint32_t blk;
+    for(blk = 0; ; blk++) {
+        ev.token = blk;
+        ret = await(&ev, 1, AIO_FOREVER);
+        if(ret < 0) {
+            printf("*ERROR* in aiotest: await failed (%d)\r\n", ret);
+            aioDrain(blk, next / AIO_BLOCK);
+            fclose(fp);
+            return E_FAILURE;
+        }
+        if(ev.result <= 0) {    // E_EOF, or an error
+            break;
+        }
+
+        char *buf = bufs[blk % AIO_DEPTH];
+        buf[ev.result] = 0;
+        printf("%s", buf);
+        total += ev.result;
+
+        // reuse the buffer for the next block
+        ret = aread(fp, buf, AIO_BLOCK, next, blk + AIO_DEPTH);
+        next += AIO_BLOCK;
+        if(ret < 0) {
+            printf("*ERROR* in aiotest: aread failed (%d)\r\n", ret);
+            aioDrain(blk + 1, next / AIO_BLOCK);
+            fclose(fp);
+            return E_FAILURE;
+        }
+    }
+
+    // The reads queued after that one are past the end of the file;
+    // collect them anyway
+    aioDrain(blk + 1, next / AIO_BLOCK);
+    printf("\r\n%d bytes in %d-byte reads, %d in flight\r\n", total, AIO_BLOCK, AIO_DEPTH);
+
+    // A poll right after queueing a read (usually) finds it still
+    // queued, as the worker only runs once we block or use up our
+    // quantum
+    ret = aread(fp, bufs[0], AIO_BLOCK, 0, 100);
+    ev.token = 100;
+    ret = (ret < 0) ? ret : await(&ev, 1, 0);
+    printf("poll:     %d collected, result %d\r\n", ret, ev.result);
+    await(&ev, 1, AIO_FOREVER);
+
+    // Nothing will ever finish for an unknown token, so this waits out
+    // the timeout; a sleep() afterward must not be cut short
+    ev.token = 101;
+    ret = await(&ev, 1, 50);
+    printf("timeout:  %d collected, result %d\r\n", ret, ev.result);
+    sleep(10);
+
+    // A process which exits with a read still queued
+    ret = spawn(aioQuitter, getprio(), (uint32_t) path, 0);
+    if(ret < 0) {
+        printf("*ERROR* in aiotest: spawn failed (%d)\r\n", ret);
+    } else {
+        wait(&status);
+
+        // and the worker carries on with ours
+        aread(fp, bufs[0], AIO_BLOCK, 0, 102);
+        ev.token = 102;
+        ret = await(&ev, 1, AIO_FOREVER);
+        printf("exit:     child status %d, then %d collected, result %d\r\n",
+                status, ret, ev.result);
+    }
+
+    fclose(fp);
+    return E_SUCCESS;
+}
+
+#endif
@@ -2,6 +2,7 @@
 #define AP_H_
 
 #include "common.h"
+#include "syscalls.h"
 int32_t ap(uint32_t arg1, uint32_t arg2) {
     char * path = (char*) arg1;
     char lineBuf[128];
@@ -48,16 +49,43 @@ int32_t ap(uint32_t arg1, uint32_t arg2) {
     readLn(CHAN_SIO, lineBuf, 126, true);
     strcat(lineBuf, "\r\n");
 
-    // Append the string to file
-    ret = write(fp, lineBuf, strlen(lineBuf));
+    // Append the string to file and close it, as one batch on the ring
+    ring_t ring;
+    rcqe_t cqes[2];
+    bool_t closed = false;
+
+    ret = ring_setup(&ring);
+    if(ret < 0) {
+        sprint(lineBuf, "*ERROR* in ap: Failed to set up the ring (%d)", ret);
+        swrites(lineBuf);
+        fclose(fp);
+        return E_FAILURE;
+    }
+
+    ring_queue(&ring, SYS_write, fp, (uint32_t) lineBuf, strlen(lineBuf), 0);
+    ring_queue(&ring, SYS_fclose, fp, 0, 0, 1);
+    int n = ring_run(&ring, 2, cqes);
+    ring_setup(NULL);
+
+    // The write failed unless its completion says otherwise
+    ret = (n < 0) ? n : E_FAILURE;
+    for(int i = 0; i < n; i++) {
+        if(cqes[i].tag == 0) {
+            ret = cqes[i].result;
+        } else {
+            closed = true;
+        }
+    }
+    if(!closed) {
+        fclose(fp);
+    }
+
     if(ret < 0) {
         sprint(lineBuf, "*ERROR* in ap: Failed to write out to file %s (%d)", path, ret);
         swrites(lineBuf);
         return E_FAILURE;
     }
 
-    // Close the file and return
-    fclose(fp);
     return E_SUCCESS;
 
 }
@@ -7,6 +7,7 @@ int32_t cat(uint32_t arg1, uint32_t arg2) {
     char buf[128];
     char oBuf[130];
     int ret;
+    FILE in;
     int fp = fopen(path, false);
 
     if(fp < 0) {
@@ -16,20 +17,36 @@ int32_t cat(uint32_t arg1, uint32_t arg2) {
         return E_FAILURE;
     }
 
-    swrites("\r\n");
-    while(true) {
-        ret = fReadLn(fp, buf, 128);
-        if(ret == E_EOF) {
-            break;
-        } else if (ret < 0) {
-            sprint(oBuf, "*ERROR* in cat: File read error (%d)\r\n", ret);
+    printf("\r\n");
+
+    if(arg2) {
+        // Raw dumps go straight from the file to the SIO
+        fflush(CHAN_SIO);
+        do {
+            ret = splice(fp, CHAN_SIO, 4096);
+        } while(ret > 0);
+
+        if(ret != E_EOF) {
+            sprint(oBuf, "*ERROR* in cat: File splice error (%d)\r\n", ret);
             swrites(oBuf);
             cwrites(oBuf);
             return E_FAILURE;
         }
+    } else {
+        finit(&in, fp);
+        while(true) {
+            ret = fgetLn(&in, buf, 128);
+            if(ret == E_EOF) {
+                break;
+            } else if (ret < 0) {
+                sprint(oBuf, "*ERROR* in cat: File read error (%d)\r\n", ret);
+                swrites(oBuf);
+                cwrites(oBuf);
+                return E_FAILURE;
+            }
 
-        sprint(oBuf, "%s\r\n", buf);
-        swrites(oBuf);
+            printf("%s\r\n", buf);
+        }
     }
 
     ret = fclose(fp);
@@ -0,0 +1,37 @@
+#ifndef FREE_H_
+#define FREE_H_
+
+#include "common.h"
+
+int32_t free(uint32_t arg1, uint32_t arg2) {
+    static const char * tagNames[N_KMTAGS] = KM_TAG_NAMES;
+    meminfo_t info;
+    int ret;
+
+    ret = meminfo(&info);
+    if(ret < 0) {
+        printf("*ERROR* in free: meminfo failed (%d)\r\n", ret);
+        return E_FAILURE;
+    }
+
+    // Page totals (in KB)
+    printf("\r\n          total      used      free   low free\r\n");
+    printf("pages  %7dK  %7dK  %7dK  %7dK\r\n", info.total * 4, 
+            (info.total - info.free) * 4, info.free * 4, info.low * 4);
+
+    // Per-subsystem usage (in bytes); slab pages also hold the objects 
+    // counted under the other tags
+    printf("\r\ntag       in use      peak    allocs     frees  fails\r\n");
+    for(int i = 0; i < N_KMTAGS; i++) {
+        kmstat_t * stat = &info.tags[i];
+        printf("%-6s %9d %9d %9d %9d %6d\r\n", tagNames[i], stat->inuse, 
+                stat->peak, stat->allocs, stat->frees, stat->fails);
+    }
+
+    printf("\r\nspawn pool: %d of %d warm processes\r\n", info.pool,
+            info.pool_target);
+
+    return E_SUCCESS;
+}
+
+#endif
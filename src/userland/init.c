@@ -37,11 +37,7 @@ int init( uint32_t arg1, uint32_t arg2 ) {
     // a bit of Dante to set the mood
     swrites( "\n\nSpem relinquunt qui huc intrasti!\n\n\r" );
 
-    // start by spawning the idle process
-    whom = spawn( idle, PRIO_LOWEST, '.', 0 );
-    if( whom < 0 ) {
-        cwrites( "init, spawn() of idle failed!!!\n" );
-    }
+    // (the idle process lives in the kernel; see _idle_loop())
 
     /*
     ** Start all the other users
@@ -2,24 +2,22 @@
 #define LS_H_
 
 #include "common.h"
+#include "syscalls.h"
 
-void getEntry(char * oBuf, inode_t node, const char * name) {
-    sprint(oBuf, "    %c%c%c%c%c%c%c", 
+// directory entries looked up per submit()
+#define LS_BATCH 8
+
+void printEntry(inode_t node, const char * name) {
+    printf("    %c%c%c%c%c%c%c    %04x  %04x    %s%s\r\n", 
             (node.nodeType == INODE_DIR_TYPE) ? 'd' : '-',
             (node.permissions & 0x20) ? 'w' : '-',
             (node.permissions & 0x10) ? 'r' : '-',
             (node.permissions & 0x08) ? 'w' : '-',
             (node.permissions & 0x04) ? 'r' : '-',
             (node.permissions & 0x02) ? 'w' : '-',
-            (node.permissions & 0x01) ? 'r' : '-');
-
-    sprint(oBuf + strlen(oBuf), "    %04x", node.uid);
-    sprint(oBuf + strlen(oBuf), "  %04x", node.gid);
-    
-    sprint(oBuf + strlen(oBuf), "    %s", name);
-    
-    if(node.nodeType == INODE_DIR_TYPE) strcat(oBuf, "/");
-    strcat(oBuf, "\r\n");
+            (node.permissions & 0x01) ? 'r' : '-',
+            node.uid, node.gid, name,
+            (node.nodeType == INODE_DIR_TYPE) ? "/" : "");
 }
 
 int32_t ls(uint32_t arg1, uint32_t arg2) {
@@ -27,8 +25,7 @@ int32_t ls(uint32_t arg1, uint32_t arg2) {
 
     char * path = (char *) arg1;
     char oBuf[oBufSz];
-    char nBuf[MAX_FILENAME_SIZE + 1];
-    inode_t node, child;
+    inode_t node;
     int ret;
 
     // Read in the current entry
@@ -47,43 +44,89 @@ int32_t ls(uint32_t arg1, uint32_t arg2) {
     }
 
     // Print the current directory
-    swrites("\r\n");
-    getEntry(oBuf, node, ".");
-    swrites(oBuf);
-
-    // Print all child directories
-    for(int i = 0; i < node.nBytes; i++) {
-        // Get the child's name
-        ret = dirname(path, nBuf, i);
-        if(ret < 0) {
-            sprint(oBuf, "*ERROR* in ls: failed to get inode %d at path \"%s\"\r\n", i, path);
+    printf("\r\n");
+    printEntry(node, ".");
+
+    // Print all child directories, a batch at a time: one ring batch for
+    // the names, then one for the inodes
+    ring_t ring;
+    char nBufs[LS_BATCH][MAX_FILENAME_SIZE + 1];
+    char pBufs[LS_BATCH][oBufSz];
+    inode_t children[LS_BATCH];
+    rcqe_t cqes[LS_BATCH];
+
+    ret = ring_setup(&ring);
+    if(ret < 0) {
+        sprint(oBuf, "*ERROR* in ls: failed to set up the ring (%d)\r\n", ret);
+        cwrites(oBuf);
+        return E_FAILURE;
+    }
+
+    for(int i = 0; i < node.nBytes; i += LS_BATCH) {
+        int n = node.nBytes - i;
+        if(n > LS_BATCH) {
+            n = LS_BATCH;
+        }
+
+        // Get the children's names
+        for(int j = 0; j < n; j++) {
+            ring_queue(&ring, SYS_dirname, (uint32_t) path,
+                       (uint32_t) nBufs[j], i + j, j);
+        }
+        ret = ring_run(&ring, n, cqes);
+        if(ret != n) {
+            sprint(oBuf, "*ERROR* in ls: ran %d of %d dirname calls\r\n", ret, n);
             cwrites(oBuf);
+            ring_setup(NULL);
             return E_FAILURE;
         }
-
-        // Genearte the path
-        if(*path) {
-            strcpy(oBuf, path);
-            strcat(oBuf, "/");
-        } else {
-            oBuf[0] = 0;
+        for(int j = 0; j < n; j++) {
+            if(cqes[j].result < 0) {
+                sprint(oBuf, "*ERROR* in ls: failed to get inode %d at path \"%s\"\r\n", i + cqes[j].tag, path);
+                cwrites(oBuf);
+                ring_setup(NULL);
+                return E_FAILURE;
+            }
         }
-        strcat(oBuf, nBuf);
 
-        // Get the child
-        ret = getinode(oBuf, &child);
-        if(ret < 0) {
-            sprint(oBuf, "*ERROR* in ls: failed to get inode at path \"%s\"\r\n", oBuf);
+        // Generate the paths, and get the children
+        for(int j = 0; j < n; j++) {
+            if(*path) {
+                strcpy(pBufs[j], path);
+                strcat(pBufs[j], "/");
+            } else {
+                pBufs[j][0] = 0;
+            }
+            strcat(pBufs[j], nBufs[j]);
+
+            ring_queue(&ring, SYS_getinode, (uint32_t) pBufs[j],
+                       (uint32_t) &children[j], 0, j);
+        }
+        ret = ring_run(&ring, n, cqes);
+        if(ret != n) {
+            sprint(oBuf, "*ERROR* in ls: ran %d of %d getinode calls\r\n", ret, n);
             cwrites(oBuf);
+            ring_setup(NULL);
             return E_FAILURE;
         }
+        for(int j = 0; j < n; j++) {
+            if(cqes[j].result < 0) {
+                sprint(oBuf, "*ERROR* in ls: failed to get inode at path \"%s\"\r\n", pBufs[cqes[j].tag]);
+                cwrites(oBuf);
+                ring_setup(NULL);
+                return E_FAILURE;
+            }
+        }
 
-        // Print the child
-        getEntry(oBuf, child, nBuf);
-        swrites(oBuf);
-
+        // Print the children
+        for(int j = 0; j < n; j++) {
+            printEntry(children[j], nBufs[j]);
+        }
     }
 
+    // The ring lives on our stack
+    ring_setup(NULL);
+
     return E_SUCCESS;
 }
 
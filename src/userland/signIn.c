@@ -19,6 +19,7 @@ int getShadowField(const char* lineBuf, char* outBuf, int outBufLen) {
 int getShadowLine(const char* nameBuf, char * dataBuf, int dataBufLen) {
     int fp, ret;
     char tmpBuf[MAX_UNAME_SIZE];
+    FILE shadow;
     
     fp = fopen("/.shadow", false);
     if(fp < 0) {
@@ -26,9 +27,11 @@ int getShadowLine(const char* nameBuf, char * dataBuf, int dataBufLen) {
         return fp;
     }
 
+    finit(&shadow, fp);
+
     // Try to match name against each line in the shadow buffer
     bool_t matched = false;
-    for(ret = fReadLn(fp, dataBuf, dataBufLen); ret >= 0; ret = fReadLn(fp, dataBuf, dataBufLen)) {
+    for(ret = fgetLn(&shadow, dataBuf, dataBufLen); ret >= 0; ret = fgetLn(&shadow, dataBuf, dataBufLen)) {
         if(ret == 0) continue;
         // Extract the name from the data
         int nameLen = getShadowField(dataBuf, tmpBuf, MAX_UNAME_SIZE);
@@ -0,0 +1,47 @@
+#ifndef SYSBENCH_H_
+#define SYSBENCH_H_
+
+#include "common.h"
+
+// calls per measurement; a power of two, to avoid a 64-bit division
+#define SYSBENCH_SHIFT  12
+#define SYSBENCH_CALLS  (1 << SYSBENCH_SHIFT)
+
+int32_t sysbench(uint32_t arg1, uint32_t arg2) {
+    uint64_t t0, t1, t2, t3;
+
+    // getprio() does next to nothing in the kernel, so this is
+    // (almost) all system call entry and exit
+    if(gettime_ns(&t0) < 0) {
+        printf("*ERROR* in sysbench: gettime_ns failed\r\n");
+        return E_FAILURE;
+    }
+
+    for(int i = 0; i < SYSBENCH_CALLS; i++) {
+        (void) getprio();
+    }
+    gettime_ns(&t1);
+
+    for(int i = 0; i < SYSBENCH_CALLS; i++) {
+        (void) getprio_int();
+    }
+    gettime_ns(&t2);
+
+    // and getpid() doesn't enter the kernel at all
+    for(int i = 0; i < SYSBENCH_CALLS; i++) {
+        (void) getpid();
+    }
+    gettime_ns(&t3);
+
+    printf("\r\nnull system call, %d calls each:\r\n", SYSBENCH_CALLS);
+    printf("  fast entry  %6d ns/call\r\n", 
+            (uint32_t) ((t1 - t0) >> SYSBENCH_SHIFT));
+    printf("  int $0x80   %6d ns/call\r\n", 
+            (uint32_t) ((t2 - t1) >> SYSBENCH_SHIFT));
+    printf("  vdata read  %6d ns/call\r\n", 
+            (uint32_t) ((t3 - t2) >> SYSBENCH_SHIFT));
+
+    return E_SUCCESS;
+}
+
+#endif
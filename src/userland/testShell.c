@@ -12,10 +12,10 @@ int32_t testShell(uint32_t arg1, uint32_t arg2) {
     int ret;
 
 
-    swrites("Test shell started\r\nTry help for a list of commands\r\n\n");
+    printf("Test shell started\r\nTry help for a list of commands\r\n\n");
 
     while (true) {
-        swrites("$ ");
+        printf("$ ");
         nRead = readLn(CHAN_SIO, iBuf, iBufSz, true);
         if(nRead < 0) {
             cwrites("TEST SHELL: **ERROR** encountered on line read\n");
@@ -26,34 +26,38 @@ int32_t testShell(uint32_t arg1, uint32_t arg2) {
         if(nRead == 0) {    // Skip empty commands
             continue;
         } else if(strcmp(iBuf, "help") == 0) {  // Print command lists
-            swrites("Main test shell help:\r\n");
-            swrites("\thelp: prints this screen\r\n");
-            swrites("\tlist [bank]: List all tests (if bank is specified, all tests in it)\r\n");
-            swrites("\ttest <bank> <test>: perform test x from bank n\r\n");
-
-            swrites("\r\n\tlogout: return to sign in\r\n");
-            swrites("\tcls: clear the screen (print several lines to console)\r\n");
-
-            swrites("\r\n\tsetgid [GID]: Set a new GID (defaults to user GID 0)\r\n");
-            swrites("\tchown <uid> <gid> <path>: Set a new group and user owner for path\r\n");
-            swrites("\tchmod <permStr> <path>: Set new permissions for path\r\n");
-            swrites("\tsudo: Toggles sudo mode\r\n");
+            printf("Main test shell help:\r\n");
+            printf("\thelp: prints this screen\r\n");
+            printf("\tlist [bank]: List all tests (if bank is specified, all tests in it)\r\n");
+            printf("\ttest <bank> <test>: perform test x from bank n\r\n");
+
+            printf("\r\n\tlogout: return to sign in\r\n");
+            printf("\tcls: clear the screen (print several lines to console)\r\n");
+
+            printf("\r\n\tsetgid [GID]: Set a new GID (defaults to user GID 0)\r\n");
+            printf("\tchown <uid> <gid> <path>: Set a new group and user owner for path\r\n");
+            printf("\tchmod <permStr> <path>: Set new permissions for path\r\n");
+            printf("\tsudo: Toggles sudo mode\r\n");
             
-            swrites("\r\n\tcat <file path>: Cat the file contents out to the console\r\n");
-            swrites("\tls <file path>: Print the contents and permissions of the subdirectory\r\n");
-            swrites("\tap <file path>: Append a line to a file\r\n");
-            swrites("\trm <file path>: Remove a directory entry\r\n");
-            swrites("\tcd <file path>: Change the working directory\r\n");
+            printf("\r\n\tcat <file path>: Cat the file contents out to the console\r\n");
+            printf("\tdump <file path>: Send the raw file contents to the console\r\n");
+            printf("\tls <file path>: Print the contents and permissions of the subdirectory\r\n");
+            printf("\tap <file path>: Append a line to a file\r\n");
+            printf("\trm <file path>: Remove a directory entry\r\n");
+            printf("\tcd <file path>: Change the working directory\r\n");
+            printf("\r\n\tfree: Show kernel memory usage\r\n");
+            printf("\tsysbench: Time a null system call\r\n");
+            printf("\taiotest <file path>: Read a file with aread() and await()\r\n");
 
 
         } else if(strcmp(iBuf, "exit") == 0 || strcmp(iBuf, "logoff") == 0 || 
             strcmp(iBuf, "logout") == 0 || strcmp(iBuf, "`") == 0) {    // Exit
-            swrites("Exiting\r\n");
+            printf("Exiting\r\n");
             exit(0);
 
         } else if (strcmp(iBuf, "cls") == 0){   // Clear the screen
             for(int i = 0; i < 80; i++) {
-                swrites("\r\n");
+                printf("\r\n");
             }
         } else if(strncmp(iBuf, "list", 4) == 0) {  // list tests
             char* tmp = &iBuf[4];
@@ -66,14 +70,14 @@ int32_t testShell(uint32_t arg1, uint32_t arg2) {
 
             while(*tmp == ' ' && *tmp) tmp++;
             if(*tmp == 0) {
-                swrites("Usage: test <bank> <test>\r\n");
+                printf("Usage: test <bank> <test>\r\n");
                 continue;
             }
             char ch1 = *tmp++;
 
             while(*tmp == ' ' && *tmp) tmp++;
             if(*tmp == 0) {
-                swrites("Usage: test <bank> <test>\r\n");
+                printf("Usage: test <bank> <test>\r\n");
                 continue;
             }
 
@@ -110,13 +114,11 @@ int32_t testShell(uint32_t arg1, uint32_t arg2) {
             result = setgid(gid);
 
             if(result < 0) {
-                sprint(oBuf, "Failed to set GID to %d (exit code %d)\r\n", gid, result);
+                printf("Failed to set GID to %d (exit code %d)\r\n", gid, result);
             } else {
-                sprint(oBuf, "Set GID to %d (exit code %d)\r\n", gid, result);
+                printf("Set GID to %d (exit code %d)\r\n", gid, result);
             }
 
-            swrites(oBuf);
-
         } else if (strncmp(iBuf, "chown", 5) == 0) {
             nRead = strTrim(oBuf, &iBuf[6]);
             char modBuf[32];
@@ -136,7 +138,7 @@ int32_t testShell(uint32_t arg1, uint32_t arg2) {
             
             nRead = strTrim(oBuf, modBuf);
             if(nRead <= 0) {
-                swrites("SHELL: No uid specified for chown\r\n");
+                printf("SHELL: No uid specified for chown\r\n");
             }
             uid_t uid = str2int(modBuf, 10);
 
@@ -149,7 +151,7 @@ int32_t testShell(uint32_t arg1, uint32_t arg2) {
             
             nRead = strTrim(oBuf, modBuf);
             if(nRead <= 0) {
-                swrites("SHELL: No gid specified for chown\r\n");
+                printf("SHELL: No gid specified for chown\r\n");
             }
             gid_t gid = str2int(modBuf, 10);
 
@@ -178,18 +180,39 @@ int32_t testShell(uint32_t arg1, uint32_t arg2) {
 
             ret = cat((uint32_t)&oBuf, 0);
             if(ret < 0) {
-                sprint(iBuf, "Failed to cat file \"%s\"\r\n", oBuf);
-                swrites(iBuf);
+                printf("Failed to cat file \"%s\"\r\n", oBuf);
+            }
+
+
+        } else if(strncmp(iBuf, "dump", 4) == 0) {
+            strTrim(oBuf, iBuf + 4);
+
+            ret = cat((uint32_t)&oBuf, true);
+            if(ret < 0) {
+                printf("Failed to dump file \"%s\"\r\n", oBuf);
             }
 
 
+        } else if(strcmp(iBuf, "free") == 0) {
+            free(0, 0);
+
+        } else if(strcmp(iBuf, "sysbench") == 0) {
+            sysbench(0, 0);
+
+        } else if(strncmp(iBuf, "aiotest", 7) == 0) {
+            strTrim(oBuf, iBuf + 7);
+
+            ret = aiotest((uint32_t)&oBuf, 0);
+            if(ret < 0) {
+                printf("Failed to aiotest file \"%s\"\r\n", oBuf);
+            }
+
         } else if(strncmp(iBuf, "ls", 2) == 0) {
             strTrim(oBuf, iBuf + 2);
 
             ret = ls((uint32_t)&oBuf, 0);
             if(ret < 0) {
-                sprint(iBuf, "Failed to ls directory \"%s\"\r\n", oBuf);
-                swrites(iBuf);
+                printf("Failed to ls directory \"%s\"\r\n", oBuf);
             }
 
 
@@ -198,8 +221,7 @@ int32_t testShell(uint32_t arg1, uint32_t arg2) {
 
             ret = ap((uint32_t)&oBuf, 0);
             if(ret < 0) {
-                sprint(iBuf, "Failed to append line to file \"%s\"\r\n", oBuf);
-                swrites(iBuf);
+                printf("Failed to append line to file \"%s\"\r\n", oBuf);
             }
         } else if(strncmp(iBuf, "rm", 2) == 0) {
             strTrim(oBuf, iBuf + 2);
@@ -219,8 +241,7 @@ int32_t testShell(uint32_t arg1, uint32_t arg2) {
 
             ret = fremove((i == 0) ? "" : oBuf, nBuf);
             if(ret < 0) {
-                sprint(iBuf, "Failed to remove file \"%s\" (%s)\r\n", nBuf, oBuf);
-                swrites(iBuf);
+                printf("Failed to remove file \"%s\" (%s)\r\n", nBuf, oBuf);
             }
         } else if(strncmp(iBuf, "mkdir", 5) == 0) {
             strTrim(oBuf, iBuf + 5);
@@ -240,8 +261,7 @@ int32_t testShell(uint32_t arg1, uint32_t arg2) {
 
             ret = fcreate((i == 0) ? "" : oBuf, nBuf, false);
             if(ret < 0) {
-                sprint(iBuf, "Failed to create directory \"%s\" (%s)\r\n", nBuf, oBuf);
-                swrites(iBuf);
+                printf("Failed to create directory \"%s\" (%s)\r\n", nBuf, oBuf);
             }
             
         } else if (strncmp(iBuf, "cd", 2) == 0) {
@@ -249,26 +269,24 @@ int32_t testShell(uint32_t arg1, uint32_t arg2) {
             
             ret = setDir(iBuf);
             if(ret < 0) {
-                sprint(oBuf, "Failed to change working directory to \"%s\"\r\n", iBuf);
-                swrites(oBuf);
+                printf("Failed to change working directory to \"%s\"\r\n", iBuf);
             }
         } else if (strcmp(iBuf, "sudo") == 0) {
             if(getgid() != GID_SUDO) {
                 if(setgid(GID_SUDO) < 0) {
-                    swrites("Failed to enter sudo mode\r\n");
+                    printf("Failed to enter sudo mode\r\n");
                 }
             } else {
                 if(setgid(GID_USER) < 0) {
-                    swrites("Failed to leave sudo mode\r\n");
+                    printf("Failed to leave sudo mode\r\n");
                 }
             }
             
         } else {    //Unknown Command
-            sprint(oBuf, "Uncrecognized command \"%s\", try \"help\"", iBuf);
-            swrites(oBuf);
+            printf("Uncrecognized command \"%s\", try \"help\"", iBuf);
         }
         
-        swrites("\r\n");
+        printf("\r\n");
 
     }
 
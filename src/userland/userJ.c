@@ -8,11 +8,11 @@
 **
 ** Invoked as:  userJ  x  n
 **   where x is the ID character
-**         n is the number of children to spawn (defaults to 2 * N_PROCS)
+**         n is the number of children to spawn (defaults to 50)
 */
 
 int32_t userJ( uint32_t arg1, uint32_t arg2 ) {
-    int count = 2 * N_PROCS;   // number of children to spawn
+    int count = 50;            // number of children to spawn
     char ch = 'J';             // default character to print
     char ch2;                  // secondary char to send to 'Y'
 
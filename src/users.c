@@ -34,8 +34,6 @@
 ** for completeness)
 */
 
-int32_t idle( uint32_t, uint32_t );
-
 int32_t main1( uint32_t, uint32_t ); int32_t main2( uint32_t, uint32_t );
 int32_t main3( uint32_t, uint32_t ); int32_t main4( uint32_t, uint32_t );
 int32_t main5( uint32_t, uint32_t ); int32_t main6( uint32_t, uint32_t );
@@ -66,6 +64,8 @@ int32_t signIn(uint32_t, uint32_t ); int32_t testShell(uint32_t , uint32_t );
 
 int32_t cat(uint32_t, uint32_t);     int32_t ls(uint32_t, uint32_t);
 int32_t chmod(uint32_t, uint32_t);   int32_t ap(uint32_t, uint32_t);
+int32_t free(uint32_t, uint32_t);    int32_t sysbench(uint32_t, uint32_t);
+int32_t aiotest(uint32_t, uint32_t);
 
 /*
 ** The user processes
@@ -116,7 +116,6 @@ int32_t chmod(uint32_t, uint32_t);   int32_t ap(uint32_t, uint32_t);
 */
 
 #include "userland/init.c"
-#include "userland/idle.c"
 
 #include "userland/signIn.c"
 #include "userland/testShell.c"
@@ -125,3 +124,6 @@ int32_t chmod(uint32_t, uint32_t);   int32_t ap(uint32_t, uint32_t);
 #include "userland/ls.c"
 #include "userland/chmod.c"
 #include "userland/ap.c"
+#include "userland/free.c"
+#include "userland/sysbench.c"
+#include "userland/aiotest.c"
@@ -153,15 +153,6 @@
 */
 int32_t init( uint32_t arg1, uint32_t arg2 );
 
-/**
-** idle - the idle process
-**
-** Reports itself, then loops forever delaying and printing a character.
-**
-** Invoked as:  idle
-*/
-int32_t idle( uint32_t arg1, uint32_t arg2 );
-
 #endif
 /* SP_ASM_SRC */
 
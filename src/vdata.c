@@ -0,0 +1,72 @@
+/**
+** @file vdata.c
+**
+** @author CSCI-452 class of 20205
+**
+** Kernel data page readable by user code
+**
+** getpid(), getppid(), getuid(), getgid(), and gettime() read this
+** directly (see ulibs.S), rather than making a system call.
+*/
+
+#define SP_KERNEL_SRC
+
+#include "common.h"
+
+#include "vdata.h"
+
+/*
+** PRIVATE DEFINITIONS
+*/
+
+// keep the compiler from moving the stores across the count updates
+#define BARRIER()   __asm__ __volatile__( "" ::: "memory" )
+
+/*
+** PRIVATE DATA TYPES
+*/
+
+/*
+** PRIVATE GLOBAL VARIABLES
+*/
+
+/*
+** PUBLIC GLOBAL VARIABLES
+*/
+
+vdata_t _vdata __attribute__((aligned(4096)));
+
+/*
+** PUBLIC FUNCTIONS
+*/
+
+/**
+** _vdata_time(now)
+**
+** Publish a new system time
+**
+** @param now   The new time
+*/
+void _vdata_time( time_t now ) {
+
+    ++_vdata.seq;
+    BARRIER();
+    _vdata.time = now;
+    BARRIER();
+    ++_vdata.seq;
+}
+
+/**
+** _vdata_switch(pcb)
+**
+** Publish the IDs of the process about to run (or whose IDs changed)
+**
+** @param pcb   The process
+*/
+void _vdata_switch( pcb_t *pcb ) {
+
+    _vdata.pid  = pcb->pid;
+    _vdata.ppid = pcb->ppid;
+    _vdata.uid  = pcb->share->uid;
+    _vdata.gid  = pcb->share->gid;
+}
@@ -0,0 +1,90 @@
+/**
+** @file vdata.h
+**
+** @author CSCI-452 class of 20205
+**
+** Kernel data page readable by user code
+*/
+
+#ifndef VDATA_H_
+#define VDATA_H_
+
+/*
+** General (C and/or assembly) definitions
+*/
+
+// Byte offsets of the fields of vdata_t, for the user library's
+// assembly-language readers.  KEEP THESE IN SYNC WITH vdata_t!
+
+#define VDATA_SEQ       0
+#define VDATA_TIME      4
+#define VDATA_PID       8
+#define VDATA_PPID      12
+#define VDATA_UID       16
+#define VDATA_GID       20
+
+#ifndef SP_ASM_SRC
+
+/*
+** Start of C-only definitions
+*/
+
+#include "common.h"
+
+#include "process.h"
+
+/*
+** Types
+*/
+
+// The system time, and the identity of the current process.
+//
+// The time is guarded by a sequence count, which is odd while the
+// clock is updating it; a reader takes the count, the time, and the
+// count again, and retries if the count was odd or has changed.
+//
+// The IDs describe whichever process is running, and are refreshed
+// by the dispatcher, so each process sees its own.
+
+typedef struct vdata_s {
+    volatile uint32_t seq;      // sequence count
+    volatile time_t time;       // copy of _system_time
+    volatile pid_t pid;         // current process' PID
+    volatile pid_t ppid;        // ... its parent's PID
+    volatile uint32_t uid;      // ... its user ID
+    volatile uint32_t gid;      // ... and its group ID
+} vdata_t;
+
+/*
+** Globals
+*/
+
+// page-aligned, so that it could be mapped read-only into user space
+extern vdata_t _vdata;
+
+/*
+** Prototypes
+*/
+
+/**
+** _vdata_time(now)
+**
+** Publish a new system time
+**
+** @param now   The new time
+*/
+void _vdata_time( time_t now );
+
+/**
+** _vdata_switch(pcb)
+**
+** Publish the IDs of the process about to run (or whose IDs changed)
+**
+** @param pcb   The process
+*/
+void _vdata_switch( pcb_t *pcb );
+
+#endif
+/* SP_ASM_SRC */
+
+#endif